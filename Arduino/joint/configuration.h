@@ -14,6 +14,10 @@
 #ifndef CONFIGURATION_H
 #define CONFIGURATION_H
 
+/*
+ * MAXACCEL and MAXVEL are defaults only: the limits can be changed at runtime with SETMAXACCELERATION, SETMAXVELOCITY
+ * and SETCONTROLTHRESHOLD and stored in flash with STORECONFIG, the stored configuration replaces the defaults at boot.
+ */
 #if defined(J1)
 /** Test C documentation. */
 #define ADR 0x11
@@ -53,7 +57,84 @@
  * If set to high stalls might trigger since PID error grows too large.
  */
 #define MAXVEL 800
+
 #error "No Joint has been defined. Define one of 'JX' where X 1,2,3,4"
 #endif
 
+#ifndef CONTROL_THRESHOLD
+/**
+ * @brief Default control threshold of the closed loop in microsteps, the error tolerated before making a corrective action.
+ */
+#define CONTROL_THRESHOLD 15
+#endif
+
+#ifndef CONFIG_ADDR
+/**
+ * @brief Address of the stored configuration in the EEPROM emulation of the flash, see STORECONFIG.
+ * Moved behind the first bytes in case the UstepperS32 library keeps its own settings there.
+ */
+#define CONFIG_ADDR 0x100
+#endif
+
+#ifndef I2C_CLOCK
+/**
+ * @brief I2C clock speed in Hz, 400000 selects fast mode.
+ * Must match the bus speed of the host, see calibrateBusSpeed() of the joint_communication package.
+ */
+#define I2C_CLOCK 400000
+#endif
+
+/**
+ * @brief Optional RS-485 transport.
+ *
+ * Define RS485_PORT as the HardwareSerial connected to the transceiver to answer framed requests
+ * in addition to I2C. RS485_DE_PIN drives the driver enable of the transceiver if it does not switch automatically.
+ */
+// #define RS485_PORT Serial1
+// #define RS485_DE_PIN PA8
+
+#ifndef LOOP_RATE_HZ
+/**
+ * @brief Rate of the control tick in Hz, see tickEvent().
+ * Stall detection, homing, trajectory playback, interpolation and the state byte are updated once per tick.
+ */
+#define LOOP_RATE_HZ 1000
+#endif
+
+#ifndef LOOP_TIMER
+/**
+ * @brief Hardware timer generating the control tick, must not be used by the UstepperS32 library.
+ */
+#define LOOP_TIMER TIM11
+#endif
+
+#ifndef TRACE_LEVEL
+/**
+ * @brief Events up to this level are recorded in the trace buffer, see TRACE(). TRACE_LEVEL_OFF compiles tracing out.
+ */
+#define TRACE_LEVEL TRACE_LEVEL_INFO
+#endif
+
+#ifndef TRACE_SERIAL
+/**
+ * @brief If 1 the trace buffer is printed to the serial console while the main loop is idle, see trace_drain().
+ * Set to 0 to keep the events until the host reads them with GETTRACE.
+ */
+#define TRACE_SERIAL 1
+#endif
+
+#ifndef HOME_TIMEOUT_MS
+/**
+ * @brief Homing is aborted if the end stop is not reached within this time in ms, see home_update().
+ */
+#define HOME_TIMEOUT_MS 30000
+#endif
+
+#ifndef RS485_BAUD
+/**
+ * @brief Baud rate of the RS-485 transport, must match the RS485_backend of the host.
+ */
+#define RS485_BAUD 1000000
+#endif
+
 #endif
@@ -8,6 +8,7 @@
  * @copyright Copyright (c) 2025
  *
  * This file contains definitions and macros for the joint firmware.
+ * It shall be included after configuration.h, which sets TRACE_LEVEL.
  *
  */
 
@@ -21,9 +22,39 @@
 /**
  * @brief Maximum size of I2C Payload in bytes
  *
- * 4 bytes used to transmit floats and int32_t
+ * Together with the register byte, the return flags and the framing (I2C_FRAME_OVERHEAD)
+ * a transaction stays within the 32 byte buffer of the Wire library.
  */
-#define MAX_BUFFER 4 // Bytes
+#define MAX_BUFFER 28 // Bytes
+
+/**
+ * @brief Set in the register byte of a framed transaction, see receiveEvent().
+ *
+ * The registers are below 0x80, hence legacy transactions without framing are still served.
+ */
+#define I2C_FRAMED 0x80
+
+/**
+ * @brief Protocol version in the upper two bits of the frame header, the lower six bits are the payload length.
+ */
+#define I2C_FRAME_VERSION 1
+
+/**
+ * @brief Size of the framing in bytes: header and CRC.
+ */
+#define I2C_FRAME_OVERHEAD 2
+
+/**
+ * @brief BIT4 of the return flags: the framed command was rejected, since its length, version or CRC did not match.
+ */
+#define I2C_FRAME_ERROR (1 << 4)
+
+/**
+ * @brief I2C general call address, also the broadcast address of the RS-485 link.
+ *
+ * All joints accept COMMIT sent to this address, hence the latched targets of all joints are committed by one transaction.
+ */
+#define I2C_GENERAL_CALL 0x00
 
 /**
  * @brief Size of the return flags in bytes
@@ -32,6 +63,13 @@
  */
 #define RFLAGS_SIZE 1
 
+/**
+ * @brief Frame constants of the RS-485 transport, see rs485_poll().
+ */
+#define FRAME_SYNC 0xA5     ///< first byte of every frame
+#define FRAME_REPLY 0x80    ///< set in the address byte of replies
+#define FRAME_OVERHEAD 5    ///< SYNC, ADDR, REG, LEN and CRC
+
 /**
  * @brief Macro to dump a buffer to the serial console.
  * 
@@ -71,9 +109,9 @@ enum stp_reg_t
   ANGLEMOVED = 0x18,          ///< R; Size: 4; [(float) degrees]
   SETCURRENT = 0x19,          ///< W; Size: 1; [(uint8) driveCurrent]
   SETHOLDCURRENT = 0x1A,      ///< W; Size: 1; [(uint8) holdCurrent]
-  SETMAXACCELERATION = 0x1B,  ///<
-  SETMAXDECELERATION = 0x1C,  ///<
-  SETMAXVELOCITY = 0x1D,      ///<
+  SETMAXACCELERATION = 0x1B,  ///< W; Size: 4; [(float) steps/s^2], see Joint_config
+  SETMAXDECELERATION = 0x1C,  ///< W; Size: 4; [(float) steps/s^2]
+  SETMAXVELOCITY = 0x1D,      ///< W; Size: 4; [(float) steps/s]
   ENABLESTALLGUARD = 0x1E,    ///< W; Size: 1; [(uint8) threshold]
   DISABLESTALLGUARD = 0x1F,   ///<
   CLEARSTALL = 0x20,          ///<
@@ -83,7 +121,7 @@ enum stp_reg_t
   DISABLEPID = 0x24,          ///<
   ENABLECLOSEDLOOP = 0x25,    ///<
   DISABLECLOSEDLOOP = 0x26,   ///< W; Size: 1; [(uint8) 0]
-  SETCONTROLTHRESHOLD = 0x27, ///<
+  SETCONTROLTHRESHOLD = 0x27, ///< W; Size: 4; [(float) microsteps]
   MOVETOEND = 0x28,           ///<
   STOP = 0x29,                ///< W; Size: 1; [(uint8) mode]
   GETPIDERROR = 0x2A,         ///<
@@ -91,19 +129,309 @@ enum stp_reg_t
   GETENCODERRPM = 0x2C,       ///< R; Size: 4; [(float) RPM]
   HOME = 0x2D,                ///< W; Size: 4; [(uint8) current, (uint8) sensitivity, (uint8) speed, (uint8) direction]
   ISHOMED = 0x2E,             ///< R; Size: 1; [(uint8) isStalled]
-  ISSETUP = 0x2F              ///< R; Size: 1; [(uint8) isStalled]
+  ISSETUP = 0x2F,             ///< R; Size: 1; [(uint8) isStalled]
+  GETSTATE = 0x30,            ///< R; Size: 12; [(float) degrees, (float) RPM, (float) PID error], see Joint_state
+  PUSHPVT = 0x31,             ///< W; Size: 12 - 24; [1 - 2 x (float) degrees, (float) degrees/s, (uint32) us], see Pvt_segment
+  SETINTERPOLATION = 0x32,    ///< W; Size: 1; [(uint8) mode], see interp_mode_t
+  LATCHANGLE = 0x33,          ///< W; Size: 4; [(float) degrees] target executed by the next COMMIT
+  COMMIT = 0x34,              ///< W; Size: 1; [(uint8) 0] moves to the latched target, also sent to I2C_GENERAL_CALL
+  GETCOMMITDELAY = 0x35,      ///< R; Size: 4; [(uint32) us] from the reception of the last COMMIT to its execution
+  GETHOMESTATE = 0x36,        ///< R; Size: 1; [(uint8) state], see home_state_t
+  GETLOOPSTATS = 0x37,        ///< R; Size: 12; [(uint32) ticks, (uint32) overruns, (uint32) us], see Loop_stats
+  GETTRACE = 0x38,            ///< R; Size: 26; [(uint8) count, (uint8) dropped, 3 x Trace_event], see Trace_batch
+  STARTCAPTURE = 0x39,        ///< W; Size: 4; [(uint16) divider, (uint16) samples] samples every divider control ticks, 0 samples stops
+  GETCAPTURE = 0x3A,          ///< R; Size: 28; [(uint16) index, (uint8) count, (uint8) active, 2 x Joint_state], see Capture_batch
+  STORECONFIG = 0x3B,         ///< W; Size: 1; [(uint8) action], see config_action_t
+  GETCONFIG = 0x3C            ///< R; Size: 16; [(float) steps/s^2, (float) steps/s^2, (float) steps/s, (float) microsteps], see Joint_config
+};
+
+/**
+ * @brief State of the homing started by HOME, read with GETHOMESTATE.
+ *
+ * While homing the BUSY flag is set, the main loop keeps running and serves all registers.
+ */
+enum home_state_t
+{
+  HOME_IDLE = 0,    ///< homing was not started since the last reset
+  HOME_RUNNING = 1, ///< running towards the end stop
+  HOME_DONE = 2,    ///< the end stop was reached, the joint is homed
+  HOME_TIMEOUT = 3, ///< the end stop was not reached within HOME_TIMEOUT_MS
+  HOME_ABORTED = 4  ///< aborted by STOP, SETUP or another motion command
+};
+
+/**
+ * @brief Payload of the GETSTATE register.
+ *
+ * The complete state of the joint in one read, the state byte follows as return flags.
+ */
+struct __attribute__((packed)) Joint_state
+{
+  float angle;    ///< stepper.angleMoved() in degrees
+  float rpm;      ///< stepper.encoder.getRPM()
+  float pidError; ///< stepper.getPidError() in steps
 };
 
+/**
+ * @brief Payload of the GETLOOPSTATS register.
+ *
+ * Counts the control ticks since the reset. A tick which arrives before the previous one has been served,
+ * e.g. during a long command like CHECKORIENTATION, is an overrun.
+ */
+struct __attribute__((packed)) Loop_stats
+{
+  uint32_t ticks;     ///< control ticks since the reset
+  uint32_t overruns;  ///< ticks which found the previous tick still pending
+  uint32_t maxTickUs; ///< longest run time of a tick in us
+};
+
+/**
+ * @brief Motion limits of the joint, payload of the GETCONFIG register.
+ *
+ * Initialized with MAXACCEL, MAXVEL and CONTROL_THRESHOLD or the configuration stored in flash,
+ * changed with SETMAXACCELERATION, SETMAXDECELERATION, SETMAXVELOCITY and SETCONTROLTHRESHOLD.
+ * Changes take effect immediately once the joint is setup.
+ */
+struct __attribute__((packed)) Joint_config
+{
+  float maxAcceleration;  ///< steps/s^2
+  float maxDeceleration;  ///< steps/s^2
+  float maxVelocity;      ///< steps/s
+  float controlThreshold; ///< microsteps
+};
+
+/**
+ * @brief Actions of the STORECONFIG register.
+ */
+enum config_action_t
+{
+  CONFIG_SAVE = 1,     ///< stores the configuration in flash, blocks the main loop while the flash is erased
+  CONFIG_LOAD = 2,     ///< restores the configuration stored in flash
+  CONFIG_DEFAULTS = 3  ///< restores MAXACCEL, MAXVEL and CONTROL_THRESHOLD, the flash is not changed
+};
+
+/**
+ * @brief Marks a stored configuration, see Config_record.
+ */
+#define CONFIG_MAGIC 0x4A
+
+/**
+ * @brief Layout version of Config_record, a stored configuration of another version is ignored.
+ */
+#define CONFIG_VERSION 1
+
+/**
+ * @brief Configuration as stored in flash at CONFIG_ADDR.
+ */
+struct __attribute__((packed)) Config_record
+{
+  uint8_t magic;       ///< CONFIG_MAGIC
+  uint8_t version;     ///< CONFIG_VERSION
+  Joint_config config; ///< stored configuration
+  uint8_t crc;         ///< crc8() of the preceding bytes
+};
+
+/**
+ * @brief Number of samples in the telemetry ring buffer, see STARTCAPTURE.
+ */
+#define CAPTURE_BUFFER 512
+
+/**
+ * @brief Number of samples per GETCAPTURE read.
+ */
+#define CAPTURE_BATCH 2
+
+/**
+ * @brief Payload of the GETCAPTURE register.
+ *
+ * A capture started by STARTCAPTURE takes a Joint_state sample every divider control ticks into a ring buffer,
+ * which overwrites the oldest sample when it is full. The samples are removed as they are read.
+ * \a index numbers the first sample of the batch since STARTCAPTURE, hence the host places the samples on the
+ * time line of the control tick and detects overwritten samples as gaps.
+ */
+struct __attribute__((packed)) Capture_batch
+{
+  uint16_t index;                      ///< index of samples[0] since STARTCAPTURE, wraps
+  uint8_t count;                       ///< valid samples, less than CAPTURE_BATCH once the buffer is empty
+  uint8_t active;                      ///< 1 while samples are taken
+  Joint_state samples[CAPTURE_BATCH];  ///< oldest first
+};
+
+static_assert(sizeof(Capture_batch) <= MAX_BUFFER, "GETCAPTURE payload exceeds MAX_BUFFER");
+
+/**
+ * @brief Trace levels, events above TRACE_LEVEL are compiled out, see TRACE().
+ */
+#define TRACE_LEVEL_OFF 0
+#define TRACE_LEVEL_ERROR 1 ///< rejected commands and failures
+#define TRACE_LEVEL_INFO 2  ///< state changes, e.g. a stall or the end of homing
+#define TRACE_LEVEL_DEBUG 3 ///< every command and read
+
+/**
+ * @brief Number of events in the trace ring buffer, see trace().
+ */
+#define TRACE_BUFFER 64
+
+/**
+ * @brief Number of events per GETTRACE read.
+ */
+#define TRACE_BATCH 3
+
+/**
+ * @brief Events of the trace buffer, the meaning of reg and arg of Trace_event is given per event.
+ */
+enum trace_event_t
+{
+  TRACE_COMMAND = 1,      ///< DEBUG; reg: command executed by the main loop
+  TRACE_READ = 2,         ///< DEBUG; reg: register read
+  TRACE_UNKNOWN = 3,      ///< ERROR; reg: register which is not implemented
+  TRACE_BAD_LENGTH = 4,   ///< ERROR; reg: command, arg: payload length
+  TRACE_BAD_VALUE = 5,    ///< ERROR; reg: command, arg: rejected value
+  TRACE_PVT_FULL = 6,     ///< ERROR; arg: segments dropped
+  TRACE_FRAME_ERROR = 7,  ///< INFO; reg: command of a framed transaction with wrong version, length or CRC, arg: bytes received
+  TRACE_STALL = 8,        ///< INFO; arg: PID error in steps
+  TRACE_HOME_DONE = 9,    ///< INFO
+  TRACE_HOME_TIMEOUT = 10, ///< ERROR
+  TRACE_OVERRUN = 11,     ///< INFO; arg: overruns since the reset, see GETLOOPSTATS
+  TRACE_CONFIG = 12       ///< INFO; reg: STORECONFIG, 0 at boot, arg: config_action_t executed, 0 if no configuration is stored
+};
+
+/**
+ * @brief Event of the trace buffer, see trace().
+ */
+struct __attribute__((packed)) Trace_event
+{
+  uint32_t time_us; ///< micros() when the event was recorded
+  uint8_t id;       ///< see trace_event_t
+  uint8_t reg;      ///< register the event refers to, 0 if none
+  int16_t arg;      ///< argument, see trace_event_t
+};
+
+/**
+ * @brief Payload of the GETTRACE register.
+ *
+ * The oldest events are removed from the trace buffer as they are read. A GETTRACE which is retried by the host
+ * hence loses the events of the failed transfer.
+ */
+struct __attribute__((packed)) Trace_batch
+{
+  uint8_t count;                    ///< valid events, less than TRACE_BATCH once the buffer is empty
+  uint8_t dropped;                  ///< events lost to a full buffer since the last GETTRACE, saturates at 255
+  Trace_event events[TRACE_BATCH];  ///< oldest first
+};
+
+static_assert(sizeof(Trace_batch) <= MAX_BUFFER, "GETTRACE payload exceeds MAX_BUFFER");
+
+/**
+ * @brief Records an event in the trace buffer, see joint.ino.
+ */
+void trace(uint8_t id, uint8_t reg, int16_t arg);
+
+/**
+ * @brief Records a trace event if \a level is enabled by TRACE_LEVEL, otherwise the call is compiled out.
+ *
+ * Nothing is formatted, hence it may be used in ISRs and at the loop rate.
+ * @param level one of TRACE_LEVEL_ERROR, TRACE_LEVEL_INFO or TRACE_LEVEL_DEBUG
+ * @param id event, see trace_event_t
+ * @param reg register the event refers to
+ * @param arg argument of the event
+ */
+#define TRACE(level, id, reg, arg)  \
+  do                                \
+  {                                 \
+    if ((level) <= TRACE_LEVEL)     \
+    {                               \
+      trace((id), (reg), (arg));    \
+    }                               \
+  } while (0)
+
+/**
+ * @brief Number of segments in the trajectory ring buffer, see PUSHPVT.
+ */
+#define PVT_BUFFER 32
+
+/**
+ * @brief Gain of the position feedback while a trajectory is played, in 1/s.
+ *
+ * The commanded velocity is the velocity of the trajectory plus PVT_KP times the position error.
+ */
+#define PVT_KP 10.0f
+
+/**
+ * @brief Segment of a streamed trajectory, payload of the PUSHPVT register.
+ *
+ * A segment ends at \a angle with \a velocity, \a duration_us after the end of the previous segment.
+ * Position and velocity in between are interpolated with a cubic Hermite spline, see hermite().
+ */
+struct __attribute__((packed)) Pvt_segment
+{
+  float angle;          ///< encoder degrees at the end of the segment
+  float velocity;       ///< encoder degrees/s at the end of the segment
+  uint32_t duration_us; ///< duration of the segment
+};
+
+/**
+ * @brief Interpolation of MOVETOANGLE setpoints, set with SETINTERPOLATION.
+ *
+ * With interpolation the setpoints are samples of a continuous trajectory. The joint estimates the sample period
+ * from their arrival and moves from the interpolated position to the latest setpoint within one period,
+ * tracking the interpolated position with velocity feed-forward and PVT_KP feedback at the loop rate.
+ */
+enum interp_mode_t
+{
+  INTERP_OFF = 0,    ///< every setpoint starts a motion profile of the uStepper
+  INTERP_LINEAR = 1, ///< constant velocity towards the latest setpoint
+  INTERP_CUBIC = 2   ///< cubic Hermite spline, the setpoint velocity is the difference to the previous setpoint
+};
+
+/**
+ * @brief Setpoints further apart than this start a new interpolation, in s.
+ *
+ * If no setpoint arrives within two periods, the joint stops at the latest setpoint.
+ */
+#define INTERP_MAX_PERIOD 0.2f
+
+/**
+ * @brief Sample period assumed until the second setpoint arrived, in s.
+ */
+#define INTERP_DEFAULT_PERIOD 0.02f
+
+/**
+ * @brief Evaluates the cubic Hermite spline from (p0, v0) to (p1, v1) of duration T at time t.
+ * @param p0 start position
+ * @param v0 start velocity
+ * @param p1 end position
+ * @param v1 end velocity
+ * @param T duration in s
+ * @param t time since the start in s, 0 - T
+ * @param p interpolated position
+ * @param v interpolated velocity
+ */
+inline void hermite(float p0, float v0, float p1, float v1, float T, float t, float &p, float &v)
+{
+  float s = T > 0 ? t / T : 1;
+  float s2 = s * s;
+  float s3 = s2 * s;
+  p = (2 * s3 - 3 * s2 + 1) * p0 + (s3 - 2 * s2 + s) * T * v0 + (-2 * s3 + 3 * s2) * p1 + (s3 - s2) * T * v1;
+  v = T > 0 ? (6 * s2 - 6 * s) / T * (p0 - p1) + (3 * s2 - 4 * s + 1) * v0 + (3 * s2 - 2 * s) * v1 : v1;
+}
+
 /**
  * @brief Reads a value from a buffer to a value of the specified type
  * @param val Reference to output variable
  * @param rxBuf Buffer to read value from
  * @param rx_length Length of the buffer
+ * @return 0 On success, -1 if the payload length does not match the type. \a val is not changed then.
  */
 template <typename T>
-void readValue(T &val, uint8_t *rxBuf, size_t rx_length)
+int readValue(T &val, uint8_t *rxBuf, size_t rx_length)
 {
-  memcpy(&val, rxBuf, rx_length);
+  if (rx_length != sizeof(T))
+  {
+    TRACE(TRACE_LEVEL_ERROR, TRACE_BAD_LENGTH, 0, rx_length);
+    return -1;
+  }
+  memcpy(&val, rxBuf, sizeof(T));
+  return 0;
 }
 
 /**
@@ -121,4 +449,24 @@ int writeValue(const T val, uint8_t *txBuf, size_t &tx_length)
   return 0;
 }
 
+/**
+ * @brief CRC-8 with polynomial 0x07 (CRC-8/SMBUS) used by the RS-485 and the framed I2C transactions.
+ * @param data bytes to check
+ * @param length number of bytes
+ * @param crc start value
+ * @return checksum
+ */
+inline uint8_t crc8(const uint8_t *data, size_t length, uint8_t crc = 0)
+{
+  for (size_t i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+    for (int b = 0; b < 8; b++)
+    {
+      crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+  }
+  return crc;
+}
+
 #endif
@@ -14,7 +14,7 @@
 #include <UstepperS32.h>
 
 #include <Wire.h>
-#include "joint.h"
+#include <EEPROM.h>
 
 /**
  * @brief Define either joint that is to be flashed
@@ -23,6 +23,7 @@
  */
 #define J1
 #include "configuration.h"
+#include "joint.h"
 
 
 UstepperS32 stepper;
@@ -33,6 +34,8 @@ static uint8_t isStalled = 0;
 static uint8_t isSetup = 0;
 static uint8_t isStallguardEnabled = 0;
 static int stallguardThreshold = 100;
+static Joint_config config = { MAXACCEL, MAXACCEL, MAXVEL, CONTROL_THRESHOLD };  ///< motion limits, see GETCONFIG
+static_assert(CONFIG_ADDR + sizeof(Config_record) <= E2END + 1, "CONFIG_ADDR exceeds the EEPROM emulation");
 
 uint8_t reg = 0;
 uint8_t rx_buf[MAX_BUFFER] = { 0 };
@@ -43,10 +46,128 @@ bool rx_data_ready = 0;
 size_t tx_length = 0;
 size_t rx_length = 0;
 
+static Pvt_segment pvt[PVT_BUFFER];  ///< trajectory ring buffer, see PUSHPVT
+static uint8_t pvt_head = 0;         ///< index of the segment being played
+static uint8_t pvt_count = 0;        ///< number of segments in the buffer
+static bool pvt_playing = 0;         ///< a trajectory is played
+static float pvt_p0, pvt_v0;         ///< position and velocity at the start of the played segment
+static uint32_t pvt_t0;              ///< micros() at the start of the played segment
+
+static uint8_t ip_mode = INTERP_OFF;         ///< interpolation of MOVETOANGLE setpoints, see SETINTERPOLATION
+static bool ip_active = 0;                   ///< setpoints are interpolated
+static uint8_t ip_samples = 0;               ///< setpoints since the interpolation started, saturates at 2
+static float ip_p0, ip_v0;                   ///< position and velocity at the arrival of the latest setpoint
+static float ip_p1, ip_v1;                   ///< latest setpoint and its velocity
+static float ip_period = INTERP_DEFAULT_PERIOD;  ///< estimated setpoint period in s
+static uint32_t ip_t0;                       ///< micros() at the arrival of the latest setpoint
+volatile uint32_t rx_stamp = 0;              ///< micros() at the reception of the last command
+volatile uint32_t commit_stamp = 0;          ///< micros() at the reception of the last COMMIT, rx_stamp is overwritten by reads
+
+static float latched_angle;        ///< target executed by the next COMMIT, see LATCHANGLE
+static bool latched = 0;           ///< a target is latched
+static uint32_t commit_delay = 0;  ///< us from the reception of the last COMMIT to its execution
+
+static uint8_t home_state = HOME_IDLE;  ///< see home_state_t and GETHOMESTATE
+static uint8_t home_sensitivity;        ///< PID error which detects the end stop
+static uint32_t home_t0;                ///< millis() at the start of homing
+
+static HardwareTimer *tick_timer;         ///< generates the control tick, see tickEvent()
+volatile bool tick_pending = 0;           ///< a control tick is due
+volatile uint32_t tick_count = 0;         ///< control ticks since the reset
+volatile uint32_t tick_overruns = 0;      ///< ticks which found the previous tick still pending
+static uint32_t tick_max_us = 0;          ///< longest run time of control_tick()
+
+static Joint_state capture_buf[CAPTURE_BUFFER];  ///< telemetry ring buffer, see STARTCAPTURE
+static uint16_t capture_head = 0;                ///< index of the oldest sample
+static uint16_t capture_count = 0;               ///< number of samples in the buffer
+static uint16_t capture_taken = 0;               ///< samples taken since STARTCAPTURE, wraps
+static uint16_t capture_left = 0;                ///< samples still to take, 0 if no capture runs
+static uint16_t capture_divider = 1;             ///< a sample is taken every capture_divider ticks
+static uint16_t capture_tick = 0;                ///< ticks since the last sample
+
+static Trace_event trace_buf[TRACE_BUFFER];  ///< trace ring buffer, see trace()
+static uint8_t trace_head = 0;               ///< index of the oldest event
+static uint8_t trace_count = 0;              ///< number of events in the buffer
+static uint8_t trace_dropped = 0;            ///< events lost since the last GETTRACE, saturates at 255
+
+bool framed = 0;       ///< the last I2C transaction is framed, see receiveEvent()
+bool command = 0;      ///< the last I2C transaction carries a payload
+bool frame_error = 0;  ///< the last framed command was rejected
+
 
 void stepper_receive_handler(uint8_t reg);
 void stepper_request_handler(uint8_t reg);
 
+/**
+ * @brief Records an event in the trace buffer, use TRACE() to compile it out by level.
+ *
+ * Safe to call from an ISR: nothing is formatted, the event is copied with interrupts disabled.
+ * If the buffer is full the event is dropped and counted.
+ * @param id event, see trace_event_t
+ * @param reg register the event refers to
+ * @param arg argument of the event
+ */
+void trace(uint8_t id, uint8_t reg, int16_t arg) {
+  Trace_event e = { micros(), id, reg, arg };
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  if (trace_count < TRACE_BUFFER) {
+    trace_buf[(trace_head + trace_count) % TRACE_BUFFER] = e;
+    trace_count++;
+  } else if (trace_dropped < 0xFF) {
+    trace_dropped++;
+  }
+  __set_PRIMASK(primask);
+}
+
+/**
+ * @brief Removes the oldest event from the trace buffer.
+ * @param e output
+ * @return true if an event was removed, false if the buffer is empty.
+ */
+static bool trace_pop(Trace_event &e) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  bool ok = trace_count > 0;
+  if (ok) {
+    e = trace_buf[trace_head];
+    trace_head = (trace_head + 1) % TRACE_BUFFER;
+    trace_count--;
+  }
+  __set_PRIMASK(primask);
+  return ok;
+}
+
+#if TRACE_SERIAL
+/**
+ * @brief Prints the oldest trace event to the serial console as "time_us id reg arg", called from the idle main loop.
+ *
+ * At most one event per call and only if the serial buffer takes the line without blocking.
+ */
+static void trace_drain(void) {
+  if (Serial.availableForWrite() < 32) {
+    return;
+  }
+  if (trace_dropped) {
+    Serial.print("trace dropped ");
+    Serial.println(trace_dropped);
+    trace_dropped = 0;
+    return;
+  }
+  Trace_event e;
+  if (!trace_pop(e)) {
+    return;
+  }
+  Serial.print(e.time_us);
+  Serial.print(' ');
+  Serial.print(e.id);
+  Serial.print(' ');
+  Serial.print(e.reg, HEX);
+  Serial.print(' ');
+  Serial.println(e.arg);
+}
+#endif
+
 /**
  * @brief I2C receive event Handler.
  *
@@ -58,22 +179,59 @@ void stepper_request_handler(uint8_t reg);
  * For a command the message looks like this: \n 
  * \< [REG][RXBUFn]...[RXBUF2][RXBUF1][RXBUF0] \n 
  * \> [FLAGS] \n 
- * The payload is read into the rx_buf, rx_length is set to the payload length and the rx_data_ready flag is set.
+ * If I2C_FRAMED is set in the register byte, header and CRC are added (see Bus_backend::setFraming() of joint_communication): \n 
+ * \< [REG|I2C_FRAMED] \> [HDR][TXBUFn]...[TXBUF0][FLAGS][CRC] \n 
+ * \< [REG|I2C_FRAMED][HDR][RXBUFn]...[RXBUF0][CRC] \> [HDR][FLAGS][CRC] \n 
+ * HDR is I2C_FRAME_VERSION in the upper two bits and the payload length, CRC is crc8() over ADR, the register byte and the frame.
+ * A framed command with a wrong version, length or CRC is not executed, I2C_FRAME_ERROR is set in the flags of the reply instead.
+ * Unframed commands are also received with the general call (I2C_GENERAL_CALL), e.g. COMMIT to all joints at once.
+ * The payload is read into the rx_buf, rx_length is set to the payload length and the rx_data_ready flag is set if there is a payload.
  * @param n the number of bytes read from the controller device: MAX_BUFFER
  */
 void receiveEvent(int n) {
-  // Serial.println("receive");
-  reg = Wire.read();
+  rx_stamp = micros();
+  uint8_t r = Wire.read();
+  uint8_t frame[MAX_BUFFER + I2C_FRAME_OVERHEAD];
 
-  // Serial.println(reg);
-  int i = 0;
+  // Serial.println(r);
+  size_t i = 0;
   while (Wire.available()) {
-    rx_buf[i] = Wire.read();
+    uint8_t b = Wire.read();
+    if (i < sizeof(frame)) {
+      frame[i] = b;
+    }
     i++;
   }
-  rx_length = i;
+  framed = r & I2C_FRAMED;
+  reg = r & ~I2C_FRAMED;
+  command = i > 0;
+  frame_error = 0;
+  if (command && reg == COMMIT) {
+    commit_stamp = rx_stamp;
+  }
+
+  if (!framed) {
+    rx_length = i < MAX_BUFFER ? i : MAX_BUFFER;
+    memcpy(rx_buf, frame, rx_length);
+    rx_data_ready = command;  // a read only selects the register for requestEvent()
+    // if (i) { DUMP_BUFFER(rx_buf, rx_length); }
+    return;
+  }
+  if (!command) {
+    return;  // framed read, answered by requestEvent()
+  }
+
+  uint8_t length = frame[0] & 0x3F;
+  uint8_t head[2] = { ADR, r };
+  if (i < I2C_FRAME_OVERHEAD || frame[0] >> 6 != I2C_FRAME_VERSION || length > MAX_BUFFER || i != (size_t)(length + I2C_FRAME_OVERHEAD)
+      || crc8(frame, length + 1, crc8(head, sizeof(head))) != frame[length + 1]) {
+    frame_error = 1;  // reported with the flags, the host resends the command
+    TRACE(TRACE_LEVEL_INFO, TRACE_FRAME_ERROR, reg, i);
+    return;
+  }
+  memcpy(rx_buf, frame + 1, length);
+  rx_length = length;
   rx_data_ready = 1;
-  // if (i) { DUMP_BUFFER(rx_buf, rx_length); }
 }
 
 /**
@@ -82,15 +240,363 @@ void receiveEvent(int n) {
  * Sends the response data to the master. Every transaction begins with a receive event. This function is only called when the master calls the read() function.
  * Hence this function is only invoked after the receiveEvent() handler has been called. The function calls the stepper_request_handler() which is non-blocking.
  * stepper_request_handler() populates the tx_buf, the current state flags are appended to the tx_buf and then it is send to the master.
+ * Framed transactions are answered with a framed reply, see receiveEvent().
  */
 void requestEvent() {
   // Serial.println("request");
+  if (framed) {
+    uint8_t reply[MAX_BUFFER + RFLAGS_SIZE + I2C_FRAME_OVERHEAD];
+    uint8_t head[2] = { ADR, (uint8_t)(reg | I2C_FRAMED) };
+    tx_length = 0;
+    if (!command) {
+      stepper_request_handler(reg);
+    }
+    reply[0] = I2C_FRAME_VERSION << 6 | tx_length;
+    memcpy(reply + 1, tx_buf, tx_length);
+    reply[1 + tx_length] = frame_error ? state | I2C_FRAME_ERROR : state;
+    reply[2 + tx_length] = crc8(reply, tx_length + 2, crc8(head, sizeof(head)));
+    Wire.write(reply, tx_length + RFLAGS_SIZE + I2C_FRAME_OVERHEAD);
+    return;
+  }
   stepper_request_handler(reg);
   tx_buf[tx_length++] = state;
   // DUMP_BUFFER(tx_buf, tx_length);
   Wire.write(tx_buf, tx_length);
 }
 
+/**
+ * @brief Ends a running homing without reaching the end stop and restores the drive current. The motor is not stopped.
+ * @param reason HOME_TIMEOUT or HOME_ABORTED
+ */
+static void home_abort(uint8_t reason) {
+  if (home_state != HOME_RUNNING) {
+    return;
+  }
+  stepper.setCurrent(driveCurrent);
+  home_state = reason;
+}
+
+/**
+ * @brief Drops the trajectory, the interpolated setpoints and the latched target and aborts homing, e.g. on STOP
+ * or when another motion command takes over. The motor is not stopped.
+ */
+static void pvt_clear(void) {
+  pvt_count = 0;
+  pvt_playing = 0;
+  ip_active = 0;
+  latched = 0;
+  home_abort(HOME_ABORTED);
+}
+
+/**
+ * @brief Fill level of the trajectory buffer in BIT5 - BIT7 of the state byte.
+ *
+ * 0 if the buffer is empty, 7 if it is full. The level is rounded up, hence at least
+ * PVT_BUFFER - level * PVT_BUFFER / 7 segments are free.
+ */
+static uint8_t pvt_level(void) {
+  return (pvt_count * 7 + PVT_BUFFER - 1) / PVT_BUFFER;
+}
+
+/**
+ * @brief Plays the trajectory, called from the main loop.
+ *
+ * Interpolates the current segment with hermite() and commands the velocity of the trajectory with a
+ * position feedback (PVT_KP). Finished segments are dropped. If the buffer runs empty, the joint holds
+ * the end of the last segment until new segments are pushed.
+ */
+static void pvt_playback(void) {
+  if (!pvt_playing) {
+    return;
+  }
+  uint32_t t = micros() - pvt_t0;
+  while (pvt_count && t >= pvt[pvt_head].duration_us) {
+    t -= pvt[pvt_head].duration_us;
+    pvt_t0 += pvt[pvt_head].duration_us;
+    pvt_p0 = pvt[pvt_head].angle;
+    pvt_v0 = pvt[pvt_head].velocity;
+    pvt_head = (pvt_head + 1) % PVT_BUFFER;
+    pvt_count--;
+  }
+  if (!pvt_count) {
+    stepper.moveToAngle(pvt_p0);
+    pvt_playing = 0;
+    return;
+  }
+
+  const Pvt_segment &s = pvt[pvt_head];
+  float p, v;
+  hermite(pvt_p0, pvt_v0, s.angle, s.velocity, s.duration_us * 1e-6f, t * 1e-6f, p, v);
+  stepper.setRPM((v + PVT_KP * (p - stepper.angleMoved())) / 6);
+}
+
+/**
+ * @brief Position and velocity of the interpolated setpoints at \a now.
+ *
+ * Within one period after the latest setpoint arrived, the segment towards it is interpolated (see interp_mode_t).
+ * Afterwards the next setpoint is late and the motion is extrapolated with the velocity of the latest setpoint.
+ */
+static void ip_eval(uint32_t now, float &p, float &v) {
+  float t = (now - ip_t0) * 1e-6f;
+  if (t >= ip_period) {
+    v = ip_v1;
+    p = ip_p1 + ip_v1 * (t - ip_period);
+  } else if (ip_mode == INTERP_LINEAR) {
+    v = ip_v1;
+    p = ip_p0 + ip_v1 * t;
+  } else {
+    hermite(ip_p0, ip_v0, ip_p1, ip_v1, ip_period, t, p, v);
+  }
+}
+
+/**
+ * @brief Adds a MOVETOANGLE setpoint to the interpolation.
+ *
+ * The sample period is the smoothed interval between the arrivals. The new segment starts at the interpolated
+ * position and velocity, the first setpoint after a pause at the current position. A streamed trajectory is dropped
+ * and homing is aborted.
+ * @param angle setpoint in encoder degrees
+ * @param stamp micros() at the reception of the setpoint
+ */
+static void ip_sample(float angle, uint32_t stamp) {
+  float dt = (stamp - ip_t0) * 1e-6f;
+  float p, v;
+  pvt_count = 0;
+  pvt_playing = 0;
+  home_abort(HOME_ABORTED);
+  if (ip_active && dt < INTERP_MAX_PERIOD) {
+    if (dt > 1e-3f) {
+      // the first interval replaces the assumed period, later ones are smoothed against the arrival jitter
+      ip_period = ip_samples < 2 ? dt : ip_period + (dt - ip_period) / 4;
+    }
+    ip_eval(stamp, p, v);
+    ip_samples = ip_samples < 2 ? ip_samples + 1 : 2;
+  } else {
+    p = stepper.angleMoved();
+    v = 0;
+    ip_period = INTERP_DEFAULT_PERIOD;
+    ip_samples = 1;
+  }
+
+  ip_v1 = ip_mode == INTERP_CUBIC ? (ip_samples < 2 ? 0 : (angle - ip_p1) / ip_period) : (angle - p) / ip_period;
+  ip_p0 = p;
+  ip_v0 = v;
+  ip_p1 = angle;
+  ip_t0 = stamp;
+  ip_active = 1;
+}
+
+/**
+ * @brief Tracks the interpolated setpoints, called from the main loop.
+ *
+ * Commands the interpolated velocity with a position feedback (PVT_KP), as pvt_playback(). If no setpoint
+ * arrived within two periods, the joint stops at the latest setpoint.
+ */
+static void ip_update(void) {
+  if (!ip_active) {
+    return;
+  }
+  uint32_t now = micros();
+  if ((now - ip_t0) * 1e-6f >= 2 * ip_period) {
+    stepper.moveToAngle(ip_p1);
+    ip_active = 0;
+    return;
+  }
+  float p, v;
+  ip_eval(now, p, v);
+  stepper.setRPM((v + PVT_KP * (p - stepper.angleMoved())) / 6);
+}
+
+/**
+ * @brief Advances the homing started by HOME, called from the main loop.
+ *
+ * The joint runs towards the end stop until the PID error reaches the sensitivity, then encoder and driver are
+ * set home. If the end stop is not reached within HOME_TIMEOUT_MS the motor is stopped and homing fails.
+ */
+static void home_update(void) {
+  if (home_state != HOME_RUNNING) {
+    return;
+  }
+  if (abs(stepper.getPidError()) >= home_sensitivity) {
+    stepper.encoder.setHome();
+    stepper.driver.setHome();
+    stepper.stop();  // Stop motor !
+    stepper.setCurrent(driveCurrent);
+
+    isHomed = 1;
+    isStalled = 0;
+    home_state = HOME_DONE;
+    TRACE(TRACE_LEVEL_INFO, TRACE_HOME_DONE, 0, 0);
+  } else if (millis() - home_t0 > HOME_TIMEOUT_MS) {
+    TRACE(TRACE_LEVEL_ERROR, TRACE_HOME_TIMEOUT, 0, 0);
+    stepper.stop();
+    home_abort(HOME_TIMEOUT);
+  }
+}
+
+/**
+ * @brief Applies the motion limits of config to the uStepper, which must be setup.
+ */
+static void config_apply(void) {
+  stepper.setMaxAcceleration(config.maxAcceleration);
+  stepper.setMaxDeceleration(config.maxDeceleration);
+  stepper.setMaxVelocity(config.maxVelocity);
+  stepper.setControlThreshold(config.controlThreshold);
+}
+
+/**
+ * @brief Restores the configuration stored in flash at CONFIG_ADDR.
+ * @return false if no valid configuration of CONFIG_VERSION is stored, config is not changed then.
+ */
+static bool config_load(void) {
+  Config_record r;
+  uint8_t *b = (uint8_t *)&r;
+  for (size_t i = 0; i < sizeof(r); i++) {
+    b[i] = eeprom_read_byte(CONFIG_ADDR + i);
+  }
+  if (r.magic != CONFIG_MAGIC || r.version != CONFIG_VERSION || crc8(b, sizeof(r) - 1) != r.crc) {
+    return false;
+  }
+  config = r.config;
+  return true;
+}
+
+/**
+ * @brief Stores config in flash at CONFIG_ADDR.
+ *
+ * The EEPROM emulation erases the whole flash sector once, which blocks for up to a few seconds.
+ */
+static void config_save(void) {
+  Config_record r = { CONFIG_MAGIC, CONFIG_VERSION, config, 0 };
+  uint8_t *b = (uint8_t *)&r;
+  r.crc = crc8(b, sizeof(r) - 1);
+  eeprom_buffer_fill();
+  for (size_t i = 0; i < sizeof(r); i++) {
+    eeprom_buffered_write_byte(CONFIG_ADDR + i, b[i]);
+  }
+  eeprom_buffer_flush();
+}
+
+/**
+ * @brief Takes a telemetry sample every capture_divider control ticks while a capture runs, called from control_tick().
+ *
+ * If the host does not drain the buffer in time, the oldest sample is overwritten.
+ */
+static void capture_update(void) {
+  if (!capture_left || ++capture_tick < capture_divider) {
+    return;
+  }
+  capture_tick = 0;
+  Joint_state s;
+  s.angle = stepper.angleMoved();
+  s.rpm = stepper.encoder.getRPM();
+  s.pidError = stepper.getPidError();
+
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();  // GETCAPTURE reads the buffer from the I2C ISR
+  if (capture_count == CAPTURE_BUFFER) {
+    capture_head = (capture_head + 1) % CAPTURE_BUFFER;
+    capture_count--;
+  }
+  capture_buf[(capture_head + capture_count) % CAPTURE_BUFFER] = s;
+  capture_count++;
+  capture_taken++;
+  capture_left--;
+  __set_PRIMASK(primask);
+}
+
+#ifdef RS485_PORT
+static uint8_t frame[MAX_BUFFER + FRAME_OVERHEAD];  ///< receive buffer of the RS-485 frame parser
+static size_t frame_length = 0;                     ///< bytes in frame
+
+/**
+ * @brief Sends a reply frame on the RS-485 link.
+ * @param reg register of the request
+ * @param payload reply payload, the state flags are the last byte
+ * @param length payload length
+ */
+static void rs485_reply(uint8_t reg, const uint8_t *payload, size_t length) {
+  uint8_t reply[MAX_BUFFER + RFLAGS_SIZE + FRAME_OVERHEAD];
+  reply[0] = FRAME_SYNC;
+  reply[1] = ADR | FRAME_REPLY;
+  reply[2] = reg;
+  reply[3] = length;
+  memcpy(reply + 4, payload, length);
+  reply[4 + length] = crc8(reply + 1, 3 + length);
+#ifdef RS485_DE_PIN
+  digitalWrite(RS485_DE_PIN, HIGH);
+#endif
+  RS485_PORT.write(reply, FRAME_OVERHEAD + length);
+  RS485_PORT.flush();  // wait until the last byte left the UART before releasing the line
+#ifdef RS485_DE_PIN
+  digitalWrite(RS485_DE_PIN, LOW);
+#endif
+}
+
+/**
+ * @brief RS-485 frame receiver.
+ *
+ * Parses the frames [SYNC][ADDR][REG][LEN][PAYLOAD...][CRC] of the host (see uRS485.h of joint_communication).
+ * Frames of other joints, replies and frames with a wrong checksum are ignored.
+ * A frame without payload is a read and answered like requestEvent() with the register value and the state flags.
+ * A frame with payload is a command: it is handed to the main loop like receiveEvent() and answered with the state flags.
+ * Commands to I2C_GENERAL_CALL are broadcasts to all joints and not answered.
+ * Called from every pass of the main loop and from yield(), hence the link is also served while a blocking command waits in delay().
+ * @warning Use either I2C or RS-485 on a joint, both transports share the command and tx buffers.
+ */
+void rs485_poll(void) {
+  static bool active = false;
+  if (active) {
+    return;  // the handlers may yield while printing
+  }
+  active = true;
+
+  while (RS485_PORT.available()) {
+    frame[frame_length++] = RS485_PORT.read();
+    if (frame[0] != FRAME_SYNC || (frame_length == 4 && frame[3] > MAX_BUFFER)) {
+      frame_length = 0;
+      continue;
+    }
+    if (frame_length < 4 || frame_length < (size_t)(FRAME_OVERHEAD + frame[3])) {
+      continue;
+    }
+
+    frame_length = 0;
+    uint8_t length = frame[3];
+    bool broadcast = frame[1] == I2C_GENERAL_CALL;
+    if ((frame[1] != ADR && !broadcast) || crc8(frame + 1, 3 + length) != frame[4 + length] || (broadcast && length == 0)) {
+      continue;
+    }
+    if (length == 0) {
+      stepper_request_handler(frame[2]);
+      tx_buf[tx_length++] = state;
+      rs485_reply(frame[2], tx_buf, tx_length);
+    } else {
+      uint8_t flags = state;  // flags are sent before the command is executed, as with I2C
+      reg = frame[2];
+      memcpy(rx_buf, frame + 4, length);
+      rx_length = length;
+      rx_stamp = micros();
+      if (reg == COMMIT) {
+        commit_stamp = rx_stamp;
+      }
+      rx_data_ready = 1;
+      if (!broadcast) {
+        rs485_reply(frame[2], &flags, RFLAGS_SIZE);  // a broadcast is not answered
+      }
+    }
+  }
+  active = false;
+}
+
+/**
+ * @brief Serves the RS-485 link while the firmware waits in delay(), e.g. in SETUP or CHECKORIENTATION.
+ */
+void yield(void) {
+  rs485_poll();
+}
+#endif
+
 /**
  * @brief Handles commands received via I2C.
  * @warning This is a blocking function which may take some time to execute. This function must not be called from an ISR or callback! 
@@ -100,26 +606,28 @@ void requestEvent() {
  * @param reg command that should be executed.
  */
 void stepper_receive_handler(uint8_t reg) {
+  TRACE(TRACE_LEVEL_DEBUG, TRACE_COMMAND, reg, rx_length);
   switch (reg) {
     case SETUP:
       {
-        Serial.print("Executing SETUP\n");
+        if (rx_length < 2) {  // the host sends the currents in a 4 byte word
+          TRACE(TRACE_LEVEL_ERROR, TRACE_BAD_LENGTH, reg, rx_length);
+          break;
+        }
         memcpy(&driveCurrent, rx_buf, 1);
         memcpy(&holdCurrent, rx_buf + 1, 1);
         if (!isSetup) {
           stepper.setup(CLOSEDLOOP, 200);
           isHomed = 0;
         }
-        stepper.setMaxAcceleration(MAXACCEL);
-        stepper.setMaxDeceleration(MAXACCEL);
-        stepper.setMaxVelocity(MAXVEL);
-        stepper.setControlThreshold(15);  //Adjust the control threshold - here set to 15 microsteps before making corrective action
+        config_apply();  // limits and control threshold, the microsteps tolerated before making corrective action
         stepper.setCurrent(driveCurrent);
         stepper.setHoldCurrent(holdCurrent);
         stepper.moveToAngle(stepper.angleMoved());
         stepper.enableClosedLoop();
         stepper.stop();
 
+        pvt_clear();
         isStallguardEnabled = 0;
         isSetup = 1;
         isStalled = 0;
@@ -128,10 +636,12 @@ void stepper_receive_handler(uint8_t reg) {
 
     case SETRPM:
       {
-        Serial.print("Executing SETRPM\n");
         float v;
-        readValue<float>(v, rx_buf, rx_length);
+        if (readValue<float>(v, rx_buf, rx_length)) {
+          break;
+        }
         if (!isStalled) {
+          pvt_clear();
           stepper.setRPM(v);
         }
         break;
@@ -139,9 +649,11 @@ void stepper_receive_handler(uint8_t reg) {
 
     case MOVESTEPS:
       {
-        Serial.print("Executing MOVESTEPS\n");
         int32_t v;
-        readValue<int32_t>(v, rx_buf, rx_length);
+        if (readValue<int32_t>(v, rx_buf, rx_length)) {
+          break;
+        }
+        pvt_clear();
         stepper.moveSteps(v);
 
         break;
@@ -149,12 +661,19 @@ void stepper_receive_handler(uint8_t reg) {
 
     case MOVETOANGLE:
       {
-        Serial.print("Executing MOVETOANGLE\n");
         float v;
-        readValue<float>(v, rx_buf, rx_length);
+        if (readValue<float>(v, rx_buf, rx_length)) {
+          break;
+        }
         // Serial.println(v);
-        if (!isStalled) {
+        if (isStalled) {
+          break;
+        }
+        if (ip_mode == INTERP_OFF) {
+          pvt_clear();
           stepper.moveToAngle(v);
+        } else {
+          ip_sample(v, rx_stamp);
         }
 
         break;
@@ -163,41 +682,86 @@ void stepper_receive_handler(uint8_t reg) {
 
     case SETCURRENT:
       {
-        Serial.print("Executing SETCURRENT\n");
         uint8_t v;
-        readValue<uint8_t>(v, rx_buf, rx_length);
+        if (readValue<uint8_t>(v, rx_buf, rx_length)) {
+          break;
+        }
         stepper.setCurrent(v);
         break;
       }
 
     case SETHOLDCURRENT:
       {
-        Serial.print("Executing SETHOLDCURRENT\n");
         uint8_t v;
-        readValue<uint8_t>(v, rx_buf, rx_length);
+        if (readValue<uint8_t>(v, rx_buf, rx_length)) {
+          break;
+        }
         stepper.setHoldCurrent(v);
         break;
       }
 
-      // case SETMAXACCELERATION:
-      // Serial.print("Executing SETMAXACCELERATION\n");
-      //   break;
-
-      // case SETMAXDECELERATION:
-      // Serial.print("Executing SETMAXDECELERATION\n");
-      //   break;
+    case SETMAXACCELERATION:
+    case SETMAXDECELERATION:
+    case SETMAXVELOCITY:
+    case SETCONTROLTHRESHOLD:
+      {
+        float v;
+        if (readValue<float>(v, rx_buf, rx_length)) {
+          break;
+        }
+        if (!(v > 0)) {
+          TRACE(TRACE_LEVEL_ERROR, TRACE_BAD_VALUE, reg, (int16_t)v);
+          break;
+        }
+        if (reg == SETMAXACCELERATION) {
+          config.maxAcceleration = v;
+        } else if (reg == SETMAXDECELERATION) {
+          config.maxDeceleration = v;
+        } else if (reg == SETMAXVELOCITY) {
+          config.maxVelocity = v;
+        } else {
+          config.controlThreshold = v;
+        }
+        if (isSetup) {
+          config_apply();  // otherwise applied by SETUP
+        }
+        break;
+      }
 
-      // case SETMAXVELOCITY:
-      // Serial.print("Executing SETMAXVELOCITY\n");
-      //   break;
+    case STORECONFIG:
+      {
+        uint8_t v;
+        if (readValue<uint8_t>(v, rx_buf, rx_length)) {
+          break;
+        }
+        if (v == CONFIG_SAVE) {
+          config_save();
+        } else if (v == CONFIG_LOAD) {
+          if (!config_load()) {
+            TRACE(TRACE_LEVEL_INFO, TRACE_CONFIG, reg, 0);
+            break;
+          }
+        } else if (v == CONFIG_DEFAULTS) {
+          config = { MAXACCEL, MAXACCEL, MAXVEL, CONTROL_THRESHOLD };
+        } else {
+          TRACE(TRACE_LEVEL_ERROR, TRACE_BAD_VALUE, reg, v);
+          break;
+        }
+        TRACE(TRACE_LEVEL_INFO, TRACE_CONFIG, reg, v);
+        if (isSetup) {
+          config_apply();
+        }
+        break;
+      }
 
     case ENABLESTALLGUARD:
       {
-        Serial.print("Executing ENABLESTALLGUARD\n");
 
         // Very simple workaround for stall detection, since the built-in encoder stall-detection is tricky to work with in particular in combination with homeing since it can not be reset.
         uint8_t sensitivity;
-        readValue<uint8_t>(sensitivity, rx_buf, rx_length);
+        if (readValue<uint8_t>(sensitivity, rx_buf, rx_length)) {
+          break;
+        }
         stallguardThreshold = sensitivity * 10;
         // // Serial.println(sensitivity*1.0/10);
         // stepper.encoder.encoderStallDetectSensitivity = sensitivity * 1.0/10 ;
@@ -222,9 +786,10 @@ void stepper_receive_handler(uint8_t reg) {
 
     case SETBRAKEMODE:
       {
-        Serial.print("Executing SETBRAKEMODE\n");
         uint8_t v;
-        readValue<uint8_t>(v, rx_buf, rx_length);
+        if (readValue<uint8_t>(v, rx_buf, rx_length)) {
+          break;
+        }
         stepper.setBrakeMode(v);
         break;
       }
@@ -240,9 +805,10 @@ void stepper_receive_handler(uint8_t reg) {
 
     case DISABLECLOSEDLOOP:
       {
-        Serial.print("Executing DISABLECLOSEDLOOP\n");
         uint8_t v;
-        readValue<uint8_t>(v, rx_buf, rx_length);
+        if (readValue<uint8_t>(v, rx_buf, rx_length)) {
+          break;
+        }
         stepper.disableClosedLoop();
         break;
       }
@@ -250,25 +816,31 @@ void stepper_receive_handler(uint8_t reg) {
 
     case STOP:
       {
-        Serial.print("Executing STOP\n");
         uint8_t v;
-        readValue<uint8_t>(v, rx_buf, rx_length);
+        if (readValue<uint8_t>(v, rx_buf, rx_length)) {
+          break;
+        }
+        pvt_clear();
         stepper.stop(v);
         break;
       }
 
     case CHECKORIENTATION:
       {
-        Serial.print("Executing CHECKORIENTATION\n");
         float v;
-        readValue<float>(v, rx_buf, rx_length);
+        if (readValue<float>(v, rx_buf, rx_length)) {
+          break;
+        }
         stepper.checkOrientation(v);
         break;
       }
 
     case HOME:
       {
-        Serial.print("Executing HOME\n");
+        if (rx_length != 4) {
+          TRACE(TRACE_LEVEL_ERROR, TRACE_BAD_LENGTH, reg, rx_length);
+          break;
+        }
 
         uint8_t dir;
         uint8_t speed;
@@ -279,6 +851,7 @@ void stepper_receive_handler(uint8_t reg) {
         memcpy(&sensitivity, rx_buf + 2, 1);
         memcpy(&current, rx_buf + 3, 1);
 
+        pvt_clear();
         stepper.stop();
         // stepper.encoder = TLE5012B();  // Reset Enocoder to clear stall<<
         // stepper.encoder.init();
@@ -289,35 +862,118 @@ void stepper_receive_handler(uint8_t reg) {
         // stepper.encoder.encoderStallDetectSensitivity = sensitivity * 1.0 / 10;<<
         // stepper.encoder.encoderStallDetectEnable = 1;<<
 
-        float err;
-        do {
-          err = stepper.getPidError();
+        home_sensitivity = sensitivity;
+        home_t0 = millis();
+        home_state = HOME_RUNNING;  // advanced by home_update(), BUSY stays set until it ends
+        break;
+      }
 
-          Serial.println(abs(err));
-          delay(1);
-        } while (abs(err) < sensitivity);
+    case PUSHPVT:
+      {
+        if (rx_length == 0 || rx_length % sizeof(Pvt_segment)) {
+          TRACE(TRACE_LEVEL_ERROR, TRACE_BAD_LENGTH, reg, rx_length);
+          break;
+        }
+        if (isStalled) {
+          break;
+        }
+        home_abort(HOME_ABORTED);
+        for (size_t i = 0; i < rx_length / sizeof(Pvt_segment); i++) {
+          if (pvt_count == PVT_BUFFER) {
+            TRACE(TRACE_LEVEL_ERROR, TRACE_PVT_FULL, reg, rx_length / sizeof(Pvt_segment) - i);
+            break;
+          }
+          memcpy(&pvt[(pvt_head + pvt_count) % PVT_BUFFER], rx_buf + i * sizeof(Pvt_segment), sizeof(Pvt_segment));
+          pvt_count++;
+        }
+        ip_active = 0;
+        if (!pvt_playing) {
+          // the first segment starts at the current position
+          pvt_p0 = stepper.angleMoved();
+          pvt_v0 = stepper.encoder.getRPM() * 6;
+          pvt_t0 = micros();
+          pvt_playing = 1;
+        }
+        break;
+      }
 
-        // while (!stepper.encoder.encoderStallDetect) {
-        //   delay(5);
-        // }
-        stepper.encoder.setHome();
-        stepper.driver.setHome();
-        stepper.stop();  // Stop motor !
+    case SETINTERPOLATION:
+      {
+        uint8_t v;
+        if (readValue<uint8_t>(v, rx_buf, rx_length)) {
+          break;
+        }
+        if (v > INTERP_CUBIC) {
+          TRACE(TRACE_LEVEL_ERROR, TRACE_BAD_VALUE, reg, v);
+          break;
+        }
+        if (ip_active) {
+          stepper.moveToAngle(ip_p1);  // hold the latest setpoint
+          ip_active = 0;
+        }
+        ip_mode = v;
+        break;
+      }
 
-        // stepper.encoder = TLE5012B();  // Reset Enocoder to clear stall
-        // stepper.encoder.encoderStallDetect = 0;
-        // stepper.encoder.setHome();
-        // stepper.encoder.encoderStallDetectEnable = 0;<<
+    case LATCHANGLE:
+      {
+        float v;
+        if (readValue<float>(v, rx_buf, rx_length)) {
+          break;
+        }
+        if (!isStalled) {
+          latched_angle = v;
+          latched = 1;
+        }
+        break;
+      }
 
-        stepper.setCurrent(driveCurrent);
+    case COMMIT:
+      {
+        // the delay differs between the joints by their loop phase, it is the start skew of a synchronized move
+        commit_delay = micros() - commit_stamp;
+        if (!latched || isStalled) {
+          break;
+        }
+        float v = latched_angle;
+        if (ip_mode == INTERP_OFF) {
+          pvt_clear();
+          stepper.moveToAngle(v);
+        } else {
+          latched = 0;
+          ip_sample(v, commit_stamp);
+        }
+        break;
+      }
 
-        isHomed = 1;
-        isStalled = 0;
+    case STARTCAPTURE:
+      {
+        if (rx_length != 4) {
+          TRACE(TRACE_LEVEL_ERROR, TRACE_BAD_LENGTH, reg, rx_length);
+          break;
+        }
+        uint16_t divider;
+        uint16_t samples;
+        memcpy(&divider, rx_buf, 2);
+        memcpy(&samples, rx_buf + 2, 2);
+
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        if (samples) {
+          // a new capture drops the samples of the previous one, the first sample is taken at the next tick
+          capture_head = 0;
+          capture_count = 0;
+          capture_taken = 0;
+          capture_divider = divider ? divider : 1;
+          capture_tick = capture_divider - 1;
+        }
+        capture_left = samples;  // 0 stops, the buffer can still be drained
+        __set_PRIMASK(primask);
         break;
       }
 
     default:
-      Serial.println("Unknown command");
+      TRACE(TRACE_LEVEL_ERROR, TRACE_UNKNOWN, reg, 0);
       break;
   }
 }
@@ -333,10 +989,10 @@ void stepper_receive_handler(uint8_t reg) {
  */
 
 void stepper_request_handler(uint8_t reg) {
+  TRACE(TRACE_LEVEL_DEBUG, TRACE_READ, reg, 0);
   switch (reg) {
     case PING:
       {
-        Serial.print("Executing PING\n");
         writeValue<char>(ACK, tx_buf, tx_length);
         tx_data_ready = true;
         break;
@@ -350,7 +1006,6 @@ void stepper_request_handler(uint8_t reg) {
 
     case ANGLEMOVED:
       {
-        Serial.print("Executing ANGLEMOVED\n");
         writeValue<float>(stepper.angleMoved(), tx_buf, tx_length);
         tx_data_ready = 1;
         break;
@@ -358,7 +1013,6 @@ void stepper_request_handler(uint8_t reg) {
 
     case ISSTALLED:
       {
-        Serial.print("Executing ISSTALLED\n");
         writeValue<uint8_t>(state & 0x01, tx_buf, tx_length);
 
         tx_data_ready = 1;
@@ -366,7 +1020,6 @@ void stepper_request_handler(uint8_t reg) {
       }
     case ISHOMED:
       {
-        Serial.print("Executing ISHOMED\n");
         writeValue<uint8_t>(isHomed ? 1 : 0, tx_buf, tx_length);
         tx_data_ready = 1;
         break;
@@ -374,7 +1027,6 @@ void stepper_request_handler(uint8_t reg) {
 
     case ISSETUP:
       {
-        Serial.print("Executing ISSETUP\n");
         writeValue<uint8_t>(isSetup ? 1 : 0, tx_buf, tx_length);
         tx_data_ready = 1;
         break;
@@ -382,72 +1034,227 @@ void stepper_request_handler(uint8_t reg) {
 
     case GETENCODERRPM:
       {
-        Serial.print("Executing GETENCODERRPM\n");
         writeValue<float>(stepper.encoder.getRPM(), tx_buf, tx_length);
         tx_data_ready = 1;
         break;
       }
 
+    case GETSTATE:
+      {
+        Joint_state s;
+        s.angle = stepper.angleMoved();
+        s.rpm = stepper.encoder.getRPM();
+        s.pidError = stepper.getPidError();
+        writeValue<Joint_state>(s, tx_buf, tx_length);
+        tx_data_ready = 1;
+        break;
+      }
+
+    case GETCOMMITDELAY:
+      {
+        writeValue<uint32_t>(commit_delay, tx_buf, tx_length);
+        tx_data_ready = 1;
+        break;
+      }
+
+    case GETHOMESTATE:
+      {
+        writeValue<uint8_t>(home_state, tx_buf, tx_length);
+        tx_data_ready = 1;
+        break;
+      }
+
+    case GETCONFIG:
+      {
+        writeValue<Joint_config>(config, tx_buf, tx_length);
+        tx_data_ready = 1;
+        break;
+      }
+
+    case GETCAPTURE:
+      {
+        Capture_batch b;
+        memset(&b, 0, sizeof(b));
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        b.index = capture_taken - capture_count;
+        b.count = capture_count < CAPTURE_BATCH ? capture_count : CAPTURE_BATCH;
+        for (uint8_t i = 0; i < b.count; i++) {
+          b.samples[i] = capture_buf[(capture_head + i) % CAPTURE_BUFFER];
+        }
+        capture_head = (capture_head + b.count) % CAPTURE_BUFFER;
+        capture_count -= b.count;
+        b.active = capture_left > 0;
+        __set_PRIMASK(primask);
+        writeValue<Capture_batch>(b, tx_buf, tx_length);
+        tx_data_ready = 1;
+        break;
+      }
+
+    case GETTRACE:
+      {
+        Trace_batch b;
+        Trace_event e;
+        b.count = 0;
+        while (b.count < TRACE_BATCH && trace_pop(e)) {
+          b.events[b.count++] = e;
+        }
+        b.dropped = trace_dropped;
+        trace_dropped = 0;
+        writeValue<Trace_batch>(b, tx_buf, tx_length);
+        tx_data_ready = 1;
+        break;
+      }
+
+    case GETLOOPSTATS:
+      {
+        Loop_stats s = { tick_count, tick_overruns, tick_max_us };
+        writeValue<Loop_stats>(s, tx_buf, tx_length);
+        tx_data_ready = 1;
+        break;
+      }
+
     default:
-      Serial.println("Unknown function");
+      TRACE(TRACE_LEVEL_ERROR, TRACE_UNKNOWN, reg, 0);
       // Instead of sending a zero buffer, set the tx_length to 0 to only send return flags
       tx_length = 0;
       break;
   }
 }
 
+/**
+ * @brief Control tick interrupt of LOOP_TIMER at LOOP_RATE_HZ.
+ *
+ * Only flags the tick, the work is done by control_tick() in the main loop, since the uStepper and the serial
+ * console must not be used from an ISR. A tick which finds the previous one still pending is counted as overrun.
+ */
+void tickEvent(void) {
+  if (tick_pending) {
+    tick_overruns++;
+    TRACE(TRACE_LEVEL_INFO, TRACE_OVERRUN, 0, tick_overruns);
+  }
+  tick_pending = 1;
+  tick_count++;
+}
+
 /**
  * @brief Setup Peripherals
 
- * Setup I2C with the address ADR, and begin Serial for debugging with baudrate 9600.
+ * Setup I2C with the address ADR and the clock speed I2C_CLOCK, and begin Serial for the trace output with baudrate 9600.
+ * If RS485_PORT is defined, the RS-485 transport is started with RS485_BAUD.
+ * Restores the configuration stored in flash, see STORECONFIG, and starts the control tick of LOOP_TIMER at LOOP_RATE_HZ.
  */
 void setup(void) {
-  // Join I2C bus as follower
-  Wire.begin(ADR);
+  // Join I2C bus as follower, the general call carries the COMMIT of synchronized moves
+  Wire.begin(ADR, true);
+  // The timing of the peripheral must match the SCL speed of the host, also in follower mode
+  Wire.setClock(I2C_CLOCK);
   Serial.begin(9600);
 
   Wire.onReceive(receiveEvent);
   Wire.onRequest(requestEvent);
+
+#ifdef RS485_PORT
+#ifdef RS485_DE_PIN
+  pinMode(RS485_DE_PIN, OUTPUT);
+  digitalWrite(RS485_DE_PIN, LOW);
+#endif
+  RS485_PORT.begin(RS485_BAUD);
+#endif
+
+  bool loaded = config_load();
+  TRACE(TRACE_LEVEL_INFO, TRACE_CONFIG, 0, loaded ? CONFIG_LOAD : 0);
+
+  tick_timer = new HardwareTimer(LOOP_TIMER);
+  tick_timer->setOverflow(LOOP_RATE_HZ, HERTZ_FORMAT);
+  tick_timer->attachInterrupt(tickEvent);
+  tick_timer->resume();
 }
 
 /**
- * @brief Main loop
+ * @brief Fixed rate part of the main loop, runs once per control tick.
 
  * Executes the following: \n 
- * 1) if isStallguardEnabled: compares stepper.getPidError() with stallguardThreshold and sets BIT0 of the state byte. \n 
- * 2) sets/clears BIT2 of the state byte if the joint is homed or not. \n 
+ * 1) if isStallguardEnabled and not homing: compares stepper.getPidError() with stallguardThreshold and sets BIT0 of the state byte. \n 
+ * 2) advances the homing with home_update(), sets BIT1 of the state byte while homing and sets/clears BIT2 of the state byte if the joint is homed or not. \n 
  * 3) sets/clears BIT3 of the state byte if the joint is setup or not. \n 
- * 4) if rx_data_ready: set BIT1 of the state byte to indicate device is busy. Invoke stepper_receive_handler. 
- * Clear BIT1 of the state byte to indicate device is no longer busy \n 
+ * 4) plays the trajectory with pvt_playback(), tracks the interpolated setpoints with ip_update() and writes the buffer fill level to BIT5 - BIT7 of the state byte. \n 
+ * 5) takes a telemetry sample with capture_update() while a capture runs.
  * @todo
  - why are BIT2 and BIT3 constantly checked and set? Would it be sufficient to do this only invoking the actual functions?
  */
-void loop(void) {
-
-  if (isStallguardEnabled) {
+static void control_tick(void) {
+  // driving into the end stop while homing is not a stall
+  if (isStallguardEnabled && home_state != HOME_RUNNING) {
     float err = stepper.getPidError();
     if (abs(err) > stallguardThreshold) {
+      if (!isStalled) {
+        TRACE(TRACE_LEVEL_INFO, TRACE_STALL, 0, (int16_t)err);
+      }
       isStalled = 1;
       state |= (1 << 0);
+      pvt_clear();
       stepper.stop(SOFT);  // UNTESTED
     } else if (!isStalled) {
       state &= ~(1 << 0);
     }
     // state |= (abs(err) > stallguardThreshold) ? 0x01 : 0x00;
-    Serial.print(abs(err));
-    Serial.print("\t");
-    Serial.println(state);
   }
 
+  home_update();
+  home_state == HOME_RUNNING ? state |= (1 << 1) : state &= ~(1 << 1);
   isHomed ? state |= (1 << 2) : state &= ~(1 << 2);
   isSetup ? state |= (1 << 3) : state &= ~(1 << 3);
 
+  pvt_playback();
+  ip_update();
+  state = (state & 0x1F) | pvt_level() << 5;
+
+  capture_update();
+}
+
+/**
+ * @brief Main loop
+
+ * Runs without delay and executes the following: \n 
+ * 0) if RS485_PORT is defined: serve the RS-485 link with rs485_poll(). \n 
+ * 1) if rx_data_ready: set BIT1 of the state byte to indicate device is busy. Invoke stepper_receive_handler. 
+ * Update BIT2, BIT3 and BIT5 - BIT7, then clear BIT1 of the state byte to indicate device is no longer busy unless homing \n 
+ * 2) if a control tick is pending: run control_tick() and track its run time, see GETLOOPSTATS. \n 
+ * 3) otherwise, if TRACE_SERIAL is set: print one event of the trace buffer with trace_drain(). \n 
+ * Commands are executed as soon as they are received, hence the start of a move lags its command only by the tick
+ * being served, which bounds the start skew of a synchronized move (see COMMIT).
+ */
+void loop(void) {
+#ifdef RS485_PORT
+  rs485_poll();
+#endif
+
   if (rx_data_ready) {
     rx_data_ready = 0;
     state |= 1 << 1;  // set is busy flag
     stepper_receive_handler(reg);
-    state &= ~(1 << 1);  // reset is busy flag
+    // the host caches the flags, they must show the result of the command once BUSY is cleared
+    isHomed ? state |= (1 << 2) : state &= ~(1 << 2);
+    isSetup ? state |= (1 << 3) : state &= ~(1 << 3);
+    state = (state & 0x1F) | pvt_level() << 5;
+    if (home_state != HOME_RUNNING) {
+      state &= ~(1 << 1);  // reset is busy flag
+    }
   }
 
-  delay(10);
+  if (tick_pending) {
+    tick_pending = 0;
+    uint32_t t0 = micros();
+    control_tick();
+    uint32_t dt = micros() - t0;
+    if (dt > tick_max_us) {
+      tick_max_us = dt;
+    }
+  }
+#if TRACE_SERIAL
+  else if (!rx_data_ready) {
+    trace_drain();
+  }
+#endif
 }
@@ -0,0 +1,216 @@
+/**
+ * @file mAsync.h
+ * @author Sebastian Storz
+ * @brief Awaitable motion commands based on C++20 coroutines
+ * @version 0.1
+ * @date 2025-06-20
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * Include this file to write multi-step routines without blocking sleeps. Every awaitable command starts
+ * the motion and suspends the calling coroutine. A single Event_loop polls the flags or positions of all
+ * suspended commands and resumes them once they are finished, so independent motions overlap without threads.
+ * Tasks start eagerly, awaiting them only collects the result.
+ *
+ * \code{.cpp}
+#include "joint_communication/mAsync.h"
+Task routine(Joint_comms &joints, Gripper &gripper)
+{
+    Task h1 = home(joints.joints[0], 0, 20, 30, 15); // both joints home at the same time
+    Task h3 = home(joints.joints[2], 0, 10, 30, 10);
+    int rc1 = co_await h1;
+    int rc3 = co_await h3;
+    if (rc1 || rc3)
+        co_return -1;
+    std::vector<float> q = {10, 50, 0, 0};
+    co_await moveTo(joints, q);
+    co_return co_await setPosition(gripper, 40);
+}
+
+int main(int argc, char **argv)
+{
+    ...
+    Task t = routine(joints, gripper);
+    return Event_loop::instance().run(t);
+}
+  \endcode
+ */
+#ifndef MASYNC_H
+#define MASYNC_H
+
+#include <coroutine>
+#include <functional>
+#include <vector>
+#include "joint_communication/mJointCom.h"
+#include "joint_communication/mGripper.h"
+
+/**
+ * @brief Coroutine returning an error code.
+ *
+ * The coroutine starts executing when it is called. co_await on a Task suspends the caller until the
+ * Task has finished and returns its error code.
+ * @warning A Task must have finished before it is destroyed, i.e. always await it or run() it.
+ */
+class Task
+{
+public:
+  /**
+   * @brief Coroutine promise of a Task
+   */
+  struct promise_type
+  {
+    int rc = 0;                           ///< value passed to co_return
+    std::coroutine_handle<> continuation; ///< coroutine awaiting this task
+
+    Task get_return_object(void) { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    std::suspend_never initial_suspend(void) noexcept { return {}; }
+
+    /**
+     * @brief Resumes the awaiting coroutine when the task has finished
+     */
+    struct Final_awaiter
+    {
+      bool await_ready(void) noexcept { return false; }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+      {
+        return h.promise().continuation ? h.promise().continuation : std::noop_coroutine();
+      }
+      void await_resume(void) noexcept {}
+    };
+    Final_awaiter final_suspend(void) noexcept { return {}; }
+    void return_value(int value) { this->rc = value; }
+    void unhandled_exception(void) { std::terminate(); }
+  };
+
+  Task(Task &&other) noexcept;
+  Task &operator=(Task &&other) noexcept;
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+  ~Task();
+
+  /**
+   * @return true if the coroutine has finished.
+   */
+  bool done(void) const;
+
+  /**
+   * @return the error code of a finished coroutine.
+   */
+  int result(void) const;
+
+  bool await_ready(void) const noexcept { return this->h.done(); }
+  void await_suspend(std::coroutine_handle<> c) noexcept { this->h.promise().continuation = c; }
+  int await_resume(void) const { return this->h.promise().rc; }
+
+private:
+  explicit Task(std::coroutine_handle<promise_type> h);
+
+  std::coroutine_handle<promise_type> h;
+};
+
+/**
+ * @brief Single threaded event loop resuming suspended coroutines.
+ *
+ * Each thread has its own instance. Waits go through getClock(), hence the loop also runs on a Virtual_clock.
+ */
+class Event_loop
+{
+public:
+  /**
+   * @return the event loop of the calling thread.
+   */
+  static Event_loop &instance(void);
+
+  /**
+   * @brief Runs the loop until \a task has finished.
+   * @return the error code of the task, -1 if the task can never be resumed.
+   */
+  int run(Task &task);
+
+  /**
+   * @brief Awaitable suspending until a point in time
+   */
+  struct Sleep_awaiter
+  {
+    uint64_t until; ///< getClock() time in us
+    bool await_ready(void) const;
+    void await_suspend(std::coroutine_handle<> h);
+    void await_resume(void) const {}
+  };
+
+  /**
+   * @brief Awaitable suspending until a condition holds
+   */
+  struct Poll_awaiter
+  {
+    std::function<bool(void)> condition; ///< polled every \a period_us
+    uint32_t period_us;
+    bool await_ready(void) const;
+    void await_suspend(std::coroutine_handle<> h);
+    void await_resume(void) const {}
+  };
+
+private:
+  /**
+   * @brief suspended coroutine
+   */
+  struct Waiter
+  {
+    uint64_t due;                         ///< next time to check the waiter
+    uint32_t period_us;                   ///< poll period, 0 for timers
+    std::function<bool(void)> condition;  ///< empty for timers
+    std::coroutine_handle<> h;
+  };
+
+  std::vector<Waiter> waiters;
+  std::vector<std::coroutine_handle<> > ready; ///< preallocated list of coroutines to resume
+};
+
+/**
+ * @brief Suspends for the specified time.
+ * @param us time in microseconds
+ */
+Event_loop::Sleep_awaiter sleepFor(const uint64_t us);
+
+/**
+ * @brief Suspends until \a condition returns true.
+ * @param condition function which is polled, it must not block.
+ * @param period_us poll period in us
+ */
+Event_loop::Poll_awaiter pollUntil(std::function<bool(void)> condition, const uint32_t period_us = 10000);
+
+/**
+ * @brief Moves all joints and finishes when every joint is within the tolerance of its target.
+ * @param joints joints to move, see Joint_comms::setPositions()
+ * @param angle_v target positions
+ * @param tolerance tolerance in degrees or mm
+ * @param period_us poll period of the positions in us
+ * @return error code.
+ */
+Task moveTo(Joint_comms &joints, std::vector<float> angle_v, const float tolerance = 0.5, const uint32_t period_us = 10000);
+
+/**
+ * @brief Homes a joint and finishes when the homing ended, see Joint::getHomeState(). See Joint::home() for the parameters.
+ * @param timeout_us deadline of the homing. The firmware ends homing after HOME_TIMEOUT_MS (30 s), the deadline
+ * also ends the wait for a joint which stopped answering.
+ * @return 0 if the joint is homed, -1 if the homing timed out or was aborted on the joint, -ETIMEDOUT if the deadline
+ * passed, negative error code of a failed read.
+ */
+Task home(Joint &joint, u_int8_t direction, u_int8_t rpm, u_int8_t sensitivity, u_int8_t current, const uint64_t timeout_us = 35 * 1000 * 1000);
+
+/**
+ * @brief Checks the orientation of all joints, see Joint_comms::checkOrientations().
+ * @return error code.
+ */
+Task checkOrientations(Joint_comms &joints, const float angle = 10.0);
+
+/**
+ * @brief Sets the gripper width and finishes after the servo had time to settle.
+ * @param gripper the gripper
+ * @param width width in mm, see Gripper::setPosition()
+ * @param settle_us time the servo needs to reach the position, the servo has no feedback.
+ * @return error code.
+ */
+Task setPosition(Gripper &gripper, const float width, const uint64_t settle_us = 500 * 1000);
+
+#endif // MASYNC_H
@@ -12,8 +12,218 @@
 #ifndef MJOINT_H
 #define MJOINT_H
 
-#define JOINT2ENCODERANGLE(jointAngle, gearRatio, offset) (gearRatio * (jointAngle + offset))
-#define ENCODER2JOINTANGLE(encoderAngle, gearRatio, offset) (encoderAngle / gearRatio - offset)
+#include <array>
+#include <atomic>
+#include <memory>
+#include <span>
+#include <string>
+#include "joint_communication/uBus.h"
+
+/**
+ * @brief Transforms a joint position in degrees or mm to encoder degrees. Pass offset 0 to transform velocities.
+ * @param jointAngle joint position
+ * @param gearRatio gear ratio from encoder units to joint units
+ * @param offset offset from encoder zero to joint zero
+ */
+constexpr float jointToEncoder(const float jointAngle, const float gearRatio, const float offset)
+{
+  return gearRatio * (jointAngle + offset);
+}
+
+/**
+ * @brief Transforms encoder degrees to a joint position, inverse of jointToEncoder().
+ */
+constexpr float encoderToJoint(const float encoderAngle, const float gearRatio, const float offset)
+{
+  return encoderAngle / gearRatio - offset;
+}
+
+static_assert(encoderToJoint(jointToEncoder(10, 35, 2), 35, 2) == 10, "encoderToJoint() must invert jointToEncoder()");
+
+/**
+ * @brief Number of registers mirrored in the shadow register cache of a joint
+ */
+#define SHADOW_REGS 5
+
+/**
+ * @brief Default age in us up to which flags received with a transaction answer flag queries, see Joint::setFlagsMaxAge().
+ */
+#define FLAGS_MAX_AGE_US 20000
+
+/**
+ * @brief Default time budget of Joint::recover() in us
+ */
+#define RECOVERY_BUDGET_US 100000
+
+/**
+ * @brief Number of segments in the trajectory buffer of the firmware, see Joint::pushTrajectory().
+ */
+#define PVT_BUFFER 32
+
+/**
+ * @brief Number of trajectory segments sent per PUSHPVT transaction.
+ */
+#define PVT_BATCH 2
+
+/**
+ * @brief Statistics of bus recoveries, see Joint::recover().
+ */
+struct Recovery_stats
+{
+  uint32_t count = 0;          ///< number of recoveries started
+  uint32_t failures = 0;       ///< recoveries which did not reach the joint within the budget
+  uint32_t reset_failures = 0; ///< bus resets which failed or are not supported by the backend
+  uint64_t last_us = 0;        ///< duration of the last recovery
+  uint64_t max_us = 0;         ///< longest recovery
+  uint64_t total_us = 0;       ///< sum of all recovery durations
+
+  /**
+   * @brief Adds the statistics of another joint.
+   */
+  Recovery_stats &operator+=(const Recovery_stats &other);
+};
+
+/**
+ * @brief Payload of the GETSTATE register, packed as sent by the firmware (Joint_state in Arduino/joint/joint.h).
+ */
+struct __attribute__((packed)) Joint_state_payload
+{
+  float angle;    ///< encoder degrees
+  float rpm;      ///< encoder rpm
+  float pidError; ///< PID error in steps
+};
+
+static_assert(sizeof(Joint_state_payload) == 12, "GETSTATE payload must match the firmware");
+
+/**
+ * @brief Payload of the GETLOOPSTATS register, packed as sent by the firmware (Loop_stats in Arduino/joint/joint.h).
+ *
+ * The firmware runs stall detection, homing and trajectory playback in a control tick at LOOP_RATE_HZ.
+ */
+struct __attribute__((packed)) Loop_stats
+{
+  uint32_t ticks = 0;     ///< control ticks since the reset of the joint
+  uint32_t overruns = 0;  ///< ticks which found the previous tick still pending
+  uint32_t maxTickUs = 0; ///< longest run time of a tick in us
+};
+
+static_assert(sizeof(Loop_stats) == 12, "GETLOOPSTATS payload must match the firmware");
+
+/**
+ * @brief Motion limits of a joint, payload of the GETCONFIG register (Joint_config in Arduino/joint/joint.h).
+ *
+ * The limits are in the units of the uStepper, independent of gear ratio and offset of the joint.
+ */
+struct __attribute__((packed)) Joint_config
+{
+  float maxAcceleration = 0;  ///< steps/s^2
+  float maxDeceleration = 0;  ///< steps/s^2
+  float maxVelocity = 0;      ///< steps/s
+  float controlThreshold = 0; ///< microsteps the closed loop tolerates before making a corrective action
+};
+
+static_assert(sizeof(Joint_config) == 16, "GETCONFIG payload must match the firmware");
+
+/**
+ * @brief Rate of the control tick of the firmware in Hz, must match LOOP_RATE_HZ in Arduino/joint/configuration.h.
+ */
+#define JOINT_LOOP_RATE_HZ 1000
+
+/**
+ * @brief Number of telemetry samples per GETCAPTURE transaction.
+ */
+#define CAPTURE_BATCH 2
+
+/**
+ * @brief Payload of the GETCAPTURE register, packed as sent by the firmware (Capture_batch in Arduino/joint/joint.h).
+ */
+struct __attribute__((packed)) Capture_batch_payload
+{
+  uint16_t index;                             ///< index of samples[0] since the capture started, wraps
+  uint8_t count;                              ///< valid samples
+  uint8_t active;                             ///< 1 while the joint takes samples
+  Joint_state_payload samples[CAPTURE_BATCH]; ///< oldest first
+};
+
+static_assert(sizeof(Capture_batch_payload) == 28, "GETCAPTURE payload must match the firmware");
+
+/**
+ * @brief Telemetry sample taken by the joint, see Joint::captureTelemetry().
+ */
+struct Telemetry_sample
+{
+  double t = 0;       ///< time since the start of the capture in s, from the control tick of the joint
+  float q = 0;        ///< position in degrees or mm
+  float qd = 0;       ///< velocity in degrees/s or mm/s
+  float pidError = 0; ///< PID error of the closed loop controller in steps
+};
+
+/**
+ * @brief Number of events in the trace buffer of the firmware, must match TRACE_BUFFER in Arduino/joint/joint.h.
+ */
+#define TRACE_BUFFER 64
+
+/**
+ * @brief Number of trace events per GETTRACE transaction.
+ */
+#define TRACE_BATCH 3
+
+/**
+ * @brief Event of the trace buffer of the firmware, packed as sent (Trace_event in Arduino/joint/joint.h).
+ */
+struct __attribute__((packed)) Trace_event
+{
+  uint32_t time_us; ///< micros() of the joint when the event was recorded
+  uint8_t id;       ///< see Joint::trace_event_t
+  uint8_t reg;      ///< register the event refers to, 0 if none
+  int16_t arg;      ///< argument, see Joint::trace_event_t
+};
+
+/**
+ * @brief Payload of the GETTRACE register, packed as sent by the firmware (Trace_batch in Arduino/joint/joint.h).
+ */
+struct __attribute__((packed)) Trace_batch_payload
+{
+  uint8_t count;                   ///< valid events
+  uint8_t dropped;                 ///< events lost to a full buffer since the last read
+  Trace_event events[TRACE_BATCH]; ///< oldest first
+};
+
+static_assert(sizeof(Trace_batch_payload) == 26, "GETTRACE payload must match the firmware");
+
+/**
+ * @brief Full state of a joint read in one transaction, see Joint::getState().
+ */
+struct Joint_state
+{
+  float q = 0;        ///< position in degrees or mm
+  float qd = 0;       ///< velocity in degrees/s or mm/s
+  float pidError = 0; ///< PID error of the closed loop controller in steps
+  u_int8_t flags = 0; ///< state flags, see Joint::flags
+};
+
+/**
+ * @brief Point of a streamed trajectory, see Joint::pushTrajectory().
+ */
+struct PVT_point
+{
+  float q = 0;              ///< position in degrees or mm at the end of the segment
+  float qd = 0;             ///< velocity in degrees/s or mm/s at the end of the segment
+  uint32_t duration_us = 0; ///< time from the previous point
+};
+
+/**
+ * @brief Segment of the PUSHPVT register, packed as received by the firmware (Pvt_segment in Arduino/joint/joint.h).
+ */
+struct __attribute__((packed)) PVT_segment_payload
+{
+  float angle;          ///< encoder degrees
+  float velocity;       ///< encoder degrees/s
+  uint32_t duration_us; ///< duration of the segment
+};
+
+static_assert(sizeof(PVT_segment_payload) == 12, "PUSHPVT segment must match the firmware");
+static_assert(PVT_BATCH == 2, "Joint::pushTrajectory() sends one or two segments per transaction");
 
 /**
  * @brief Representing a single joint on the I2C bus
@@ -22,7 +232,132 @@
 class Joint
 {
 public:
-  Joint(const int address, const std::string name, const float gearRatio, const float offset);
+  /**
+   *
+   * @brief register and command definitions
+   *
+   * a register can be read (R) or written (W), each register has a size in bytes.
+   * The payload can be split into multiple values or just be a single value.
+   * Note that not all functions are implemented.
+   *
+   */
+  enum stp_reg_t
+  {
+    PING = 0x0f,                ///< R; Size: 1; [(char) ACK]
+    SETUP = 0x10,               ///< W; Size: 2; [(uint8) holdCurrent, (uint8) driveCurrent]
+    SETRPM = 0x11,              ///< W; Size: 4; [(float) RPM]
+    GETDRIVERRPM = 0x12,        ///<
+    MOVESTEPS = 0x13,           ///< W; Size: 4; [(int32) steps]
+    MOVEANGLE = 0x14,           ///<
+    MOVETOANGLE = 0x15,         ///< W; Size: 4; [(float) degrees]
+    GETMOTORSTATE = 0x16,       ///<
+    RUNCOTINOUS = 0x17,         ///<
+    ANGLEMOVED = 0x18,          ///< R; Size: 4; [(float) degrees]
+    SETCURRENT = 0x19,          ///< W; Size: 1; [(uint8) driveCurrent]
+    SETHOLDCURRENT = 0x1A,      ///< W; Size: 1; [(uint8) holdCurrent]
+    SETMAXACCELERATION = 0x1B,  ///< W; Size: 4; [(float) steps/s^2], see Joint_config
+    SETMAXDECELERATION = 0x1C,  ///< W; Size: 4; [(float) steps/s^2]
+    SETMAXVELOCITY = 0x1D,      ///< W; Size: 4; [(float) steps/s]
+    ENABLESTALLGUARD = 0x1E,    ///< W; Size: 1; [(uint8) threshold]
+    DISABLESTALLGUARD = 0x1F,   ///<
+    CLEARSTALL = 0x20,          ///<
+    ISSTALLED = 0x21,           ///< R; Size: 1; [(uint8) isStalled]
+    SETBRAKEMODE = 0x22,        ///< W; Size: 1; [(uint8) mode]
+    ENABLEPID = 0x23,           ///<
+    DISABLEPID = 0x24,          ///<
+    ENABLECLOSEDLOOP = 0x25,    ///<
+    DISABLECLOSEDLOOP = 0x26,   ///< W; Size: 1; [(uint8) 0]
+    SETCONTROLTHRESHOLD = 0x27, ///< W; Size: 4; [(float) microsteps]
+    MOVETOEND = 0x28,           ///<
+    STOP = 0x29,                ///< W; Size: 1; [(uint8) mode]
+    GETPIDERROR = 0x2A,         ///<
+    CHECKORIENTATION = 0x2B,    ///< W; Size: 4; [(float) degrees]
+    GETENCODERRPM = 0x2C,       ///< R; Size: 4; [(float) RPM]
+    HOME = 0x2D,                ///< W; Size: 4; [(uint8) current, (int8) sensitivity, (uint8) speed, (uint8) direction]
+    ISHOMED = 0x2E,             ///< R; Size: 1; [(uint8) isStalled]
+    ISSETUP = 0x2F,             ///< R; Size: 1; [(uint8) isStalled]
+    GETSTATE = 0x30,            ///< R; Size: 12; [(float) degrees, (float) RPM, (float) PID error], see Joint_state_payload
+    PUSHPVT = 0x31,             ///< W; Size: 12 - 24; [1 - 2 x (float) degrees, (float) degrees/s, (uint32) us], see PVT_segment_payload
+    SETINTERPOLATION = 0x32,    ///< W; Size: 1; [(uint8) mode], see interp_mode_t
+    LATCHANGLE = 0x33,          ///< W; Size: 4; [(float) degrees] target executed by the next COMMIT
+    COMMIT = 0x34,              ///< W; Size: 1; [(uint8) 0] moves to the latched target, also sent to I2C_GENERAL_CALL
+    GETCOMMITDELAY = 0x35,      ///< R; Size: 4; [(uint32) us] from the reception of the last COMMIT to its execution
+    GETHOMESTATE = 0x36,        ///< R; Size: 1; [(uint8) state], see home_state_t
+    GETLOOPSTATS = 0x37,        ///< R; Size: 12; [(uint32) ticks, (uint32) overruns, (uint32) us], see Loop_stats
+    GETTRACE = 0x38,            ///< R; Size: 26; [(uint8) count, (uint8) dropped, 3 x Trace_event], see Trace_batch_payload
+    STARTCAPTURE = 0x39,        ///< W; Size: 4; [(uint16) divider, (uint16) samples], see startCapture()
+    GETCAPTURE = 0x3A,          ///< R; Size: 28; [(uint16) index, (uint8) count, (uint8) active, 2 x Joint_state_payload], see Capture_batch_payload
+    STORECONFIG = 0x3B,         ///< W; Size: 1; [(uint8) action], see config_action_t
+    GETCONFIG = 0x3C            ///< R; Size: 16; [(float) steps/s^2, (float) steps/s^2, (float) steps/s, (float) microsteps], see Joint_config
+  };
+
+  /**
+   * @brief Events of the trace buffer of the firmware, see readTrace().
+   */
+  enum trace_event_t
+  {
+    TRACE_COMMAND = 1,       ///< reg: command executed
+    TRACE_READ = 2,          ///< reg: register read
+    TRACE_UNKNOWN = 3,       ///< reg: register which is not implemented
+    TRACE_BAD_LENGTH = 4,    ///< reg: command, arg: payload length
+    TRACE_BAD_VALUE = 5,     ///< reg: command, arg: rejected value
+    TRACE_PVT_FULL = 6,      ///< arg: segments dropped
+    TRACE_FRAME_ERROR = 7,   ///< reg: rejected framed command, arg: bytes received
+    TRACE_STALL = 8,         ///< arg: PID error in steps
+    TRACE_HOME_DONE = 9,     ///< homing reached the end stop
+    TRACE_HOME_TIMEOUT = 10, ///< homing timed out
+    TRACE_OVERRUN = 11,      ///< arg: control tick overruns since the reset, see getLoopStats()
+    TRACE_CONFIG = 12        ///< reg: STORECONFIG, 0 at boot, arg: config_action_t executed, 0 if no configuration is stored
+  };
+
+  /**
+   * @brief Actions of storeConfig().
+   */
+  enum config_action_t
+  {
+    CONFIG_SAVE = 1,    ///< stores the configuration in the flash of the joint
+    CONFIG_LOAD = 2,    ///< restores the configuration stored in flash
+    CONFIG_DEFAULTS = 3 ///< restores the defaults compiled into the firmware (MAXACCEL, MAXVEL, CONTROL_THRESHOLD)
+  };
+
+  /**
+   * @brief State of the homing started by startHome(), see getHomeState().
+   */
+  enum home_state_t
+  {
+    HOME_IDLE = 0,    ///< homing was not started since the joint was reset
+    HOME_RUNNING = 1, ///< running towards the end stop
+    HOME_DONE = 2,    ///< the end stop was reached, the joint is homed
+    HOME_TIMEOUT = 3, ///< the end stop was not reached within the timeout of the firmware (HOME_TIMEOUT_MS)
+    HOME_ABORTED = 4  ///< aborted by stop(), setup or another motion command
+  };
+
+  /**
+   * @brief Interpolation of position setpoints by the joint, see setInterpolation().
+   */
+  enum interp_mode_t
+  {
+    INTERP_OFF = 0,    ///< every setpoint starts a motion profile of the joint
+    INTERP_LINEAR = 1, ///< constant velocity towards the latest setpoint
+    INTERP_CUBIC = 2   ///< cubic Hermite spline through the setpoints
+  };
+
+  /**
+   * @brief Payload size of a register as annotated in stp_reg_t, without the return flags.
+   * @param reg register
+   * @param write set to true if the register is written (W), false if it is read (R).
+   * @return size in bytes, -1 if the register is not implemented.
+   */
+  static int registerSize(const stp_reg_t reg, bool &write);
+
+  /**
+   * @param address 1-byte I2C device adress
+   * @param name device name for output logs
+   * @param gearRatio gear ratio from encoder units to joint units
+   * @param offset offset in degrees or mm from encoder zero to joint zero.
+   * @param bus backend carrying the transactions of this joint. If nullptr the defaultBusBackend() is used.
+   */
+  Joint(const int address, const std::string name, const float gearRatio, const float offset, std::shared_ptr<Bus_backend> bus = nullptr);
   // ~Joint();
 
   int init(void);
@@ -30,7 +365,170 @@ public:
   int printInfo(void);
   int getPosition(float &angle);
   int setPosition(float angle);
+
+  /**
+   * @brief Sends a target position which is executed by the next COMMIT, the joint does not move yet.
+   *
+   * The target is committed by commit() or by a broadcast to all joints of a bus, see Joint_comms::setPositionsSynchronized().
+   * Another motion command, STOP, SETUP, HOME and a stall drop the latched target.
+   * @param angle target in joint units
+   * @return 0 on OK, 1 if stalled, 2 if not homed, negative on error
+   */
+  int latchPosition(float angle);
+
+  /**
+   * @brief Moves to the target latched with latchPosition().
+   * @return 0 on OK, 1 if stalled, negative on error
+   */
+  int commit(void);
+
+  /**
+   * @brief Reads the time between the reception of the last COMMIT and the start of the move.
+   *
+   * The joint executes commands as soon as its main loop finished the current control tick (see getLoopStats()).
+   * The differences of the delays of the joints are the start skew of a synchronized move.
+   * @param us delay in microseconds
+   * @return 0 on OK, negative on error
+   */
+  int getCommitDelay(uint32_t &us);
+
+  /**
+   * @brief Reads the timing of the control tick of the firmware.
+   *
+   * Overruns mean that a command or the tick itself took longer than the tick period, e.g. SETUP or a
+   * CHECKORIENTATION. Rising overruns while moving point to a too high LOOP_RATE_HZ.
+   * @param stats output
+   * @return 0 on OK, negative on error
+   */
+  int getLoopStats(Loop_stats &stats);
+
+  /**
+   * @brief Reads the events recorded by the firmware since the last call.
+   *
+   * The firmware records events up to its TRACE_LEVEL in a ring buffer instead of printing them. With TRACE_SERIAL
+   * the buffer is printed to the serial console of the joint instead and stays mostly empty.
+   * Events are removed as they are read, hence the events of a failed transaction are lost.
+   * @param events the events are appended, oldest first
+   * @param dropped number of events lost to a full buffer
+   * @return number of events read, negative on error
+   */
+  int readTrace(std::vector<Trace_event> &events, uint32_t &dropped);
+
+  /**
+   * @brief Starts a telemetry capture on the joint.
+   *
+   * The joint samples position, velocity and PID error every \a divider control ticks (JOINT_LOOP_RATE_HZ) into
+   * its ring buffer of 512 samples, which the host drains with readCapture(). A new capture drops the samples
+   * of the previous one.
+   * @param divider sample every \a divider ticks, 1 for the full loop rate
+   * @param samples number of samples to take, 0 stops the running capture
+   * @return 0 on OK, negative on error
+   */
+  int startCapture(const uint16_t divider, const uint16_t samples);
+
+  /**
+   * @brief Drains up to CAPTURE_BATCH samples of the capture with one GETCAPTURE transaction.
+   *
+   * The samples are timestamped from their index, samples overwritten on the joint leave a gap in the series.
+   * @param series the samples are appended, in joint units
+   * @param active set to false once the joint took all samples
+   * @return number of samples appended, negative on error
+   */
+  int readCapture(std::vector<Telemetry_sample> &series, bool &active);
+
+  /**
+   * @brief Captures \a samples telemetry samples at \a rate_hz and waits until all are drained.
+   *
+   * The rate is rounded to a divider of JOINT_LOOP_RATE_HZ, the timestamps follow the rounded rate.
+   * Blocks for the duration of the capture, hence it is refused while the bus thread of the owning Joint_comms runs.
+   * @param rate_hz sample rate, at most JOINT_LOOP_RATE_HZ
+   * @param samples number of samples
+   * @param series output, cleared first
+   * @return number of samples lost, since the host did not drain them in time, -3 while the bus thread runs,
+   * negative on error
+   */
+  int captureTelemetry(const float rate_hz, const uint16_t samples, std::vector<Telemetry_sample> &series);
+
+  /**
+   * @brief Sets the maximum acceleration of the motion profiles.
+   *
+   * The limits of this group take effect immediately once the joint is setup and are lost at a reset,
+   * unless they are stored with storeConfig().
+   * @param steps_s2 acceleration in steps/s^2, must be positive
+   * @return 0 on OK, negative on error
+   */
+  int setMaxAcceleration(const float steps_s2);
+
+  /**
+   * @brief Sets the maximum deceleration of the motion profiles, see setMaxAcceleration().
+   * @param steps_s2 deceleration in steps/s^2, must be positive
+   * @return 0 on OK, negative on error
+   */
+  int setMaxDeceleration(const float steps_s2);
+
+  /**
+   * @brief Sets the maximum velocity of the motion profiles, see setMaxAcceleration().
+   * @param steps_s velocity in steps/s, must be positive
+   * @return 0 on OK, negative on error
+   */
+  int setMaxVelocity(const float steps_s);
+
+  /**
+   * @brief Sets the error the closed loop tolerates before making a corrective action, see setMaxAcceleration().
+   * @param microsteps threshold, must be positive
+   * @return 0 on OK, negative on error
+   */
+  int setControlThreshold(const float microsteps);
+
+  /**
+   * @brief Reads the motion limits in effect.
+   * @param config output
+   * @return 0 on OK, negative on error
+   */
+  int getConfig(Joint_config &config);
+
+  /**
+   * @brief Stores the motion limits in the flash of the joint, restores them from flash or restores the defaults.
+   *
+   * The joint loads the stored limits at boot. Saving erases a flash sector, which blocks the joint for up to a few
+   * seconds, hence the joint must stand still. Transactions fail meanwhile, the call waits until the joint answers
+   * and is no longer busy.
+   * @param action see config_action_t
+   * @param timeout_us time to wait for a save
+   * @return 0 on OK, -ETIMEDOUT if a save did not finish in time, negative on error
+   */
+  int storeConfig(const config_action_t action, const uint32_t timeout_us = 5000000);
   int getVelocity(float &degps);
+
+  /**
+   * @brief Reads position, velocity, PID error and flags with one GETSTATE transaction.
+   * @param state output in joint units
+   * @return 0 on OK, negative on error
+   */
+  int getState(Joint_state &state);
+
+  /**
+   * @brief Appends points to the trajectory buffer of the joint.
+   *
+   * PVT_BATCH points are sent per PUSHPVT transaction. The joint plays the trajectory from its own clock,
+   * interpolating between the points with cubic Hermite splines. The first point starts at the current position.
+   * If the buffer runs empty, the joint holds the last point until new points arrive.
+   * Points which do not fit the buffer are dropped by the joint, see getTrajectorySpace().
+   * Motion commands, STOP, SETUP, HOME and a stall clear the buffer.
+   * @param points trajectory in joint units
+   * @return 0 on OK, 1 if stalled, 2 if not homed, negative on error
+   */
+  int pushTrajectory(std::span<const PVT_point> points);
+
+  /**
+   * @brief Free space of the trajectory buffer.
+   *
+   * Derived from the fill level in the flags (see Joint::flags), answered from the status cache if it is fresh.
+   * The fill level is coarse, hence the result is a lower bound.
+   * @param space number of points which can be pushed
+   * @return 0 on OK, negative on error
+   */
+  int getTrajectorySpace(int &space);
   int setVelocity(float degps);
   int checkOrientation(float angle = 10.0);
 
@@ -59,6 +557,22 @@ public:
    */
   int home(u_int8_t direction, u_int8_t rpm, u_int8_t sensitivity, u_int8_t current);
 
+  /**
+   * @brief Starts homing the motor and returns immediately.
+   *
+   * The joint sets the BUSY flag until homing is finished, all registers are served in the meantime.
+   * Homing fails after a timeout and is aborted by stop(). See home() for the parameters and getHomeState() for the progress.
+   * @return error code.
+   */
+  int startHome(u_int8_t direction, u_int8_t rpm, u_int8_t sensitivity, u_int8_t current);
+
+  /**
+   * @brief Reads the state of the homing started by startHome().
+   * @param state output
+   * @return 0 on OK, negative on error
+   */
+  int getHomeState(home_state_t &state);
+
   /**
    * @brief Stops the motor.
    * @note When stopping the motor in soft mode, wait sufficiently long until the motor has stopped.
@@ -97,8 +611,24 @@ public:
    */
   int setBrakeMode(u_int8_t mode);
 
+  /**
+   * @brief Sets the interpolation of the setpoints of setPosition().
+   *
+   * With interpolation the setpoints are samples of a continuous trajectory, e.g. sent by a controller at a fixed rate.
+   * The joint estimates the sample period from their arrival and moves from its interpolated position to the
+   * latest setpoint within one period, with velocity feed-forward at its internal loop rate. Hence the motion lags
+   * the setpoints by one period but has no steps at the setpoint rate. If no setpoint arrives within two periods,
+   * the joint stops at the latest setpoint. Without interpolation every setpoint starts a motion profile.
+   * Position setpoints are not coalesced while interpolating (see setWriteCoalescing()), every sample is sent.
+   * @param mode see interp_mode_t
+   * @return error code.
+   */
+  int setInterpolation(const interp_mode_t mode);
+
   /**
    * @brief checks if the motor is stalled
+   *
+   * Answered from the status cache if it is fresh, see setFlagsMaxAge().
    * @param stall not stalled: 0, stalled: 1
    * @return error code.
    */
@@ -112,6 +642,8 @@ public:
 
   /**
    * @brief retrieves the status flags from the joint and checks if the joint is homed.
+   *
+   * Answered from the status cache if it is fresh, see setFlagsMaxAge().
    * @param homed not homed: 0, homed: 1
    * @return error code.
    */
@@ -128,6 +660,7 @@ public:
   /**
    * @brief Get the isHomed state variable saved locally.
    *
+   * The variable follows the HOMED flag of every read transaction.
    * To retrieve the actual state call Joint::getIsHomed()
    * @return local isHomed state variable.
    */
@@ -135,6 +668,8 @@ public:
 
   /**
    * @brief checks if the joint is setup from the joint
+   *
+   * Answered from the status cache if it is fresh, see setFlagsMaxAge().
    * @param setup not setup: 0, setup: 1
    * @return error code.
    */
@@ -156,59 +691,110 @@ public:
 
   /**
    * get driver state flags
+   *
+   * The flags of the last read transaction are returned if they are fresh, otherwise the joint is pinged.
    * @return flags.
    */
   u_int8_t getFlags(void);
 
-  std::string name;
+  /**
+   * @return true if the joint is busy processing a command, see getFlags().
+   */
+  bool isBusy(void);
+
+  /**
+   * @return true if the joint is stalled, see getFlags().
+   */
+  bool isStalled(void);
 
-protected:
-private:
   /**
+   * @brief Sets how long the flags received with a transaction answer flag queries without a bus read.
    *
-   * @brief register and command definitions
+   * Every reply carries the state flags (see Joint::flags), hence telemetry reads keep the status cache fresh.
+   * The flags returned by a command describe the state before the command is executed, so a command marks
+   * the cache stale.
+   * @param max_age_us maximum age in us, 0 to read the flags on every query. Default: FLAGS_MAX_AGE_US
+   */
+  void setFlagsMaxAge(const uint64_t max_age_us);
+
+  /**
+   * @return number of flag queries answered from the status cache.
+   */
+  uint32_t getFlagCacheHits(void) const;
+
+  /**
+   * @return number of flag queries which had to read the joint.
+   */
+  uint32_t getFlagCacheMisses(void) const;
+
+  /**
+   * @brief Enables or disables write coalescing. Enabled by default.
    *
-   * a register can be read (R) or written (W), each register has a size in bytes.
-   * The payload can be split into multiple values or just be a single value.
-   * Note that not all functions are implemented.
+   * The joint mirrors the last acknowledged value of MOVETOANGLE, SETRPM, SETCURRENT, SETHOLDCURRENT and
+   * SETBRAKEMODE. A write of the same value (or within the deadband, see setDeadband()) is dropped and returns 0
+   * without a bus transaction. Joint::flags keep the value of the last transaction in that case.
+   * A value is only considered acknowledged if the transaction succeeded and the joint was not busy.
+   * Stop, home, setup and move commands as well as a stall invalidate the motion registers.
+   * @param enable true to drop redundant writes.
+   */
+  void setWriteCoalescing(bool enable);
+
+  /**
+   * @brief Sets the deadband of a float register of the shadow cache.
+   * @param reg MOVETOANGLE (encoder degrees) or SETRPM (encoder rpm)
+   * @param deadband writes closer than \a deadband to the last acknowledged value are dropped. Default: 0
+   * @return 0 on OK, -1 if the register is not cached.
+   */
+  int setDeadband(const stp_reg_t reg, const float deadband);
+
+  /**
+   * @brief Forgets all cached register values, the next write of every register goes to the bus.
    *
+   * Call this if the joint may have changed its state without this object, e.g. after a firmware reset.
    */
-  enum stp_reg_t
-  {
-    PING = 0x0f,                ///< R; Size: 1; [(char) ACK]
-    SETUP = 0x10,               ///< W; Size: 2; [(uint8) holdCurrent, (uint8) driveCurrent]
-    SETRPM = 0x11,              ///< W; Size: 4; [(float) RPM]
-    GETDRIVERRPM = 0x12,        ///<
-    MOVESTEPS = 0x13,           ///< W; Size: 4; [(int32) steps]
-    MOVEANGLE = 0x14,           ///<
-    MOVETOANGLE = 0x15,         ///< W; Size: 4; [(float) degrees]
-    GETMOTORSTATE = 0x16,       ///<
-    RUNCOTINOUS = 0x17,         ///<
-    ANGLEMOVED = 0x18,          ///< R; Size: 4; [(float) degrees]
-    SETCURRENT = 0x19,          ///< W; Size: 1; [(uint8) driveCurrent]
-    SETHOLDCURRENT = 0x1A,      ///< W; Size: 1; [(uint8) holdCurrent]
-    SETMAXACCELERATION = 0x1B,  ///<
-    SETMAXDECELERATION = 0x1C,  ///<
-    SETMAXVELOCITY = 0x1D,      ///<
-    ENABLESTALLGUARD = 0x1E,    ///< W; Size: 1; [(uint8) threshold]
-    DISABLESTALLGUARD = 0x1F,   ///<
-    CLEARSTALL = 0x20,          ///<
-    ISSTALLED = 0x21,           ///< R; Size: 1; [(uint8) isStalled]
-    SETBRAKEMODE = 0x22,        ///< W; Size: 1; [(uint8) mode]
-    ENABLEPID = 0x23,           ///<
-    DISABLEPID = 0x24,          ///<
-    ENABLECLOSEDLOOP = 0x25,    ///<
-    DISABLECLOSEDLOOP = 0x26,   ///< W; Size: 1; [(uint8) 0]
-    SETCONTROLTHRESHOLD = 0x27, ///<
-    MOVETOEND = 0x28,           ///<
-    STOP = 0x29,                ///< W; Size: 1; [(uint8) mode]
-    GETPIDERROR = 0x2A,         ///<
-    CHECKORIENTATION = 0x2B,    ///< W; Size: 4; [(float) degrees]
-    GETENCODERRPM = 0x2C,       ///< R; Size: 4; [(float) RPM]
-    HOME = 0x2D,                ///< W; Size: 4; [(uint8) current, (int8) sensitivity, (uint8) speed, (uint8) direction]
-    ISHOMED = 0x2E,             ///< R; Size: 1; [(uint8) isStalled]
-    ISSETUP = 0x2F              ///< R; Size: 1; [(uint8) isStalled]
-  };
+  void invalidateShadow(void);
+
+  /**
+   * @return number of writes dropped by the shadow cache.
+   */
+  uint32_t getCoalescedWrites(void) const;
+
+  /**
+   * @return estimated bus time in us saved by dropped writes, based on the last measured latency of each register.
+   */
+  uint64_t getSavedBusTime(void) const;
+
+  /**
+   * @brief Recovers the communication with the joint after a failed transaction.
+   *
+   * The sequence depends on the class of the last error (see classifyBusError()):
+   * 1) On a timeout or a stuck bus the bus is reset (Bus_backend::reset()), a failed reset is counted in getRecoveryStats(). \n
+   * 2) The handle is closed and reopened. \n
+   * 3) The joint is pinged every millisecond until it answers or the budget is spent. \n
+   * 4) The shadow cache is invalidated. If the joint lost its setup, e.g. after a firmware reset, the currents
+   * of the last enable() and the stallguard threshold of the last enableStallguard() are written again. \n
+   * The homed state is read back, a joint which lost its homing must be homed again before it moves.
+   * The duration is added to getRecoveryStats().
+   * @param budget_us time budget in us. A transaction in flight when the budget ends is completed.
+   * @return 0 on OK, negative if the joint did not answer within the budget or restoring the setup failed.
+   */
+  int recover(const uint64_t budget_us = RECOVERY_BUDGET_US);
+
+  /**
+   * @return class of the error of the last transaction, BUS_OK if it succeeded.
+   */
+  bus_error_t getLastError(void) const;
+
+  /**
+   * @return statistics of the recoveries of this joint.
+   */
+  const Recovery_stats &getRecoveryStats(void) const;
+
+  std::string name;
+
+protected:
+private:
+  friend class Joint_comms; ///< Joint_comms decodes batched transfers directly into the joints
 
   template <typename T>
   int read(const stp_reg_t reg, T &data, u_int8_t &flags);
@@ -216,6 +802,52 @@ private:
   template <typename T>
   int write(const stp_reg_t reg, T data, u_int8_t &flags);
 
+  /**
+   * @brief Last acknowledged value of a write-only register
+   */
+  struct Shadow_register
+  {
+    bool valid = false;   ///< value is known to be set on the joint
+    float value = 0;      ///< last acknowledged value
+    float deadband = 0;   ///< writes closer than this to value are dropped
+    uint64_t latency = 0; ///< round trip time of the last write in us
+  };
+
+  /**
+   * @brief Updates the status cache with the flags of a successful transaction.
+   * @param flags received flags
+   * @param command true if the flags were returned by a command, i.e. before it is executed.
+   */
+  void updateFlags(const u_int8_t flags, const bool command);
+
+  /**
+   * @brief Checks the status cache before a flag query and counts hits and misses.
+   * @return true if the cached flags are fresh enough to answer the query.
+   */
+  bool flagsCached(void);
+
+  /**
+   * @return index of \a reg in the shadow cache, -1 if the register is not cached.
+   */
+  static int shadowSlot(const stp_reg_t reg);
+
+  /**
+   * @brief Checks the shadow cache before a write.
+   * @return true if the write is redundant and must be dropped.
+   */
+  bool coalesce(const int slot, const float value);
+
+  /**
+   * @brief Updates the shadow cache after a write transaction.
+   * @param reg written register
+   * @param slot shadow slot of \a reg or -1
+   * @param value written value
+   * @param rc return code of the transaction
+   * @param flags flags returned by the transaction
+   * @param latency_us round trip time of the transaction
+   */
+  void updateShadow(const stp_reg_t reg, const int slot, const float value, const int rc, const u_int8_t flags, const uint64_t latency_us);
+
   /**
    * @brief State flags transmitted with every I2C transaction.
    *
@@ -226,13 +858,16 @@ private:
    *
    * |BIT7|BIT6|BIT5|BIT4|BIT3|BIT2|BIT1|BIT0|
    * | ---- | ---- | ---- | ---- | ---- | ---- | ---- | ---- |
-   * |reserved|reserved|reserved|reserved|SETUP|HOMED|BUSY|STALL|
+   * |PVT|PVT|PVT|FRAME|SETUP|HOMED|BUSY|STALL|
    *
    * \b STALL is set if a stall from the stall detection is sensed and the joint is stopped.
    * The flag is cleared when the joint is homed. \n
    * \b BUSY is set if the slave is busy processing a previous command. \n
    * \b HOMED is set if the joint is homed. Movement is only allowed if this flag is clear \n
-   * \b SETUP is set if the joint is setup after calling Joint::enable()
+   * \b SETUP is set if the joint is setup after calling Joint::enable() \n
+   * \b FRAME (I2C_FRAME_ERROR) is set in the reply to a rejected framed command, see Bus_backend::setFraming().
+   * The backend fails the transaction then, hence the bit is never stored here. \n
+   * \b PVT is the fill level 0 - 7 of the trajectory buffer, see getTrajectorySpace().
    */
   u_int8_t flags = 0x00;
 
@@ -244,6 +879,29 @@ private:
   float offset = 0;      ///< offset in degrees or mm from encoder zero to joint zero.
 
   int handle = -1; ///< I2C bus handle
+  std::shared_ptr<Bus_backend> bus; ///< backend carrying the transactions
+
+  Shadow_register shadow[SHADOW_REGS]; ///< write coalescing cache
+  bool coalescing = true;              ///< drop redundant writes
+  interp_mode_t interpolation = INTERP_OFF; ///< interpolation of position setpoints, see setInterpolation()
+  uint32_t coalescedWrites = 0;        ///< number of dropped writes
+  uint64_t savedBusTime = 0;           ///< estimated bus time saved in us
+  uint16_t captureDivider = 1;         ///< divider of the running capture, see startCapture()
+  uint32_t captureNext = 0;            ///< index of the next sample of the capture, unwrapped
+  const std::atomic<bool> *busThread = nullptr; ///< running flag of the bus thread of the owning Joint_comms
+
+  bool flagsFresh = false;                    ///< flags were received by a read and not invalidated by a command
+  uint64_t flagsStamp = 0;                    ///< getClock() time the flags were received
+  uint64_t flagsMaxAge = FLAGS_MAX_AGE_US;    ///< age up to which the flags answer queries
+  uint32_t flagCacheHits = 0;                 ///< flag queries answered from the cache
+  uint32_t flagCacheMisses = 0;               ///< flag queries which read the joint
+
+  int lastError = 0;              ///< return code of the last transaction, 0 on OK
+  u_int8_t setupDriveCurrent = 0; ///< drive current of the last successful enable()
+  u_int8_t setupHoldCurrent = 0;  ///< hold current of the last successful enable()
+  bool setupValid = false;        ///< enable() succeeded at least once
+  int stallguardThreshold = -1;   ///< threshold of the last enableStallguard(), -1 if not enabled
+  Recovery_stats recoveryStats;   ///< recovery time metrics
 };
 
 #include "joint_communication/mJoint.hpp"
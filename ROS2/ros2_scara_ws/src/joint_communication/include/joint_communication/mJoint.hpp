@@ -12,13 +12,16 @@
 #include "joint_communication/mJoint.h"
 #include "joint_communication/uI2C.h"
 #include "joint_communication/common.h"
+#include "joint_communication/uClock.h"
+#include <type_traits>
 
 /**
  * @brief Wrapper function to request data from the I2C slave.
  *
- * Allocates a buffer of size sizeof(T) + RFLAGS_SIZE.
- * invokes readFromI2CDev(), and copies the received payload to \a data  and the transmisison flags
- * to \a flags. See Joint::flags for details.
+ * Uses a stack buffer of size sizeof(T) + RFLAGS_SIZE, the size is checked against MAX_BUFFER at compile time.
+ * invokes Bus_backend::read() of the joints backend, and copies the received payload to \a data  and the transmisison flags
+ * to \a flags. See Joint::flags for details. The flags refresh the status cache, see Joint::setFlagsMaxAge().
+ * A failed transaction leaves \a data and \a flags unchanged and invalidates the status cache.
  *@todo
 - Implement a return code for read only functions
 - Implement clearStall function
@@ -31,26 +34,32 @@
 template <typename T>
 int Joint::read(const stp_reg_t reg, T &data, u_int8_t &flags)
 {
-    size_t size = sizeof(T) + RFLAGS_SIZE;
-    char *buf = new char[size];
-    int n = readFromI2CDev(this->handle, reg, buf, size);
+    static_assert(sizeof(T) <= MAX_BUFFER, "register payload exceeds MAX_BUFFER");
+    constexpr size_t size = sizeof(T) + RFLAGS_SIZE;
+    char buf[size];
+    int n = this->bus->read(this->handle, reg, buf, size);
     if (n != static_cast<int>(size))
     {
-        delete[] buf;
+        this->lastError = n < 0 ? n : -EBADMSG;
+        this->flagsFresh = false; // the status cache must not outlive a lost transaction
         return -1;
     }
+    this->lastError = 0;
     memcpy(&data, buf, size - RFLAGS_SIZE);
     memcpy(&flags, buf + size - RFLAGS_SIZE, RFLAGS_SIZE);
-    delete[] buf;
+    this->updateFlags(flags, false);
     return 0;
 }
 
 /**
  * @brief Wrapper function to send command to the I2C slave.
  *
- * Allocates a buffer of size sizeof(T) + RFLAGS_SIZE. Copyies \a data to the buffer
- * and invokes writeToI2CDev(). The flags received from the transaction are copied to \a flags.
+ * Uses a stack buffer of size sizeof(T) + RFLAGS_SIZE like Joint::read(). Copyies \a data to the buffer
+ * and invokes Bus_backend::write(). The flags received from the transaction are copied to \a flags, a failed
+ * transaction leaves \a flags unchanged and invalidates the status cache.
  * The flags are described in Joint::read().
+ * Writes to registers of the shadow cache are dropped if they are redundant, see Joint::setWriteCoalescing().
+ * Only arithmetic payloads are mirrored in the shadow cache, structured payloads (e.g. PUSHPVT) are always sent.
  *
  *
  * @tparam T Datatype of value to be transmitted
@@ -63,13 +72,37 @@ int Joint::read(const stp_reg_t reg, T &data, u_int8_t &flags)
 template <typename T>
 int Joint::write(const stp_reg_t reg, T data, u_int8_t &flags)
 {
-    size_t size = sizeof(T) + RFLAGS_SIZE;
-    char *buf = new char[size];
+    float value = 0;
+    int slot = -1;
+    if constexpr (std::is_arithmetic_v<T>)
+    {
+        value = static_cast<float>(data);
+        slot = Joint::shadowSlot(reg);
+    }
+    if (slot >= 0 && this->coalesce(slot, value))
+    {
+        return 0;
+    }
+
+    static_assert(sizeof(T) <= MAX_BUFFER, "register payload exceeds MAX_BUFFER");
+    constexpr size_t size = sizeof(T) + RFLAGS_SIZE;
+    char buf[size];
     memcpy(buf, &data, size - RFLAGS_SIZE);
-    int rc = writeToI2CDev(this->handle, reg, buf, size - RFLAGS_SIZE, buf + size - RFLAGS_SIZE);
+    uint64_t start = getClock().now();
+    int rc = this->bus->write(this->handle, reg, buf, size - RFLAGS_SIZE, buf + size - RFLAGS_SIZE);
     rc = rc > 0 ? 0 : rc;
+    this->lastError = rc;
 
-    memcpy(&flags, buf + size - RFLAGS_SIZE, RFLAGS_SIZE);
-    delete[] buf;
+    // the flags byte of a failed transfer is undefined, \a flags keeps the last good flags then
+    if (rc == 0)
+    {
+        memcpy(&flags, buf + size - RFLAGS_SIZE, RFLAGS_SIZE);
+        this->updateFlags(flags, true);
+    }
+    else
+    {
+        this->flagsFresh = false;
+    }
+    this->updateShadow(reg, slot, value, rc, flags, getClock().now() - start);
     return rc;
 }
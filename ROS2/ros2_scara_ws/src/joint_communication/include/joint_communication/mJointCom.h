@@ -14,9 +14,80 @@
 #ifndef MJOINTCOM_H
 #define MJOINTCOM_H
 
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
 #include <vector>
 #include <iostream>
 #include "joint_communication/mJoint.h"
+#include "joint_communication/uQueue.h"
+#include "joint_communication/uSeqlock.h"
+
+/**
+ * @brief Maximum number of joints in a Joint_snapshot and Joint_command
+ */
+#define MAX_JOINTS 8
+
+/**
+ * @brief Capacity of the command queue of every priority class of the bus thread
+ */
+#define COMMAND_QUEUE_SIZE 64
+
+/**
+ * @brief Idle poll period of the bus thread in us, bounds the latency of a command arriving at an idle bus
+ */
+#define BUS_IDLE_POLL_US 100
+
+/**
+ * @brief Priority classes of the bus thread transaction scheduler, lower value is served first.
+ */
+enum bus_prio_t
+{
+  PRIO_EMERGENCY = 0, ///< stops()
+  PRIO_MOTION,        ///< setPositions(), setVelocities()
+  PRIO_CONFIG,        ///< currents, brake modes, stallguards, closed loop
+  PRIO_TELEMETRY,     ///< periodic read of positions, velocities and flags
+  PRIO_CLASSES        ///< number of priority classes
+};
+
+/**
+ * @brief Queueing statistics of a priority class, see Joint_comms::getClassStats().
+ */
+struct Bus_class_stats
+{
+  uint32_t count = 0;           ///< number of commands started
+  uint32_t deadline_misses = 0; ///< commands which waited longer than the deadline of the class
+  uint64_t max_wait_us = 0;     ///< longest time a command waited until its first transaction
+  uint64_t total_wait_us = 0;   ///< sum of all waits
+};
+
+/**
+ * @brief Homing parameters of a joint, see Joint::home().
+ */
+struct Home_config
+{
+  u_int8_t direction;   ///< CCW: 0, CW: 1
+  u_int8_t rpm;         ///< speed of motor in rpm > 10
+  u_int8_t sensitivity; ///< PID error threshold, 0 to 255
+  u_int8_t current;     ///< homing current
+};
+
+/**
+ * @brief Latest joint state published by the bus thread, see Joint_comms::startBusThread().
+ */
+struct Joint_snapshot
+{
+  float q[MAX_JOINTS] = {0};       ///< positions in degrees or mm
+  float qd[MAX_JOINTS] = {0};      ///< velocities in degrees/s or mm/s
+  float pidError[MAX_JOINTS] = {0}; ///< PID errors in steps
+  u_int8_t flags[MAX_JOINTS] = {0}; ///< state flags of every joint, see Joint::flags
+  uint64_t stamp = 0;              ///< getClock() time in us when the state was read
+  uint32_t cycle = 0;              ///< number of the telemetry period since the bus thread was started
+  int rc = -1;                     ///< 0 if the state was read successfully, negative otherwise
+};
 
 /**
  * @brief Communication object for all joints.
@@ -60,12 +131,23 @@ public:
  * J1: 35; J2: -360/4 (4 mm per revolution); J3: 24; J4: 12;
  * @param offset offset between encoder zero and joint zero (in joint units).
  * J1: TBD; J2: -TBD (negative because homed at top); J3: TBD; J4: TBD;
+ * @param bus backend carrying the transactions of this joint, e.g. an I2CDEV_backend.
+ * If nullptr the defaultBusBackend() is used.
  * @todo 
  * - Measure joint ranges
  * - Investigate if possible to make independent of homing
 
  */
-  void addJoint(const int address, const std::string name, const float gearRatio, const float offset);
+  void addJoint(const int address, const std::string name, const float gearRatio, const float offset, std::shared_ptr<Bus_backend> bus = nullptr);
+
+  /**
+   * @brief add a Joint connected to an I2C adapter of the host.
+   *
+   * Joints on different adapters are served by separate workers of the bus thread, see startBusThread().
+   * The other parameters are described in addJoint().
+   * @param bus_id adapter number N of `/dev/i2c-N`, e.g. 1, 3 or 4 on the Raspberry Pi 4. See busBackend().
+   */
+  void addJoint(const int address, const std::string name, const float gearRatio, const float offset, const int bus_id);
 
   /**
  * @brief Engages the joints
@@ -116,16 +198,52 @@ public:
    */
   int home(std::string name, u_int8_t direction, u_int8_t rpm, u_int8_t sensitivity, u_int8_t current);
 
+  /**
+   * @brief Starts homing all joints at the same time and returns immediately.
+   *
+   * The joints home in parallel, their progress is read with getHomeStates() and getPositions().
+   * Not available while the bus thread runs.
+   * @param configs homing parameters, configs[i] for joint i.
+   * @return 0 on OK, -2 on a size mismatch, -3 if the bus thread runs, negative on error.
+   */
+  int startHomes(std::span<const Home_config> configs);
+
+  /**
+   * @brief Reads the homing state of all joints, see Joint::getHomeState().
+   * @param states output, states[i] for joint i.
+   * @return 0 on OK, -2 on a size mismatch, -3 if the bus thread runs, negative on error.
+   */
+  int getHomeStates(std::span<Joint::home_state_t> states);
+
+  /**
+   * @brief Homes all joints in parallel and waits until all of them finished.
+   * @param configs homing parameters, configs[i] for joint i.
+   * @param poll_us time between two reads of the homing states.
+   * @return 0 if all joints are homed, 1 if a joint timed out or was aborted, -2 on a size mismatch,
+   * -3 if the bus thread runs, negative on error.
+   */
+  int homes(std::span<const Home_config> configs, const uint32_t poll_us = 100000);
+
   /**
    * @brief Get the positions of all joints.
    *
    * The current positions of all joints are returned. The units are degrees and mm for
    * revolute and prismatic joints respectively.
    *
-   * @param angle_v Reference to allocated vector of appropriate size to hold all joint positions.
+   * @param angle_v Allocated vector or array of appropriate size to hold all joint positions.
    * @return error code.
    */
-  int getPositions(std::vector<float> &angle_v);
+  int getPositions(std::span<float> angle_v);
+
+  /**
+   * @brief Overload for a fixed number of joints, the size is checked against MAX_JOINTS at compile time.
+   */
+  template <size_t N>
+  int getPositions(std::array<float, N> &angle_v)
+  {
+    static_assert(N <= MAX_JOINTS, "more joints than MAX_JOINTS");
+    return this->getPositions(std::span<float>(angle_v));
+  }
 
   /**
    * @brief Set the positions of all joints.
@@ -136,7 +254,41 @@ public:
    * @param angle_v Vector of new target positions.
    * @return error code.
    */
-  int setPositions(std::vector<float> angle_v);
+  int setPositions(std::span<const float> angle_v);
+
+  /**
+   * @brief Overload for a fixed number of joints, the size is checked against MAX_JOINTS at compile time.
+   */
+  template <size_t N>
+  int setPositions(const std::array<float, N> &angle_v)
+  {
+    static_assert(N <= MAX_JOINTS, "more joints than MAX_JOINTS");
+    return this->setPositions(std::span<const float>(angle_v));
+  }
+
+  /**
+   * @brief Set the positions of all joints, all joints start to move at the same time.
+   *
+   * setPositions() writes the joints one after the other, hence the last joint starts several transactions after
+   * the first one and coordinated paths are skewed. Here every joint latches its target first (see Joint::latchPosition())
+   * without moving, then one broadcast per bus (see Bus_backend::broadcast()) commits all targets at once.
+   * The remaining skew is the loop phase of the joints, see getStartSkew(). Joints on different buses are
+   * committed one bus after the other. Backends without broadcast commit every joint separately.
+   * While the bus threads run, the command is queued as a motion command and every worker commits its bus.
+   * @param angle_v Vector of new target positions.
+   * @return 0 on OK, 1 if a joint stalled, 2 if a joint is not homed, -2 on a size mismatch, negative on error.
+   */
+  int setPositionsSynchronized(std::span<const float> angle_v);
+
+  /**
+   * @brief Start skew of the last synchronized move, see setPositionsSynchronized().
+   *
+   * Reads the commit delay of every joint (see Joint::getCommitDelay()), the skew is the spread of the delays.
+   * The time between the broadcasts on different buses is not included. Not available while the bus thread runs.
+   * @param skew_us longest minus shortest commit delay in microseconds
+   * @return 0 on OK, -1 on a failed transaction, -3 if the bus thread runs.
+   */
+  int getStartSkew(uint32_t &skew_us);
 
   /**
    * @brief Get the velocities of all joints.
@@ -144,10 +296,30 @@ public:
    * The current velocities of all joints are returned. The units are degrees/s and mm/s for
    * revolute and prismatic joints respectively.
    *
-   * @param degps_v Reference to allocated vector of appropriate size to hold all joint velocities.
+   * @param degps_v Allocated vector or array of appropriate size to hold all joint velocities.
    * @return error code.
    */
-  int getVelocities(std::vector<float> &degps_v);
+  int getVelocities(std::span<float> degps_v);
+
+  /**
+   * @brief Overload for a fixed number of joints, the size is checked against MAX_JOINTS at compile time.
+   */
+  template <size_t N>
+  int getVelocities(std::array<float, N> &degps_v)
+  {
+    static_assert(N <= MAX_JOINTS, "more joints than MAX_JOINTS");
+    return this->getVelocities(std::span<float>(degps_v));
+  }
+
+  /**
+   * @brief Get the full state of all joints.
+   *
+   * Position, velocity, PID error and flags of a joint are read with one GETSTATE transaction,
+   * batched for all joints if enabled (see setBatchedReads()).
+   * @param states Allocated vector or array of appropriate size to hold the states of all joints.
+   * @return error code.
+   */
+  int getStates(std::span<Joint_state> states);
 
   /**
    * @brief Set the velocities of all joints.
@@ -158,7 +330,31 @@ public:
    * @param degps_v Vector of new target velocities.
    * @return error code.
    */
-  int setVelocities(std::vector<float> degps_v);
+  int setVelocities(std::span<const float> degps_v);
+
+  /**
+   * @brief Overload for a fixed number of joints, the size is checked against MAX_JOINTS at compile time.
+   */
+  template <size_t N>
+  int setVelocities(const std::array<float, N> &degps_v)
+  {
+    static_assert(N <= MAX_JOINTS, "more joints than MAX_JOINTS");
+    return this->setVelocities(std::span<const float>(degps_v));
+  }
+
+  /**
+   * @brief Streams a trajectory of every joint to the trajectory buffers of the joints.
+   *
+   * Every \a period_us the free space of every buffer is read (see Joint::getTrajectorySpace()) and topped up
+   * with the next points (see Joint::pushTrajectory()). The joints play the points from their own clock, hence the
+   * motion does not depend on the latency of the host as long as the buffers do not run empty.
+   * Returns once all points are pushed and all buffers ran empty. Not available while the bus thread runs.
+   * @param points trajectory of every joint, points[i] for joint i. The last point should have zero velocity.
+   * @param period_us time between two top ups, must be well below the duration of PVT_BUFFER points.
+   * @return 0 on OK, 1 if a joint stalled, 2 if a joint is not homed, -1 on a failed transaction, -2 on a size mismatch,
+   * -3 if the bus thread runs.
+   */
+  int streamTrajectory(std::span<const std::vector<PVT_point>> points, const uint32_t period_us = 20000);
 
   /**
    * @brief Sequentially checks the orientations of each joint.
@@ -184,7 +380,8 @@ public:
   /**
    * @brief Stops the motors
    *
-   * Stops all motors either soft or hard.
+   * Stops all motors either soft or hard. With the bus thread running, the motion commands queued before
+   * the stop are dropped, including the joints a running setPositions() or setVelocities() did not reach yet.
    * @param mode Hard: 0, Soft: 1
    * @return error code.
    */
@@ -242,15 +439,115 @@ public:
    */
   int setBrakeModes(u_int8_t mode);
 
+  /**
+   * @brief Sets the interpolation of the position setpoints of all joints, see Joint::setInterpolation().
+   *
+   * Useful if setPositions() is called by a controller at a fixed rate.
+   * @param mode interpolation mode
+   * @return error code.
+   */
+  int setInterpolations(Joint::interp_mode_t mode);
+
   /**
    * @brief Enable encoder stall detection.
    *
    * If the PID error exceeds the set threshold a stall is triggered and the motor disabled.
    * A detected stall can be reset by homeing.
    * @param thresholds Vector of thresholds. 0 - 255 where lower is more sensitive.
+   * The i'th entry is applied to the i'th joint, joints without an entry are left unchanged.
    */
   int enableStallguards(std::vector<u_int8_t> thresholds);
 
+  /**
+   * @brief Enables or disables batched reads.
+   *
+   * If enabled, getPositions() and getVelocities() read the register of all joints in a single
+   * combined I2C transfer (see Bus_backend::readBatch()) and decode all payloads and return flags in one pass.
+   * This costs one syscall per call instead of one per joint. Disabled by default.
+   * @param enable true to read all joints in one transfer.
+   */
+  void setBatchedReads(bool enable);
+
+  /**
+   * @brief Starts one thread per bus backend which owns the bus.
+   *
+   * Joints sharing a Bus_backend (e.g. joints added with the same bus id) are served by one I/O worker,
+   * joints on different adapters are read and written in parallel. The telemetry periods of all workers are aligned,
+   * and the state of all joints is assembled into one snapshot per period once every worker completed it.
+   *
+   * While the threads run, setPositions(), setVelocities(), stops(), setDriveCurrents(), setHoldCurrents(),
+   * setBrakeModes(), setInterpolations(), enableStallguards() and disableCLs() only enqueue the command in the lock-free queue of its
+   * priority class (see bus_prio_t) of every worker and return immediately. Every \a period_us a telemetry command
+   * reading the state (GETSTATE: position, velocity, PID error and flags) of all joints is added. The result is published in a sequence locked
+   * snapshot, so getPositions(), getVelocities() and getSnapshot() return in O(1) without touching the bus.
+   *
+   * Commands are split into single transactions. Before every transaction a worker picks the highest priority
+   * class with pending work, hence a stop reaches the bus after at most one transaction of a lower class,
+   * never behind a complete telemetry cycle. Commands of the same class are executed in order.
+   * @warning While the threads run, no other function of this class or of the joints may be called.
+   * @param period_us telemetry period in us.
+   * @return 0 on OK, -1 if the threads are already running or more than MAX_JOINTS joints were added.
+   */
+  int startBusThread(const uint32_t period_us = 10000);
+
+  /**
+   * @brief Stops the bus thread after the current transaction. Queued stops() are still executed.
+   */
+  void stopBusThread(void);
+
+  /**
+   * @return the latest joint state published by the bus thread.
+   */
+  Joint_snapshot getSnapshot(void) const;
+
+  /**
+   * @return number of commands which could not be queued or failed to execute in the bus thread.
+   */
+  uint32_t getCommandErrors(void) const;
+
+  /**
+   * @return number of queued motion commands which were superseded by a newer one before they were completed.
+   */
+  uint32_t getMergedCommands(void) const;
+
+  /**
+   * @brief Sets the queueing deadline of a priority class.
+   *
+   * A command which waits longer than the deadline before its first transaction counts as a deadline miss.
+   * Defaults: emergency 1 ms, motion and telemetry one period, configuration 100 ms.
+   * @param prio priority class
+   * @param deadline_us deadline in us
+   */
+  void setDeadline(const bus_prio_t prio, const uint32_t deadline_us);
+
+  /**
+   * @return queueing statistics of a priority class summed over all workers of the last started bus thread.
+   */
+  Bus_class_stats getClassStats(const bus_prio_t prio) const;
+
+  /**
+   * @brief Recovers every joint whose last transaction failed, see Joint::recover().
+   * @warning Do not call while the bus thread runs, the workers recover their joints themselves (see setAutoRecovery()).
+   * @return 0 if all joints are reachable again, -1 otherwise.
+   */
+  int recover(void);
+
+  /**
+   * @brief Enables or disables the recovery of the bus threads. Enabled by default.
+   *
+   * If enabled, a worker recovers a joint (Joint::recover()) after a transaction failed with a NACK, a timeout
+   * or a stuck bus. The worker does not serve other commands during the recovery, hence \a budget_us bounds
+   * the additional latency of queued commands.
+   * @param enable true to recover in the bus threads.
+   * @param budget_us time budget of a recovery in us.
+   */
+  void setAutoRecovery(const bool enable, const uint64_t budget_us = RECOVERY_BUDGET_US);
+
+  /**
+   * @return recovery statistics summed over all joints. While the bus thread runs, the state of the last completed recovery.
+   */
+  Recovery_stats getRecoveryStats(void) const;
+
   /**
    * @brief Internal vector storing the Joint objects.
    *
@@ -260,6 +557,150 @@ public:
 
 protected:
 private:
+  /**
+   * @brief Commits the latched targets of joints with one broadcast per bus, see setPositionsSynchronized().
+   * @param ids indices of the joints
+   * @param n number of joints
+   * @return 0 on OK, negative on error
+   */
+  int commitLatched(const size_t *ids, const size_t n);
+
+  /**
+   * @brief Reads a register from several joints in combined transfers.
+   *
+   * Updates the flags of every joint with the flags returned in the same transfer.
+   * @param reg register to read
+   * @param ids indices of the joints to read
+   * @param addrs addresses of the joints to read
+   * @param n number of joints
+   * @param buf receive buffer of at least n * (length + RFLAGS_SIZE) + 1 bytes
+   * @param length payload size of the register
+   * @param values array of n payloads to hold the raw (encoder unit) values.
+   * @return 0 on OK, negative on error
+   */
+  int readBatched(const int reg, const size_t *ids, const int *addrs, const size_t n, char *buf, const size_t length, void *values);
+
+  /**
+   * @brief Command queued for the bus thread
+   */
+  struct Joint_command
+  {
+    enum
+    {
+      POSITIONS,
+      SYNCPOSITIONS,
+      VELOCITIES,
+      STOPS,
+      DRIVECURRENTS,
+      HOLDCURRENTS,
+      BRAKEMODES,
+      INTERPOLATIONS,
+      STALLGUARDS,
+      DISABLECLS,
+      TELEMETRY
+    } type;
+    float values[MAX_JOINTS]; ///< one value per joint
+    bool mode;                ///< stop mode
+    uint64_t stamp;           ///< getClock() time when the command was queued
+  };
+
+  /**
+   * @brief Command of a priority class which is being executed
+   */
+  struct Active_command
+  {
+    Joint_command cmd;
+    size_t step = 0;     ///< next transaction
+    size_t steps = 0;    ///< number of transactions, 0 if idle
+    size_t first = 0;    ///< joint of the first transaction, a merge continues where the superseded command was
+  };
+
+  /**
+   * @return true if the caller must hand its request to the running bus thread.
+   */
+  bool deferred(void) const;
+
+  /**
+   * @brief Queues a command for the bus thread.
+   * @return 0 on OK, -3 if the queue is full.
+   */
+  int enqueue(const bus_prio_t prio, Joint_command &cmd);
+
+  /**
+   * @brief Overload queueing the same value for every joint.
+   */
+  int enqueue(const bus_prio_t prio, Joint_command &cmd, const float value);
+
+  /**
+   * @brief I/O worker owning a bus backend and the joints connected to it
+   */
+  struct Bus_worker
+  {
+    std::shared_ptr<Bus_backend> bus; ///< backend of the worker
+    std::vector<size_t> ids;          ///< indices of the joints of the worker
+    std::vector<int> addrs;           ///< addresses of the joints for batched reads
+    std::vector<char> buffer;         ///< preallocated receive buffer for batched reads
+    std::vector<float> values;        ///< preallocated buffer for the transform of batched telemetry
+    std::vector<Joint_state_payload> states; ///< preallocated buffer for batched telemetry
+    std::vector<float> gearRatios;    ///< gear ratios of the joints of the worker
+    std::vector<float> offsets;       ///< offsets of the joints of the worker
+    std::vector<float> zeros;         ///< zero offsets for velocities
+    std::thread thread;               ///< thread of the worker
+    Mpsc_queue<Joint_command, COMMAND_QUEUE_SIZE> commands[PRIO_CLASSES]; ///< command queue per priority class
+    Joint_snapshot telemetry;                          ///< state of the joints of the worker being read
+    Seqlock<Joint_snapshot> partial;                   ///< last complete state of the joints of the worker
+    Seqlock<Bus_class_stats> classStats[PRIO_CLASSES]; ///< queueing statistics per class
+    Seqlock<Recovery_stats> recoveryStats;             ///< recovery statistics of the joints of the worker
+  };
+
+  /**
+   * @return the number of transactions of a command on a worker.
+   */
+  size_t steps(const Bus_worker &worker, const Joint_command &cmd) const;
+
+  /**
+   * @brief Executes one transaction of a command.
+   * @param step transaction of the command
+   * @param first joint of the first transaction
+   * @return error code of the transaction.
+   */
+  int executeStep(Bus_worker &worker, const Joint_command &cmd, const size_t step, const size_t first);
+
+  /**
+   * @brief Main function of a worker thread.
+   */
+  void busThreadLoop(Bus_worker &worker, const uint32_t period_us);
+
+  /**
+   * @brief Publishes the snapshot of the latest period completed by all workers.
+   */
+  void assembleSnapshot(void);
+
+  /**
+   * @brief Recovers a joint of a worker after a failed transaction if auto recovery is enabled and the error is recoverable.
+   */
+  void recoverInWorker(Bus_worker &worker, const size_t joint);
+
+  bool batchedReads = false;      ///< read all joints in one transfer
+  std::vector<char> batchBuffer;  ///< preallocated receive buffer for batched reads
+  std::vector<int> batchAddrs;    ///< preallocated address list for batched reads
+  std::vector<size_t> batchIds;   ///< preallocated index list for batched reads
+  std::vector<Joint_state_payload> batchStates; ///< preallocated buffer for batched getStates()
+  std::vector<float> gearRatios;  ///< gear ratio per joint, contiguous for the batched transform
+  std::vector<float> offsets;     ///< offset per joint, contiguous for the batched transform
+  std::vector<float> zeros;       ///< zero offset per joint for velocities
+
+  std::vector<std::unique_ptr<Bus_worker>> workers;        ///< one worker per bus backend
+  std::atomic<bool> running{false};                        ///< bus threads shall run
+  uint64_t busStart = 0;                                   ///< getClock() time the bus threads were started
+  std::mutex assembleLock;                                 ///< serializes writers of the snapshot
+  uint32_t assembledCycle = 0;                             ///< period of the published snapshot
+  Seqlock<Joint_snapshot> snapshot;                        ///< latest state read by the bus threads
+  std::atomic<uint32_t> commandErrors{0};                  ///< failed commands of the bus threads
+  std::atomic<uint32_t> mergedCommands{0};                 ///< superseded motion commands
+  std::atomic<uint32_t> deadlines[PRIO_CLASSES];           ///< queueing deadline per class in us
+  std::atomic<bool> autoRecovery{true};                    ///< workers recover failed joints
+  std::atomic<uint64_t> recoveryBudget{RECOVERY_BUDGET_US}; ///< time budget of a recovery in us
 };
 
 #endif
\ No newline at end of file
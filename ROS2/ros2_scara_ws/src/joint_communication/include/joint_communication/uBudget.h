@@ -0,0 +1,105 @@
+/**
+ * @file uBudget.h
+ * @author Sebastian Storz
+ * @brief Bandwidth budget of a joint bus for a control cycle
+ * @version 0.1
+ * @date 2025-06-23
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * Before the control rate is raised or a joint is added, planBusBudget() predicts whether the bus carries the load.
+ * A control cycle transfers a set of registers with every joint. The payload sizes are taken from the stp_reg_t
+ * annotations (Joint::registerSize()), the bit times from the backend (Bus_backend::transactionBits()).
+ * Every transaction costs its time on the wire plus the turnaround of host and firmware, which is measured with
+ * measureTurnaround(). validateBusBudget() compares a prediction with the transaction statistics of a running bus.
+ *
+ * \code{.cpp}
+Bus_cycle cycle;
+cycle.addrs = {0x11, 0x12, 0x13, 0x14};
+cycle.regs = {Joint::ANGLEMOVED, Joint::MOVETOANGLE};
+Bus_budget budget;
+planBusBudget(*bus, cycle, measureTurnaround(*bus, handle), budget);
+budget.print();
+  \endcode
+ */
+#ifndef UBUDGET_H
+#define UBUDGET_H
+
+#include <iostream>
+#include <vector>
+#include "joint_communication/mJoint.h"
+
+/**
+ * @brief Transactions of one control cycle on one bus
+ */
+struct Bus_cycle
+{
+  std::vector<int> addrs;             ///< addresses of the joints on the bus
+  std::vector<Joint::stp_reg_t> regs; ///< registers transferred with every joint per cycle
+  bool batched = false;               ///< reads of all joints are combined in one transfer, see Joint_comms::setBatchedReads()
+};
+
+/**
+ * @brief Time budget of a control cycle, see planBusBudget() and validateBusBudget().
+ */
+struct Bus_budget
+{
+  uint32_t transactions = 0; ///< bus transactions per cycle, a batched read counts once
+  uint64_t bits = 0;         ///< bit times on the wire per cycle
+  double wire_us = 0;        ///< time on the wire per cycle
+  double turnaround_us = 0;  ///< host and firmware turnaround per cycle
+  double cycle_us = 0;       ///< worst-case cycle time
+  double max_rate_hz = 0;    ///< highest sustainable control rate
+
+  /**
+   * @brief Prints the budget in one line.
+   */
+  void print(std::ostream &os = std::cout) const;
+};
+
+/**
+ * @brief Measures the turnaround of a transaction, i.e. the round trip time which is not spent on the wire.
+ *
+ * Pings the device \a n times, timed with getClock(), and subtracts the wire time of a PING at the current bus speed.
+ * @param bus backend to measure
+ * @param dev_handle device handle obtained from \a bus
+ * @param n number of transactions
+ * @return mean turnaround in microseconds, negative if a transaction failed.
+ */
+double measureTurnaround(Bus_backend &bus, const int dev_handle, const int n = 100);
+
+/**
+ * @brief Predicts the worst-case time of a control cycle and the highest sustainable control rate.
+ *
+ * Every joint and register costs one transaction. If \a cycle is batched, the reads of a register are combined
+ * into one transfer, which still carries the bits and the firmware turnaround of every joint.
+ * Retries are not included, every retry costs the time of its transaction again.
+ * @param bus backend carrying the cycle, provides the bit times per transaction.
+ * @param cycle transactions of a cycle
+ * @param turnaround_us host and firmware turnaround per transaction, see measureTurnaround().
+ * @param budget output
+ * @param hz bus speed in Hz. 0 to use Bus_backend::getSpeed().
+ * @param max_load fraction of the bus time the control cycle may use, the rest is left for configuration and jitter.
+ * @return 0 on OK, -1 if the bus speed is unknown or a register is not implemented.
+ */
+int planBusBudget(Bus_backend &bus, const Bus_cycle &cycle, const double turnaround_us, Bus_budget &budget,
+                  uint32_t hz = 0, const double max_load = 0.8);
+
+/**
+ * @brief Measures the time of a control cycle from the transaction statistics of a running bus.
+ *
+ * The latency percentile \a p of every transaction of \a cycle is summed, for a batched read the longest latency
+ * of the joints counts once. Since the latency histograms have power of two buckets (see Bus_stats_entry),
+ * the result is an upper bound. The wire time is taken from \a predicted, the rest is counted as turnaround.
+ * @param bus backend which carried the cycle
+ * @param cycle transactions of a cycle
+ * @param predicted prediction of planBusBudget()
+ * @param measured output
+ * @param p latency percentile 0 - 1
+ * @param max_load see planBusBudget()
+ * @return 0 on OK, -1 if a transaction of the cycle has not been recorded.
+ */
+int validateBusBudget(const Bus_backend &bus, const Bus_cycle &cycle, const Bus_budget &predicted, Bus_budget &measured,
+                      const double p = 0.99, const double max_load = 0.8);
+
+#endif // UBUDGET_H
@@ -0,0 +1,377 @@
+/**
+ * @file uBus.h
+ * @author Sebastian Storz
+ * @brief Bus backend interface used by the Joint class
+ * @version 0.1
+ * @date 2025-06-10
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * A bus backend carries the register transactions of a Joint. Every Joint picks its backend at
+ * construction time, which allows to exchange the lgpio based implementation with a direct
+ * i2c-dev implementation or any other transport without changing the Joint API.
+ */
+#ifndef UBUS_H
+#define UBUS_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "joint_communication/uSeqlock.h"
+#include "joint_communication/uStats.h"
+
+/**
+ * @brief Retry policy of a bus transaction.
+ *
+ * A failed attempt is retried after a backoff time which grows by \a backoff_factor with every retry.
+ * No retry is started if it would exceed the deadline measured from the start of the first attempt.
+ */
+struct Retry_policy
+{
+  int max_attempts = 3;           ///< attempts including the first one
+  uint32_t backoff_us = 50;       ///< wait before the first retry in us
+  float backoff_factor = 1.0;     ///< 1: constant backoff, 2: exponential backoff
+  uint32_t max_backoff_us = 5000; ///< upper limit of the backoff in us
+  uint32_t deadline_us = 0;       ///< deadline of the transaction in us, 0: no deadline
+};
+
+/**
+ * @brief Class of a failed bus transaction, see classifyBusError().
+ */
+enum bus_error_t
+{
+  BUS_OK = 0,   ///< no error
+  BUS_NACK,     ///< the device did not acknowledge, e.g. it is not powered or resetting
+  BUS_TIMEOUT,  ///< the transaction did not complete in time, e.g. the device stretched the clock too long
+  BUS_STUCK,    ///< arbitration lost or the bus is busy, e.g. a device holds SDA low
+  BUS_PROTOCOL, ///< the reply was corrupted
+  BUS_OTHER     ///< any other error, e.g. an invalid handle
+};
+
+/**
+ * @brief Classifies the return code of a transaction.
+ *
+ * The codes follow the Linux I2C fault codes (Documentation/i2c/fault-codes.rst) as negative errno.
+ * @param rc return code of Bus_backend::read(), write() or readBatch()
+ * @return error class, BUS_OK for rc >= 0.
+ */
+bus_error_t classifyBusError(const int rc);
+
+/**
+ * @brief CRC-8 with polynomial 0x07 (CRC-8/SMBUS), identical to the firmware implementation.
+ * @param data bytes to check
+ * @param length number of bytes
+ * @param crc start value, pass the result of a previous call to continue a checksum
+ * @return checksum
+ */
+uint8_t crc8(const uint8_t *data, const size_t length, uint8_t crc = 0);
+
+/**
+ * @brief Abstract bus backend.
+ *
+ * The semantics of the functions mirror openI2CDevHandle(), readFromI2CDev(), writeToI2CDev(),
+ * readFromI2CDevs() and closeI2CDevHandle(). Handles are only valid for the backend which returned them.
+ * read(), write() and readBatch() retry a failed attempt according to the Retry_policy of the register
+ * and record every transaction in the Bus_stats of the backend. Implementations only provide single attempts.
+ *
+ * If framing is enabled (see setFraming()), read(), write() and readBatch() wrap every transaction in a frame
+ * with protocol version, length and CRC-8 before it is passed to the implementation: \n
+ * command: \< [REG|I2C_FRAMED][HDR][PAYLOAD0]...[PAYLOADn][CRC] \> [HDR][FLAGS][CRC] \n
+ * read: \< [REG|I2C_FRAMED] \> [HDR][PAYLOAD0]...[PAYLOADn][FLAGS][CRC] \n
+ * \b HDR carries I2C_FRAME_VERSION in the upper two bits and the payload length in the lower six bits.
+ * \b CRC is crc8() over the device address, the register byte and the frame up to the byte before the checksum,
+ * hence a reply of another device or register is detected as well. The joint executes a command only if its frame
+ * is intact and sets I2C_FRAME_ERROR in the reply flags otherwise. Rejected commands and corrupted replies fail with
+ * -EBADMSG (BUS_PROTOCOL) and are resent according to the Retry_policy of the register.
+ * @note A command whose reply is corrupted has been executed and is executed again by the retry.
+ */
+class Bus_backend
+{
+public:
+  Bus_backend();
+  virtual ~Bus_backend() {}
+
+  /**
+   * @brief Initiates a device on the bus
+   * @param dev_addr 7-bit device adress [0 - 0x7F]
+   * @return the device handle, negative on error.
+   */
+  virtual int open(const int dev_addr) = 0;
+
+  /**
+   * @brief close a device on the bus
+   * @param dev_handle device handle obtained from open()
+   * @return 0 on OK, negative on error.
+   */
+  virtual int close(const int dev_handle) = 0;
+
+  /**
+   * @brief reads block of bytes from device to buffer
+   * @param dev_handle device handle obtained from open()
+   * @param reg the command/data register
+   * @param buffer pointer to data buffer to hold received values
+   * @param data_length number of bytes to read
+   * @return number of bytes read, negative on error.
+   */
+  int read(const int dev_handle, const int reg, char *buffer, const int data_length);
+
+  /**
+   * @brief writes block of bytes from buffer to device and reads back the return flags
+   * @param dev_handle device handle obtained from open()
+   * @param reg the command/data register
+   * @param tx_buffer pointer to data buffer holding the data to send
+   * @param data_length number of bytes to send
+   * @param RFLAGS_buffer buffer to hold returned flags
+   * @return number of flag bytes read, negative on error.
+   */
+  int write(const int dev_handle, const int reg, char *tx_buffer, const int data_length, char *RFLAGS_buffer);
+
+  /**
+   * @brief reads the same register from several devices in one transfer
+   * @param dev_handle any device handle obtained from open()
+   * @param dev_addrs array of 7-bit device adresses
+   * @param n_devs number of devices, at most MAX_BATCH_DEVS
+   * @param reg the command/data register
+   * @param buffer pointer to data buffer of at least n_devs * data_length + 1 bytes
+   * @param data_length number of bytes to read from each device
+   * @return total number of bytes read, negative on error.
+   */
+  int readBatch(const int dev_handle, const int *dev_addrs, const int n_devs, const int reg, char *buffer, const int data_length);
+
+  /**
+   * @brief writes a command to all devices on the bus in one transaction, e.g. with the I2C general call
+   *
+   * The devices receive the command at the same time, e.g. COMMIT of a synchronized move (see Joint_comms::setPositionsSynchronized()).
+   * A broadcast is neither answered nor framed, a failed attempt is retried. It is recorded in the statistics
+   * under I2C_GENERAL_CALL.
+   * @param dev_handle any device handle obtained from open()
+   * @param reg the command register
+   * @param tx_buffer pointer to data buffer holding the data to send
+   * @param data_length number of bytes to send
+   * @return 0 on OK, -ENOTSUP if the backend can not broadcast, negative on error.
+   */
+  int broadcast(const int dev_handle, const int reg, char *tx_buffer, const int data_length);
+
+  /**
+   * @brief Enables the framed protocol with length and CRC-8 for all transactions of this backend.
+   *
+   * The firmware of all joints on the bus must support the protocol version I2C_FRAME_VERSION.
+   * Legacy frames without I2C_FRAMED are still answered by the firmware, so hosts can be updated one by one.
+   * Can be called while transactions are running, every attempt of a transaction uses the setting at its start.
+   * @param enable true to frame, false for the legacy protocol
+   * @return 0 on OK, negative if the backend does not support framing.
+   */
+  virtual int setFraming(const bool enable);
+
+  /**
+   * @return true if the framed protocol is enabled, see setFraming().
+   */
+  bool getFraming(void) const;
+
+  /**
+   * @brief Sets the retry policy of all registers.
+   *
+   * Can be called while transactions are running, e.g. by a bus thread. A transaction in flight completes
+   * with the policy it started with.
+   */
+  void setRetryPolicy(const Retry_policy &policy);
+
+  /**
+   * @brief Sets the retry policy of a single register, e.g. a tight deadline for MOVETOANGLE.
+   *
+   * Can be called while transactions are running, see setRetryPolicy(const Retry_policy &).
+   * @param reg register 0x00 - 0x3F
+   * @param policy new policy
+   */
+  void setRetryPolicy(const int reg, const Retry_policy &policy);
+
+  /**
+   * @return a copy of the retry policy of a register.
+   */
+  Retry_policy getRetryPolicy(const int reg) const;
+
+  /**
+   * @brief Transaction statistics of this backend, can be queried while transactions are running.
+   */
+  const Bus_stats &getStats(void) const;
+
+  /**
+   * @brief Clears the transaction statistics.
+   */
+  void resetStats(void);
+
+  /**
+   * @brief Sets the SCL clock speed of the bus.
+   * @param hz clock speed in Hz
+   * @return 0 on OK, negative if the backend can not switch to the speed.
+   */
+  virtual int setSpeed(const uint32_t hz);
+
+  /**
+   * @return the SCL clock speed of the bus in Hz, 0 if unknown.
+   */
+  virtual uint32_t getSpeed(void);
+
+  /**
+   * @brief Resets the bus after a hang, e.g. a device holding SDA low. Handles stay valid.
+   *
+   * What a reset can do depends on the backend, see the overrides. The default does nothing and fails.
+   * @return 0 on OK, negative if the backend can not reset the bus.
+   */
+  virtual int reset(void);
+
+  /**
+   * @brief Number of bit times a transaction occupies the wire, see planBusBudget().
+   *
+   * The default models I2C: [ADDR W][REG][TX...] [ADDR R][RX...] with 9 bit times per byte (8 data bits and the ACK)
+   * plus START, repeated START and STOP. If framing is enabled, header and checksum are added to both directions.
+   * @param tx_length bytes written after the register
+   * @param rx_length bytes read including the return flags
+   * @return bit times of the transaction
+   */
+  virtual uint32_t transactionBits(const int tx_length, const int rx_length) const;
+
+protected:
+  /**
+   * @brief single read attempt, see read().
+   */
+  virtual int readOnce(const int dev_handle, const int reg, char *buffer, const int data_length) = 0;
+
+  /**
+   * @brief single write attempt, see write().
+   * @param rx_buffer buffer to hold the reply of at least \a rx_length + 1 bytes (see lgpio workaround)
+   * @param rx_length number of bytes to read back, RFLAGS_SIZE or the length of a framed reply.
+   * @return \a rx_length on OK, negative on error.
+   */
+  virtual int writeOnce(const int dev_handle, const int reg, char *tx_buffer, const int data_length, char *rx_buffer, const int rx_length) = 0;
+
+  /**
+   * @brief single batch read attempt, see readBatch().
+   */
+  virtual int readBatchOnce(const int dev_handle, const int *dev_addrs, const int n_devs, const int reg, char *buffer, const int data_length) = 0;
+
+  /**
+   * @brief single broadcast attempt, see broadcast(). The default does not support broadcasts.
+   * @return 0 on OK, negative on error.
+   */
+  virtual int broadcastOnce(const int dev_handle, const int reg, char *tx_buffer, const int data_length);
+
+  /**
+   * @return the device address of a handle, negative if the handle is invalid.
+   */
+  virtual int address(const int dev_handle) = 0;
+
+private:
+  /**
+   * @brief single framed read attempt, see setFraming().
+   */
+  int readFramedOnce(const int dev_handle, const int reg, char *buffer, const int data_length);
+
+  /**
+   * @brief single framed write attempt, see setFraming().
+   */
+  int writeFramedOnce(const int dev_handle, const int reg, char *tx_buffer, const int data_length, char *RFLAGS_buffer);
+
+  /**
+   * @brief single framed batch read attempt, see setFraming().
+   */
+  int readBatchFramedOnce(const int dev_handle, const int *dev_addrs, const int n_devs, const int reg, char *buffer, const int data_length);
+
+  /**
+   * @brief Repeats \a attempt according to the retry policy of \a reg.
+   * @param retries number of retries made
+   * @param latency_us time spent in all attempts and backoffs
+   * @return return code of the last attempt
+   */
+  template <typename F>
+  int retry(const int reg, F attempt, int &retries, uint64_t &latency_us);
+
+  Seqlock<Retry_policy> policies[STATS_MAX_REGS]; ///< retry policy per register, read by the transactions without locking
+  std::mutex policyLock;                          ///< serializes the writers of policies
+  Bus_stats stats;                                ///< transaction statistics
+  std::atomic<bool> framing{false};               ///< framed protocol enabled, see setFraming()
+};
+
+/**
+ * @brief Returns the backend used by joints which are constructed without one.
+ *
+ * This is a process wide LGPIO_backend instance.
+ */
+std::shared_ptr<Bus_backend> defaultBusBackend(void);
+
+/**
+ * @brief Returns the process wide LGPIO_backend of an I2C adapter.
+ *
+ * Joints on the same adapter share one backend, see Joint_comms::startBusThread(). busBackend(1) is defaultBusBackend().
+ * @param bus adapter number N of `/dev/i2c-N`
+ */
+std::shared_ptr<Bus_backend> busBackend(const int bus);
+
+/**
+ * @brief Measures the mean round trip time of a read transaction.
+ *
+ * Reads \a reg \a n times and averages the wall time. Use it to compare backends on the same device.
+ * @param bus backend to measure
+ * @param dev_handle device handle obtained from \a bus
+ * @param reg register to read
+ * @param data_length number of bytes to read including the return flags
+ * @param n number of transactions
+ * @return mean latency in microseconds, negative if a transaction failed.
+ */
+double measureBusLatency(Bus_backend &bus, const int dev_handle, const int reg, const int data_length, const int n = 100);
+
+/**
+ * @brief Error rate and latency of a bus at one clock speed, see calibrateBusSpeed().
+ */
+struct Bus_speed_result
+{
+  uint32_t hz = 0;           ///< SCL clock speed
+  uint32_t transactions = 0; ///< number of round trips
+  uint32_t errors = 0;       ///< failed round trips or wrong PING replies
+  double latency_us = 0;     ///< mean round trip time of the successful transactions
+};
+
+/**
+ * @brief Sweeps the clock speeds of a bus and switches to the fastest reliable one.
+ *
+ * For every speed the backend can switch to, \a n PING and ANGLEMOVED round trips are run on every device
+ * without retries. The measurement replaces the entry with the same speed in \a results, other entries are kept.
+ * Hence results of speeds which can only be set at boot (e.g. `dtparam=i2c_arm_baudrate` on the Raspberry Pi)
+ * can be accumulated over several runs with loadBusSpeeds() and saveBusSpeeds().
+ * @param bus backend to calibrate
+ * @param dev_handles handles of the devices on the bus
+ * @param results measured and previously known results, sorted by speed on return.
+ * @param speeds clock speeds to try in Hz
+ * @param n round trips per register, device and speed
+ * @param max_error_rate highest error rate considered reliable
+ * @return the selected speed in Hz, negative if no speed is reliable.
+ */
+int calibrateBusSpeed(Bus_backend &bus, const std::vector<int> &dev_handles, std::vector<Bus_speed_result> &results,
+                      const std::vector<uint32_t> &speeds = {100000, 400000, 1000000}, const int n = 100, const double max_error_rate = 0);
+
+/**
+ * @return the fastest speed in \a results with an error rate of at most \a max_error_rate, negative if there is none.
+ */
+int selectBusSpeed(const std::vector<Bus_speed_result> &results, const double max_error_rate = 0);
+
+/**
+ * @brief Stores the calibration results of a bus in a text file, the results of other buses are kept.
+ * @param path file name
+ * @param bus_id adapter number of the bus
+ * @param results results of calibrateBusSpeed()
+ * @return 0 on OK, -1 if the file can not be written.
+ */
+int saveBusSpeeds(const std::string &path, const int bus_id, const std::vector<Bus_speed_result> &results);
+
+/**
+ * @brief Loads the calibration results of a bus stored with saveBusSpeeds().
+ * @param path file name
+ * @param bus_id adapter number of the bus
+ * @param results results of the bus, empty if the bus was never calibrated.
+ * @return 0 on OK, -1 if the file can not be read.
+ */
+int loadBusSpeeds(const std::string &path, const int bus_id, std::vector<Bus_speed_result> &results);
+
+#endif // UBUS_H
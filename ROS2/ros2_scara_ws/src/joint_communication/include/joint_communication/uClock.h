@@ -0,0 +1,76 @@
+/**
+ * @file uClock.h
+ * @author Sebastian Storz
+ * @brief Exchangeable time source for all waits in the library
+ * @version 0.1
+ * @date 2025-06-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * All delays in the Joint and Joint_comms classes go through getClock(). By default this is the
+ * system clock. A Virtual_clock can be installed with setClock(), in which case sleeping only
+ * advances the virtual time. Together with the Sim_backend this runs complete sequences faster than real time.
+ */
+#ifndef UCLOCK_H
+#define UCLOCK_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+/**
+ * @brief System clock.
+ *
+ * Monotonic time from std::chrono::steady_clock, sleeps with usleep().
+ */
+class Clock
+{
+public:
+  virtual ~Clock() {}
+
+  /**
+   * @return current time in microseconds.
+   */
+  virtual uint64_t now(void);
+
+  /**
+   * @brief Waits for the specified time
+   * @param us time in microseconds
+   */
+  virtual void sleep(uint64_t us);
+};
+
+/**
+ * @brief Virtual clock.
+ *
+ * Time only advances when sleep() or advance() is called, sleep() returns immediately.
+ * Note that every thread sleeping on the virtual clock advances the same time.
+ */
+class Virtual_clock : public Clock
+{
+public:
+  uint64_t now(void) override;
+  void sleep(uint64_t us) override;
+
+  /**
+   * @brief Advances the virtual time, same as sleep()
+   * @param us time in microseconds
+   */
+  void advance(uint64_t us);
+
+private:
+  std::atomic<uint64_t> t{0}; ///< virtual time in microseconds
+};
+
+/**
+ * @brief Installs the clock used by the library.
+ * @param clock new clock. If nullptr the system clock is restored.
+ */
+void setClock(std::shared_ptr<Clock> clock);
+
+/**
+ * @return the clock used by the library.
+ */
+Clock &getClock(void);
+
+#endif // UCLOCK_H
@@ -33,6 +33,8 @@
 #include <iostream>
 #include <termios.h>
 #include <unistd.h>
+#include <vector>
+#include "joint_communication/uBus.h"
 
 #define ACK 'O'
 #define NACK 'N'
@@ -45,17 +47,50 @@
 /**
  * @copydoc MAX_BUFFER
  */
-#define MAX_BUFFER 4 // Bytes
+#define MAX_BUFFER 28 // Bytes
+
+/**
+ * @copydoc I2C_FRAMED
+ */
+#define I2C_FRAMED 0x80
+
+/**
+ * @copydoc I2C_FRAME_VERSION
+ */
+#define I2C_FRAME_VERSION 1
+
+/**
+ * @copydoc I2C_FRAME_OVERHEAD
+ */
+#define I2C_FRAME_OVERHEAD 2
+
+/**
+ * @copydoc I2C_FRAME_ERROR
+ */
+#define I2C_FRAME_ERROR (1 << 4)
+
+/**
+ * @copydoc I2C_GENERAL_CALL
+ */
+#define I2C_GENERAL_CALL 0x00
+
+/**
+ * @brief Maximum number of devices read in one combined transfer by readFromI2CDevs()
+ */
+#define MAX_BATCH_DEVS 8
 
 /**
  * @brief Initiates an I2C device on the bus
  * @param dev_addr 7-bit device adress [0 - 0x7F]
+ * @param bus adapter number N of `/dev/i2c-N`. The Raspberry Pi pin header is bus 1.
  * @return the device handle, negative on error.
  */
-int openI2CDevHandle(const int dev_addr);
+int openI2CDevHandle(const int dev_addr, const int bus = 1);
 
 /**
  * @brief reads block of bytes from device to buffer
+ *
+ * Single attempt without error output, the retries and error statistics are handled by Bus_backend::read().
  * @param dev_handle device handle obtained from `openI2CDevHandle`
  * @param reg the command/data register
  * @param buffer pointer to data buffer to hold received values
@@ -66,14 +101,57 @@ int readFromI2CDev(const int dev_handle, const int reg, char *buffer, const int
 
 /**
  * @brief writes block of bytes from buffer to device
+ *
+ * Single attempt without error output, the retries and error statistics are handled by Bus_backend::write().
  * @param dev_handle device handle obtained from `openI2CDevHandle`
  * @param reg the command/data register
  * @param tx_buffer pointer to data buffer holding the data to send
  * @param data_length number of bytes to send
- * @param RFLAGS_buffer buffer to hold returned flags
+ * @param RFLAGS_buffer buffer of at least \a rx_length + 1 bytes to hold returned flags (see lgpio workaround)
+ * @param rx_length number of bytes to read back, RFLAGS_SIZE or the length of a framed reply (see Bus_backend::setFraming()).
+ * @return 0 on OK, negative on error.
+ */
+int writeToI2CDev(const int dev_handle, const int reg, char *tx_buffer, const int data_length, char *RFLAGS_buffer, const int rx_length = RFLAGS_SIZE);
+
+/**
+ * @brief reads the same register from several devices in one combined transfer
+ *
+ * Builds a single lgI2cZip() command list which for every device sets the address, writes the register
+ * and reads back \a data_length bytes. The whole list is executed as one I2C_RDWR ioctl, hence one syscall
+ * instead of one per device. The payloads are concatenated in \a buffer in the order of \a dev_addrs.
+ * Single attempt without error output, see Bus_backend::readBatch().
+ * @param dev_handle any device handle on the bus obtained from `openI2CDevHandle`
+ * @param dev_addrs array of 7-bit device adresses [0 - 0x7F]
+ * @param n_devs number of devices in \a dev_addrs, at most MAX_BATCH_DEVS
+ * @param reg the command/data register
+ * @param buffer pointer to data buffer of at least n_devs * data_length + 1 bytes (see lgpio workaround)
+ * @param data_length number of bytes to read from each device
+ * @return total number of bytes read, negative on error.
+ */
+int readFromI2CDevs(const int dev_handle, const int *dev_addrs, const int n_devs, const int reg, char *buffer, const int data_length);
+
+/**
+ * @brief writes block of bytes to all devices with the general call
+ *
+ * Sends [I2C_GENERAL_CALL W][REG][TX...] with lgI2cZip(), no reply is read.
+ * Single attempt without error output, see Bus_backend::broadcast().
+ * @param dev_handle any device handle on the bus obtained from `openI2CDevHandle`
+ * @param reg the command register
+ * @param tx_buffer pointer to data buffer holding the data to send
+ * @param data_length number of bytes to send
  * @return 0 on OK, negative on error.
  */
-int writeToI2CDev(const int dev_handle, const int reg, char *tx_buffer, const int data_length, char *RFLAGS_buffer);
+int writeToI2CDevs(const int dev_handle, const int reg, char *tx_buffer, const int data_length);
+
+/**
+ * @brief Reads the SCL clock speed of an I2C adapter configured in the device tree.
+ *
+ * The Linux drivers take the speed from the device tree when the adapter is probed, it can not be changed
+ * at runtime. On the Raspberry Pi set e.g. `dtparam=i2c_arm_baudrate=400000` in config.txt and reboot.
+ * @param bus adapter number N of `/dev/i2c-N`
+ * @return clock speed in Hz, 0 if unknown.
+ */
+uint32_t getI2CBusSpeed(const int bus);
 
 /**
  * @brief close an I2C device on the bus
@@ -82,5 +160,39 @@ int writeToI2CDev(const int dev_handle, const int reg, char *tx_buffer, const in
  */
 int closeI2CDevHandle(const int dev_handle);
 
+/**
+ * @brief Bus backend using the lgpio library.
+ *
+ * Thin wrapper around openI2CDevHandle(), readFromI2CDev(), writeToI2CDev(), readFromI2CDevs() and closeI2CDevHandle().
+ */
+class LGPIO_backend : public Bus_backend
+{
+public:
+  /**
+   * @param bus adapter number N of `/dev/i2c-N`. The Raspberry Pi pin header is bus 1.
+   */
+  LGPIO_backend(const int bus = 1);
+
+  int open(const int dev_addr) override;
+  int close(const int dev_handle) override;
+
+  /**
+   * @brief Only succeeds for the speed configured in the device tree, see getI2CBusSpeed().
+   */
+  int setSpeed(const uint32_t hz) override;
+  uint32_t getSpeed(void) override;
+
+protected:
+  int readOnce(const int dev_handle, const int reg, char *buffer, const int data_length) override;
+  int writeOnce(const int dev_handle, const int reg, char *tx_buffer, const int data_length, char *rx_buffer, const int rx_length) override;
+  int readBatchOnce(const int dev_handle, const int *dev_addrs, const int n_devs, const int reg, char *buffer, const int data_length) override;
+  int broadcastOnce(const int dev_handle, const int reg, char *tx_buffer, const int data_length) override;
+  int address(const int dev_handle) override;
+
+private:
+  int bus;                ///< adapter number
+  std::vector<int> addrs; ///< device address per lgpio handle, -1 if closed
+};
+
 
 #endif
\ No newline at end of file
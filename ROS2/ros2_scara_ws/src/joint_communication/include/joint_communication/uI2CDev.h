@@ -0,0 +1,74 @@
+/**
+ * @file uI2CDev.h
+ * @author Sebastian Storz
+ * @brief Bus backend talking to the Linux i2c-dev driver directly
+ * @version 0.1
+ * @date 2025-06-10
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * Every transaction is a single `ioctl(I2C_RDWR)` on `/dev/i2c-N`. The message structs are preallocated
+ * in the backend so the hot path does neither allocate nor go through an additional library layer.
+ * The user must be a member of the `i2c` group.
+ */
+#ifndef UI2CDEV_H
+#define UI2CDEV_H
+
+#include <linux/i2c.h>
+#include <vector>
+#include "joint_communication/uI2C.h"
+
+/**
+ * @brief Bus backend using `ioctl(I2C_RDWR)` on `/dev/i2c-N`.
+ *
+ * The bus device is opened once by the first call to open(), the returned handles index an internal
+ * address table. The backend is not thread safe, since the message structs are shared between calls.
+ */
+class I2CDEV_backend : public Bus_backend
+{
+public:
+  /**
+   * @param bus adapter number N of `/dev/i2c-N`. The Raspberry Pi pin header is bus 1.
+   */
+  I2CDEV_backend(const int bus = 1);
+  ~I2CDEV_backend();
+
+  int open(const int dev_addr) override;
+  int close(const int dev_handle) override;
+
+  /**
+   * @brief Only succeeds for the speed configured in the device tree, see getI2CBusSpeed().
+   */
+  int setSpeed(const uint32_t hz) override;
+  uint32_t getSpeed(void) override;
+
+  /**
+   * @brief Reopens the adapter. This is no bus recovery: i2c-dev can not clock out a device holding SDA low,
+   * such a bus stays stuck until the device is power cycled.
+   */
+  int reset(void) override;
+
+protected:
+  int readOnce(const int dev_handle, const int reg, char *buffer, const int data_length) override;
+  int writeOnce(const int dev_handle, const int reg, char *tx_buffer, const int data_length, char *rx_buffer, const int rx_length) override;
+  int readBatchOnce(const int dev_handle, const int *dev_addrs, const int n_devs, const int reg, char *buffer, const int data_length) override;
+  int broadcastOnce(const int dev_handle, const int reg, char *tx_buffer, const int data_length) override;
+  int address(const int dev_handle) override;
+
+private:
+  /**
+   * @brief Executes the first \a n_msgs preallocated messages in one ioctl.
+   * @return 0 on OK, negative errno on error.
+   */
+  int transfer(const int n_msgs);
+
+  int bus;                                      ///< adapter number
+  int fd = -1;                                  ///< file descriptor of /dev/i2c-N
+  int n_open = 0;                               ///< number of open device handles
+  std::vector<int> addrs;                       ///< device address per handle, -1 if closed
+  struct i2c_msg msgs[2 * MAX_BATCH_DEVS];      ///< preallocated messages
+  __u8 regs[MAX_BATCH_DEVS];                    ///< preallocated register bytes of a batch
+  __u8 tx_buf[MAX_BUFFER + I2C_FRAME_OVERHEAD + 1]; ///< preallocated write buffer [REG][PAYLOAD], framed [REG][HDR][PAYLOAD][CRC]
+};
+
+#endif // UI2CDEV_H
@@ -0,0 +1,101 @@
+/**
+ * @file uQueue.h
+ * @author Sebastian Storz
+ * @brief Bounded lock-free multi-producer single-consumer queue
+ * @version 0.1
+ * @date 2025-06-18
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * Ring buffer with a sequence number per cell (D. Vyukov's bounded queue). Producers claim a cell with a
+ * compare and swap on the tail, the consumer is the only one advancing the head. Neither side ever blocks.
+ */
+#ifndef UQUEUE_H
+#define UQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+/**
+ * @brief Bounded lock-free MPSC queue.
+ * @tparam T element type, must be copy assignable.
+ * @tparam N capacity, must be a power of two.
+ */
+template <typename T, size_t N>
+class Mpsc_queue
+{
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "capacity must be a power of two");
+
+public:
+  Mpsc_queue(void)
+  {
+    for (size_t i = 0; i < N; i++)
+    {
+      this->cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * @brief Appends an element. Can be called from any thread.
+   * @return true on success, false if the queue is full.
+   */
+  bool push(const T &value)
+  {
+    size_t pos = this->tail.load(std::memory_order_relaxed);
+    for (;;)
+    {
+      Cell &cell = this->cells[pos & (N - 1)];
+      size_t seq = cell.seq.load(std::memory_order_acquire);
+      if (seq == pos)
+      {
+        if (this->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        {
+          cell.value = value;
+          cell.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (seq < pos)
+      {
+        return false; // full
+      }
+      else
+      {
+        pos = this->tail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /**
+   * @brief Removes the oldest element. Must only be called from the consumer thread.
+   * @return true on success, false if the queue is empty.
+   */
+  bool pop(T &value)
+  {
+    Cell &cell = this->cells[this->head & (N - 1)];
+    if (cell.seq.load(std::memory_order_acquire) != this->head + 1)
+    {
+      return false; // empty or the producer is still writing
+    }
+    value = cell.value;
+    cell.seq.store(this->head + N, std::memory_order_release);
+    this->head++;
+    return true;
+  }
+
+private:
+  /**
+   * @brief element with its sequence number
+   */
+  struct Cell
+  {
+    std::atomic<size_t> seq;
+    T value;
+  };
+
+  Cell cells[N];
+  alignas(64) std::atomic<size_t> tail{0}; ///< next cell to be claimed by a producer
+  alignas(64) size_t head = 0;             ///< next cell to be consumed
+};
+
+#endif // UQUEUE_H
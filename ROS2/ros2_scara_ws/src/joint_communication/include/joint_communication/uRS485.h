@@ -0,0 +1,118 @@
+/**
+ * @file uRS485.h
+ * @author Sebastian Storz
+ * @brief Bus backend carrying the joint registers over a UART/RS-485 multi-drop link
+ * @version 0.1
+ * @date 2025-06-20
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * The host is the only initiator on the half-duplex link. Every transaction is a request frame to one joint
+ * followed by the reply frame of that joint. Both use the same layout: \n
+ * [SYNC][ADDR][REG][LEN][PAYLOAD0]...[PAYLOADn][CRC] \n
+ * \b SYNC is FRAME_SYNC. \b ADDR is the address of the joint, replies set FRAME_REPLY in addition, so joints
+ * never mistake a reply for a request and the host skips the echo of its own request.
+ * \b LEN is the payload length. A request without payload reads the register, with payload it is a command. \n
+ * A command to I2C_GENERAL_CALL is a broadcast to all joints, which is not answered (see Bus_backend::broadcast()). \n
+ * The reply to a read carries the register value followed by the state flags, the reply to a command only the flags,
+ * as in the I2C protocol (see Joint::flags). \b CRC is crc8() (see uBus.h) over ADDR to the last payload byte.
+ * The receiver of the firmware is in Arduino/joint/joint.ino.
+ */
+#ifndef URS485_H
+#define URS485_H
+
+#include <string>
+#include <vector>
+#include "joint_communication/uI2C.h"
+
+#define FRAME_SYNC 0xA5        ///< first byte of every frame
+#define FRAME_REPLY 0x80       ///< set in the address byte of replies
+#define FRAME_OVERHEAD 5       ///< SYNC, ADDR, REG, LEN and CRC
+#define FRAME_MAX_PAYLOAD 32   ///< longest payload accepted by the host
+
+/**
+ * @brief Bus backend using framed transactions on a serial port, e.g. a RS-485 transceiver on `/dev/ttyAMA0`.
+ *
+ * The port is opened once by the first call to open(), the returned handles index an internal address table.
+ * The transceiver must switch the driver enable automatically or by the kernel RS-485 mode of the UART.
+ * The backend is not thread safe, since the frame buffers are shared between calls.
+ */
+class RS485_backend : public Bus_backend
+{
+public:
+  /**
+   * @param device serial port, also a pseudo terminal for tests.
+   * @param baud baud rate, must match RS485_BAUD of the firmware.
+   * @param timeout_us time to wait for a reply frame.
+   */
+  RS485_backend(const std::string device = "/dev/ttyAMA0", const int baud = 1000000, const uint32_t timeout_us = 5000);
+  ~RS485_backend();
+
+  int open(const int dev_addr) override;
+  int close(const int dev_handle) override;
+
+  /**
+   * @return the baud rate of the port.
+   */
+  uint32_t getSpeed(void) override;
+
+  /**
+   * @brief Discards all bytes in flight, the next transaction starts on a clean line.
+   */
+  int reset(void) override;
+
+  /**
+   * @brief The frames of the serial link always carry a CRC, the I2C framing is not supported.
+   * @return 0 if \a enable is false, -ENOTSUP otherwise.
+   */
+  int setFraming(const bool enable) override;
+
+  /**
+   * @brief Request and reply frame with 10 bit times per byte (start bit, 8 data bits, stop bit).
+   */
+  uint32_t transactionBits(const int tx_length, const int rx_length) const override;
+
+protected:
+  int readOnce(const int dev_handle, const int reg, char *buffer, const int data_length) override;
+  int writeOnce(const int dev_handle, const int reg, char *tx_buffer, const int data_length, char *rx_buffer, const int rx_length) override;
+
+  /**
+   * @brief The joints share the line, hence the devices are read one after the other.
+   */
+  int readBatchOnce(const int dev_handle, const int *dev_addrs, const int n_devs, const int reg, char *buffer, const int data_length) override;
+  int broadcastOnce(const int dev_handle, const int reg, char *tx_buffer, const int data_length) override;
+  int address(const int dev_handle) override;
+
+private:
+  /**
+   * @brief Sends a request frame, bytes of a previous transaction are dropped.
+   * @param dev_addr address of the joint, I2C_GENERAL_CALL for a broadcast
+   * @param reg register
+   * @param payload request payload
+   * @param length request payload length
+   * @return 0 on OK, -ETIMEDOUT if the port did not accept the frame within the reply timeout, negative on error.
+   */
+  int send(const int dev_addr, const int reg, const char *payload, const int length);
+
+  /**
+   * @brief Sends a request frame and waits for the reply of the joint.
+   * @param dev_addr address of the joint
+   * @param reg register
+   * @param payload request payload
+   * @param length request payload length
+   * @param reply buffer for the reply payload
+   * @param reply_length expected reply payload length
+   * @return 0 on OK, -ETIMEDOUT if no reply arrived, -EBADMSG on a checksum or length mismatch.
+   */
+  int transfer(const int dev_addr, const int reg, const char *payload, const int length, char *reply, const int reply_length);
+
+  std::string device;      ///< serial port
+  int baud;                ///< baud rate
+  uint32_t timeout_us;     ///< reply timeout
+  int fd = -1;             ///< file descriptor of the port
+  int n_open = 0;          ///< number of open device handles
+  std::vector<int> addrs;  ///< device address per handle, -1 if closed
+  uint8_t frame[FRAME_MAX_PAYLOAD + FRAME_OVERHEAD]; ///< preallocated frame buffer
+};
+
+#endif // URS485_H
@@ -0,0 +1,80 @@
+/**
+ * @file uSeqlock.h
+ * @author Sebastian Storz
+ * @brief Single-writer sequence lock
+ * @version 0.1
+ * @date 2025-06-18
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * The writer never waits for readers. Readers copy the value and retry if the writer modified it meanwhile,
+ * which is only the case if they overlap with the short copy of the writer. The value is stored as relaxed
+ * atomic words, so a torn read is detected by the sequence number instead of being a data race.
+ */
+#ifndef USEQLOCK_H
+#define USEQLOCK_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/**
+ * @brief Sequence lock protecting a trivially copyable value.
+ * @tparam T value type
+ */
+template <typename T>
+class Seqlock
+{
+  static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+
+public:
+  /**
+   * @brief Publishes a new value. Must only be called from one writer thread.
+   */
+  void store(const T &value)
+  {
+    uint64_t buf[WORDS] = {0};
+    memcpy(buf, &value, sizeof(T));
+
+    size_t s = this->seq.load(std::memory_order_relaxed);
+    this->seq.store(s + 1, std::memory_order_relaxed); // odd: write in progress
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < WORDS; i++)
+    {
+      this->data[i].store(buf[i], std::memory_order_relaxed);
+    }
+    this->seq.store(s + 2, std::memory_order_release);
+  }
+
+  /**
+   * @brief Copies the latest published value. Can be called from any thread.
+   */
+  T load(void) const
+  {
+    uint64_t buf[WORDS];
+    size_t s0, s1;
+    do
+    {
+      s0 = this->seq.load(std::memory_order_acquire);
+      for (size_t i = 0; i < WORDS; i++)
+      {
+        buf[i] = this->data[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      s1 = this->seq.load(std::memory_order_relaxed);
+    } while (s0 != s1 || (s0 & 1));
+
+    T value;
+    memcpy(&value, buf, sizeof(T));
+    return value;
+  }
+
+private:
+  static constexpr size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+  std::atomic<size_t> seq{0};          ///< odd while a write is in progress
+  std::atomic<uint64_t> data[WORDS] = {}; ///< value as words
+};
+
+#endif // USEQLOCK_H
@@ -0,0 +1,261 @@
+/**
+ * @file uSim.h
+ * @author Sebastian Storz
+ * @brief In-process simulation of the joint firmware
+ * @version 0.1
+ * @date 2025-06-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * The Sim_backend emulates the register semantics of the uStepper joint firmware (Arduino/joint/joint.ino)
+ * behind the Bus_backend interface. It allows to run and profile Joint_comms without the robot.
+ * Combined with a Virtual_clock (see uClock.h) complete startup, homing and control sequences run
+ * faster than real time.
+ *
+ * \code{.cpp}
+auto clock = std::make_shared<Virtual_clock>();
+setClock(clock);
+auto sim = std::make_shared<Sim_backend>();
+sim->addDevice(0x11);
+Joint_comms joints;
+joints.addJoint(0x11, "j1", 35, 0, sim);
+joints.init();
+  \endcode
+ */
+#ifndef USIM_H
+#define USIM_H
+
+#include <atomic>
+#include <deque>
+#include <vector>
+#include "joint_communication/uI2C.h"
+#include "joint_communication/mJoint.h"
+
+/**
+ * @brief Simulated joint bus.
+ *
+ * Implemented registers: PING, SETUP, SETRPM, MOVESTEPS, MOVETOANGLE, ANGLEMOVED, SETCURRENT, SETHOLDCURRENT,
+ * ENABLESTALLGUARD, ISSTALLED, SETBRAKEMODE, DISABLECLOSEDLOOP, STOP, CHECKORIENTATION, GETENCODERRPM, HOME,
+ * ISHOMED, ISSETUP, GETSTATE, PUSHPVT, SETINTERPOLATION, LATCHANGLE, COMMIT, GETCOMMITDELAY, GETHOMESTATE, GETLOOPSTATS, GETTRACE,
+ * STARTCAPTURE, GETCAPTURE, SETMAXACCELERATION, SETMAXDECELERATION, SETMAXVELOCITY, SETCONTROLTHRESHOLD, STORECONFIG and GETCONFIG.
+ * The model uses the maximum acceleration also for decelerating, the flash of STORECONFIG lasts as long as the backend. Every reply carries the state byte (STALL, BUSY, HOMED, SETUP, PVT fill level)
+ * as the firmware does.
+ * Framed transactions (see Bus_backend::setFraming()) are checked and answered as by the firmware.
+ *
+ * The motion of every joint follows a trapezoidal profile limited by the maximum acceleration and velocity
+ * (MAXACCEL, MAXVEL of configuration.h). The model is advanced to getClock().now() on every transaction.
+ * Homing drives the joint until it travelled the configured distance to the simulated end stop, it times out after
+ * HOME_TIMEOUT_MS of the firmware and is aborted by STOP, SETUP and motion commands.
+ * Commands are executed on reception, hence COMMIT has no delay, and a broadcast (Bus_backend::broadcast()) reaches
+ * all joints of the bus at the same time.
+ * Streamed trajectories (PUSHPVT) and interpolated setpoints (SETINTERPOLATION) are followed exactly along the
+ * interpolated points.
+ */
+class Sim_backend : public Bus_backend
+{
+public:
+  /**
+   * @brief Adds a simulated joint to the bus.
+   * @param dev_addr 7-bit device adress
+   * @param home_distance distance in encoder degrees from the start position to the simulated end stop.
+   * @param max_accel maximum acceleration in steps/s^2, see MAXACCEL.
+   * @param max_vel maximum velocity in steps/s, see MAXVEL.
+   */
+  void addDevice(const int dev_addr, const float home_distance = 720, const float max_accel = 10000, const float max_vel = 800);
+
+  /**
+   * @brief Triggers a stall of a joint, which is only latched if the stallguard is enabled.
+   * @param dev_addr 7-bit device adress
+   */
+  void stall(const int dev_addr);
+
+  /**
+   * @brief Sets a simulated transaction time which is spent on getClock() for every transaction.
+   * @param us time in microseconds, 0 by default to measure the host side overhead only.
+   */
+  void setTransactionTime(const uint64_t us);
+
+  /**
+   * @brief Sets the highest clock speed the simulated firmware keeps up with.
+   * @param hz clock speed in Hz. Above, every 10th transaction fails. 0 (default) for no limit.
+   */
+  void setSpeedLimit(const uint32_t hz);
+
+  /**
+   * @brief Simulates electrical noise on the bus.
+   *
+   * One bit of every \a n-th message, i.e. a command payload or a reply, is flipped.
+   * Without framing the joint executes a corrupted command, with framing it is rejected.
+   * @param n period in messages, 0 (default) for no corruption.
+   */
+  void setCorruption(const uint32_t n);
+
+  /**
+   * @brief Simulates a hung bus, e.g. a joint holding SDA low after a brown-out.
+   *
+   * Every transaction times out with -ETIMEDOUT until \a us passed on getClock() or reset() is called.
+   * @param us duration of the hang in microseconds
+   */
+  void hang(const uint64_t us);
+
+  /**
+   * @brief Simulates a reset of the joint firmware, e.g. by the watchdog. The joint forgets setup and homing.
+   * @param dev_addr 7-bit device adress
+   */
+  void reboot(const int dev_addr);
+
+  int open(const int dev_addr) override;
+  int close(const int dev_handle) override;
+
+  /**
+   * @brief Sets the simulated clock speed. Once set, the time on the wire (9 bits per byte) is added to the transaction time.
+   */
+  int setSpeed(const uint32_t hz) override;
+  uint32_t getSpeed(void) override;
+
+  /**
+   * @brief Ends a hang started by hang().
+   */
+  int reset(void) override;
+
+protected:
+  int readOnce(const int dev_handle, const int reg, char *buffer, const int data_length) override;
+  int writeOnce(const int dev_handle, const int reg, char *tx_buffer, const int data_length, char *rx_buffer, const int rx_length) override;
+  int readBatchOnce(const int dev_handle, const int *dev_addrs, const int n_devs, const int reg, char *buffer, const int data_length) override;
+  int broadcastOnce(const int dev_handle, const int reg, char *tx_buffer, const int data_length) override;
+  int address(const int dev_handle) override;
+
+private:
+  /**
+   * @brief Motion mode of a simulated joint
+   */
+  enum sim_mode_t
+  {
+    IDLE,     ///< standing still
+    POSITION, ///< moving to target
+    VELOCITY,  ///< running at target velocity
+    HOMING,    ///< running towards end stop
+    TRAJECTORY, ///< playing the trajectory buffer
+    INTERPOLATE ///< following interpolated setpoints
+  };
+
+  /**
+   * @brief State of a simulated joint
+   */
+  struct Sim_device
+  {
+    int address;
+    float home_distance;    ///< encoder degrees to the end stop
+    float max_accel;        ///< degrees/s^2
+    float max_vel;          ///< degrees/s
+    sim_mode_t mode = IDLE;
+    float position = 0;     ///< encoder degrees
+    float velocity = 0;     ///< encoder degrees/s
+    float target = 0;       ///< target position or velocity
+    float travelled = 0;    ///< distance travelled while homing
+    Joint::home_state_t homeState = Joint::HOME_IDLE; ///< see GETHOMESTATE
+    uint64_t homeT0 = 0;    ///< start time of homing
+    u_int8_t driveCurrent = 0, holdCurrent = 0;
+    bool isSetup = false, isHomed = false, isStalled = false, isStallguardEnabled = false;
+    bool busy = false;
+    uint64_t t = 0;         ///< time the model was last advanced to
+    uint64_t t0 = 0;        ///< time the device was added, see GETLOOPSTATS
+    PVT_segment_payload pvt[PVT_BUFFER]; ///< trajectory ring buffer
+    int pvtHead = 0;        ///< index of the played segment
+    int pvtCount = 0;       ///< number of segments in the buffer
+    float pvtP0 = 0;        ///< position at the start of the played segment
+    float pvtV0 = 0;        ///< velocity at the start of the played segment
+    uint64_t pvtT0 = 0;     ///< start time of the played segment
+    Joint::interp_mode_t interp = Joint::INTERP_OFF; ///< interpolation of MOVETOANGLE setpoints
+    int ipSamples = 0;      ///< setpoints since the interpolation started, saturates at 2
+    float ipP0 = 0, ipV0 = 0; ///< position and velocity at the arrival of the latest setpoint
+    float ipP1 = 0, ipV1 = 0; ///< latest setpoint and its velocity
+    float ipPeriod = 0;     ///< estimated setpoint period in s
+    uint64_t ipT0 = 0;      ///< arrival time of the latest setpoint
+    bool latched = false;   ///< a target is latched, see LATCHANGLE
+    float latchedAngle = 0; ///< target executed by the next COMMIT
+    std::deque<Joint_state_payload> capture; ///< telemetry buffer, see STARTCAPTURE
+    u_int16_t captureTaken = 0;   ///< samples taken since STARTCAPTURE
+    u_int16_t captureLeft = 0;    ///< samples still to take
+    u_int16_t captureDivider = 1; ///< a sample is taken every captureDivider model steps
+    u_int16_t captureTick = 0;    ///< model steps since the last sample
+    Joint_config config;          ///< motion limits in effect, see GETCONFIG
+    Joint_config defaults;        ///< limits given to addDevice(), see CONFIG_DEFAULTS
+    Joint_config flash;           ///< limits stored with CONFIG_SAVE
+    bool flashValid = false;      ///< a configuration was stored
+  };
+
+  /**
+   * @brief Advances the motion model of a device to getClock().now()
+   */
+  void update(Sim_device &dev);
+
+  /**
+   * @brief Emulates ip_sample() of the firmware: adds a MOVETOANGLE setpoint arriving at dev.t to the interpolation.
+   */
+  void sample(Sim_device &dev, const float angle);
+
+  /**
+   * @brief Emulates ip_eval() of the firmware: interpolated position and velocity at time \a t.
+   */
+  void interpolate(const Sim_device &dev, const uint64_t t, float &p, float &v);
+
+  /**
+   * @brief Composes the state byte as the firmware main loop does.
+   */
+  u_int8_t state(const Sim_device &dev);
+
+  /**
+   * @brief Emulates stepper_request_handler() followed by appending the state byte.
+   * @return number of bytes written to \a buffer
+   */
+  int request(Sim_device &dev, const int reg, char *buffer);
+
+  /**
+   * @brief Emulates stepper_receive_handler().
+   */
+  void receive(Sim_device &dev, const int reg, const char *rx_buf, const int rx_length);
+
+  /**
+   * @return the device with the address or nullptr.
+   */
+  Sim_device *find(const int dev_addr);
+
+  /**
+   * @brief Emulates the frame check of receiveEvent() for a framed command [HDR][PAYLOAD][CRC].
+   * @return payload length, negative if the frame is rejected.
+   */
+  int checkFrame(const Sim_device &dev, const int reg, const char *frame, const int length);
+
+  /**
+   * @brief Emulates the framed reply of requestEvent(): [HDR][PAYLOAD][FLAGS][CRC].
+   * @param buffer payload followed by the flags, framed in place. Must hold \a n + I2C_FRAME_OVERHEAD bytes.
+   * @param n number of bytes in \a buffer
+   * @return frame length
+   */
+  int frameReply(const Sim_device &dev, const int reg, char *buffer, const int n);
+
+  /**
+   * @brief Flips a bit of \a buffer if the message is due for corruption, see setCorruption().
+   */
+  void corrupt(char *buffer, const int length);
+
+  /**
+   * @brief Spends the time of a transaction on getClock() and injects errors above the speed limit.
+   * @param bytes number of bytes on the wire including the address bytes
+   * @return 0 on OK, -ETIMEDOUT while the bus hangs, -EIO if the transaction fails.
+   */
+  int transact(const int bytes);
+
+  std::vector<Sim_device> devices; ///< simulated joints
+  std::vector<int> handles;        ///< device index per handle, -1 if closed
+  uint64_t transactionTime = 0;    ///< simulated time per transaction in us
+  uint32_t speed = 0;              ///< simulated clock speed in Hz, 0 if the wire time is not simulated
+  uint32_t speedLimit = 0;         ///< highest reliable clock speed in Hz, 0 for no limit
+  uint32_t transactions = 0;       ///< transaction counter for error injection
+  uint32_t corruption = 0;         ///< period of corrupted messages, 0 for none
+  uint32_t corrupted = 0;          ///< message counter for corruption
+  std::atomic<uint64_t> hangUntil{0}; ///< getClock() time until which the bus hangs, may be set by another thread
+};
+
+#endif // USIM_H
@@ -0,0 +1,110 @@
+/**
+ * @file uStats.h
+ * @author Sebastian Storz
+ * @brief Lock-free transaction statistics of a bus backend
+ * @version 0.1
+ * @date 2025-06-16
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * Every transaction of a Bus_backend is recorded with its round trip latency, the number of retries and
+ * the error code if it failed. The histograms are keyed by joint address and register and can be queried
+ * at runtime while the control loop keeps running. Recording only uses relaxed atomic increments.
+ */
+#ifndef USTATS_H
+#define USTATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+
+#define STATS_MAX_DEVS 16      ///< number of device addresses that can be tracked
+#define STATS_MAX_REGS 64      ///< registers 0x00 - 0x3F are tracked
+#define STATS_LAT_BUCKETS 20   ///< latency bucket i counts round trips < 2^i us, the last bucket everything above
+#define STATS_RETRY_BUCKETS 8  ///< retry bucket i counts transactions with i retries, the last bucket everything above
+#define STATS_ERROR_CODES 256  ///< error codes are recorded as abs(rc), codes above are recorded as STATS_ERROR_CODES - 1
+
+/**
+ * @brief Copy of the statistics of one address/register pair.
+ */
+struct Bus_stats_entry
+{
+  uint32_t count = 0;                         ///< number of transactions
+  uint32_t errors = 0;                        ///< number of transactions which failed after all retries
+  uint32_t latency[STATS_LAT_BUCKETS] = {0};  ///< round trip latency histogram including retries
+  uint32_t retries[STATS_RETRY_BUCKETS] = {0}; ///< retry histogram
+
+  /**
+   * @brief Upper bound of the latency percentile from the histogram.
+   * @param p percentile 0 - 1
+   * @return latency in us, 0 if no transactions have been recorded.
+   */
+  uint64_t latencyPercentile(const double p) const;
+};
+
+/**
+ * @brief Lock-free histograms of bus transactions.
+ */
+class Bus_stats
+{
+public:
+  /**
+   * @brief Records a transaction. Thread safe and lock-free.
+   * @param dev_addr 7-bit device adress
+   * @param reg register
+   * @param latency_us round trip time including retries
+   * @param retries number of retries
+   * @param rc return code of the last attempt, negative on error.
+   */
+  void record(const int dev_addr, const int reg, const uint64_t latency_us, const int retries, const int rc);
+
+  /**
+   * @brief Copies the statistics of an address/register pair
+   * @param dev_addr 7-bit device adress
+   * @param reg register
+   * @param entry output
+   * @return 0 on OK, -1 if the address/register pair is not tracked.
+   */
+  int get(const int dev_addr, const int reg, Bus_stats_entry &entry) const;
+
+  /**
+   * @brief Number of failed transactions of a device with an error code.
+   * @param dev_addr 7-bit device adress
+   * @param rc error code as returned from the backend
+   */
+  uint32_t errorCount(const int dev_addr, const int rc) const;
+
+  /**
+   * @brief Prints count, errors, retries and latency percentiles of all recorded pairs.
+   */
+  void print(std::ostream &os = std::cout) const;
+
+  /**
+   * @brief Clears all counters. Transactions recorded concurrently may be lost.
+   */
+  void reset(void);
+
+private:
+  /**
+   * @brief Finds or claims the slot of a device.
+   * @return slot index, -1 if the table is full or \a claim is false and the address is not tracked.
+   */
+  int slot(const int dev_addr, const bool claim) const;
+
+  /**
+   * @brief Counters of one address/register pair
+   */
+  struct Cell
+  {
+    std::atomic<uint32_t> count{0};
+    std::atomic<uint32_t> errors{0};
+    std::atomic<uint32_t> latency[STATS_LAT_BUCKETS] = {};
+    std::atomic<uint32_t> retries[STATS_RETRY_BUCKETS] = {};
+  };
+
+  mutable std::atomic<int> addrs[STATS_MAX_DEVS] = {}; ///< device address + 1 per slot, 0 if free
+  Cell cells[STATS_MAX_DEVS][STATS_MAX_REGS];
+  std::atomic<uint32_t> error_codes[STATS_MAX_DEVS][STATS_ERROR_CODES] = {};
+};
+
+#endif // USTATS_H
@@ -2,19 +2,29 @@
 #include <unistd.h>
 #include "joint_communication/mJointCom.h"
 #include "joint_communication/mGripper.h"
+#include "joint_communication/uBudget.h"
+#include "joint_communication/uI2CDev.h"
+#include "joint_communication/uRS485.h"
+#include "joint_communication/uSim.h"
+#include "joint_communication/uClock.h"
 
+#include <chrono>
 #include <cmath>
 
 using namespace std;
 
 Joint_comms _Joints;
 Gripper _Gripper;
+bool _GripperEnabled = false; // the gripper is not used in the simulation
 
 void INT_handler(int s)
 {
   printf("Caught signal %d\n", s);
   _Joints.disables();
-  _Gripper.disable();
+  if (_GripperEnabled)
+  {
+    _Gripper.disable();
+  }
   exit(1);
 }
 
@@ -22,14 +32,50 @@ int main(int argc, char **argv)
 {
   signal(SIGINT, INT_handler);
 
-  (void)argc;
-  (void)argv;
-
-  _Gripper.init();
-  if (_Gripper.enable() != 0)
+  // --sim: run the sequence against simulated joints on a virtual clock, faster than real time
+  // --calibrate: sweep the clock speeds of the bus and store the results in bus_speed.cfg
+  // --latency: compare the per-transaction latency of the bus backends
+  // --benchmark: compare serial and batched reads of the positions before the control loop
+  // --budget: predict the timing of the control cycle and validate it against the measured one at the end
+  // --rs485=DEVICE: include a joint on a RS-485 port in the latency comparison
+  // --framed: frame all transactions with length and CRC, the firmware of all joints must support it
+  bool sim = false, calibrate = false, latency = false, benchmark = false, budget = false, framed = false;
+  string rs485;
+  for (int i = 1; i < argc; i++)
   {
-    cerr << "Gripper not enabled" << endl;
-    return 0;
+    sim |= string(argv[i]) == "--sim";
+    calibrate |= string(argv[i]) == "--calibrate";
+    latency |= string(argv[i]) == "--latency";
+    benchmark |= string(argv[i]) == "--benchmark";
+    budget |= string(argv[i]) == "--budget";
+    framed |= string(argv[i]) == "--framed";
+    if (string(argv[i]).rfind("--rs485=", 0) == 0)
+    {
+      rs485 = string(argv[i]).substr(8);
+    }
+  }
+  auto wall_start = chrono::steady_clock::now();
+  shared_ptr<Sim_backend> simBus;
+  if (sim)
+  {
+    setClock(make_shared<Virtual_clock>());
+    simBus = make_shared<Sim_backend>();
+    simBus->setSpeed(400000);
+    simBus->setSpeedLimit(400000);
+    for (int adr = 0x11; adr <= 0x14; adr++)
+    {
+      simBus->addDevice(adr);
+    }
+  }
+  else
+  {
+    _Gripper.init();
+    if (_Gripper.enable() != 0)
+    {
+      cerr << "Gripper not enabled" << endl;
+      return 0;
+    }
+    _GripperEnabled = true;
   }
   // float time = 0;
   // int period = 10;
@@ -51,10 +97,15 @@ int main(int argc, char **argv)
 
   // return -1;
 
-  _Joints.addJoint(0x11, "j1", 35, 349.1/2);
-  _Joints.addJoint(0x12, "j2", -360 / 4, -349.35);
-  _Joints.addJoint(0x13, "j3", 24, 301/2);
-  _Joints.addJoint(0x14, "j4", 12, 345/2);
+  if (framed)
+  {
+    (sim ? static_pointer_cast<Bus_backend>(simBus) : defaultBusBackend())->setFraming(true);
+  }
+
+  _Joints.addJoint(0x11, "j1", 35, 349.1/2, simBus);
+  _Joints.addJoint(0x12, "j2", -360 / 4, -349.35, simBus);
+  _Joints.addJoint(0x13, "j3", 24, 301/2, simBus);
+  _Joints.addJoint(0x14, "j4", 12, 345/2, simBus);
 
   if (_Joints.init())
   {
@@ -62,13 +113,59 @@ int main(int argc, char **argv)
     return -1;
   }
 
+  if (calibrate)
+  {
+    shared_ptr<Bus_backend> bus = sim ? static_pointer_cast<Bus_backend>(simBus) : defaultBusBackend();
+    vector<int> handles;
+    for (int adr = 0x11; adr <= 0x14; adr++)
+    {
+      handles.push_back(bus->open(adr));
+    }
+    vector<Bus_speed_result> results;
+    loadBusSpeeds("bus_speed.cfg", 1, results);
+    int hz = calibrateBusSpeed(*bus, handles, results);
+    for (const Bus_speed_result &r : results)
+    {
+      cout << r.hz << " Hz: " << r.errors << "/" << r.transactions << " errors, " << r.latency_us << " us per transaction" << endl;
+    }
+    saveBusSpeeds("bus_speed.cfg", 1, results);
+    if (hz > 0 && static_cast<uint32_t>(hz) != bus->getSpeed())
+    {
+      cout << "Fastest reliable speed: " << hz << " Hz, set dtparam=i2c_arm_baudrate=" << hz << " and reboot" << endl;
+    }
+    for (int h : handles)
+    {
+      bus->close(h);
+    }
+  }
+
+  // Compare the per-transaction latency of the bus backends by pinging j1
+  if (latency && !sim)
+  {
+    LGPIO_backend lgpio_bus;
+    I2CDEV_backend i2cdev_bus(1);
+    RS485_backend rs485_bus(rs485.empty() ? "/dev/ttyAMA0" : rs485);
+    vector<pair<string, Bus_backend *>> buses = {{"lgpio", &lgpio_bus}, {"i2c-dev", &i2cdev_bus}};
+    if (!rs485.empty())
+    {
+      buses.push_back({"rs485", &rs485_bus});
+    }
+    for (auto &[name, bus] : buses)
+    {
+      int h = bus->open(0x11);
+      cout << name << " PING: " << measureBusLatency(*bus, h, 0x0f, 2) << " us, ANGLEMOVED: "
+           << measureBusLatency(*bus, h, 0x18, 5) << " us per transaction" << endl;
+      bus->close(h);
+    }
+  }
+
   if (_Joints.enables({30, 40, 40, 20}, {30, 40, 40, 20}))
   {
     cerr << "did not enable joints" << endl;
     return -1;
   }
 
-  sleep(1);
+  getClock().sleep(1000 * 1000);
 
   if (_Joints.checkOrientations(1))
   {
@@ -76,7 +173,7 @@ int main(int argc, char **argv)
     return -1;
   }
 
-  sleep(1);
+  getClock().sleep(1000 * 1000);
 
   if (!_Joints.joints[0].isHomed())
   {
@@ -99,7 +196,7 @@ int main(int argc, char **argv)
   }
   _Joints.joints[3].disable();
 
-  sleep(1);
+  getClock().sleep(1000 * 1000);
   // return 0;
 
   if (_Joints.enableStallguards({20, 20, 20}))
@@ -108,7 +205,7 @@ int main(int argc, char **argv)
     return -1;
   }
 
-  usleep(1000 * 1000);
+  getClock().sleep(1000 * 1000);
 
   _Joints.disables();
   // return 0;
@@ -121,6 +218,46 @@ int main(int argc, char **argv)
   // vector<float> qd = {0.0};
   // vector<float> q_set = {0.0};
   // vector<float> qd_set = {0.0};
+
+  // Compare the per-cycle cost of reading one joint after another with one batched transfer
+  if (benchmark)
+  {
+    for (bool batched : {false, true})
+    {
+      _Joints.setBatchedReads(batched);
+      auto start = chrono::steady_clock::now();
+      for (int i = 0; i < 100; i++)
+      {
+        _Joints.getPositions(q);
+      }
+      auto us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count() / 100;
+      cout << (batched ? "Batched" : "Serial") << " getPositions(): " << us << " us per cycle" << endl;
+    }
+  }
+  // the control loop reads batched, also without the comparison
+  _Joints.setBatchedReads(true);
+
+  // Budget of the control cycle below: one batched read of all positions
+  shared_ptr<Bus_backend> loopBus = sim ? static_pointer_cast<Bus_backend>(simBus) : defaultBusBackend();
+  Bus_cycle cycle;
+  cycle.addrs = {0x11, 0x12, 0x13, 0x14};
+  cycle.regs = {Joint::ANGLEMOVED};
+  cycle.batched = true;
+  Bus_budget predicted;
+  int budgetRc = -1;
+  if (budget)
+  {
+    int h = loopBus->open(0x11);
+    budgetRc = planBusBudget(*loopBus, cycle, measureTurnaround(*loopBus, h), predicted);
+    loopBus->close(h);
+  }
+  if (budgetRc == 0)
+  {
+    cout << "Predicted: ";
+    predicted.print();
+  }
+  loopBus->resetStats();
+
   float t = 0;
   int period_ms = 10;
   while (1)
@@ -139,9 +276,16 @@ int main(int argc, char **argv)
     //   break;
     // }
 
-    usleep(period_ms * 1000);
+    getClock().sleep(period_ms * 1000);
     t += period_ms * 1.0 / 1000;
 
+    if (sim && t > 10)
+    {
+      auto wall = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - wall_start).count();
+      cout << "Simulated " << t << " s in " << wall << " ms wall time" << endl;
+      break;
+    }
+
     if (_Joints.getPositions(q) == 0)
     {
       cout << "Positions: ";
@@ -151,6 +295,10 @@ int main(int argc, char **argv)
       }
       cout << endl;
     }
+    else if (_Joints.recover() == 0)
+    {
+      cout << "Recovered the bus in " << _Joints.getRecoveryStats().last_us << " us" << endl;
+    }
     else
     {
       break;
@@ -173,7 +321,21 @@ int main(int argc, char **argv)
     //   break;
     // }
   }
-  _Gripper.disable();
+  if (_GripperEnabled)
+  {
+    _Gripper.disable();
+  }
   _Joints.disables();
+
+  // Transaction statistics of the control loop
+  loopBus->getStats().print();
+  Bus_budget measured;
+  if (budgetRc == 0 && validateBusBudget(*loopBus, cycle, predicted, measured) == 0)
+  {
+    cout << "Measured:  ";
+    measured.print();
+  }
+  Recovery_stats recovery = _Joints.getRecoveryStats();
+  cout << "Recoveries: " << recovery.count << " failed: " << recovery.failures << " reset failed: " << recovery.reset_failures << " max: " << recovery.max_us << " us" << endl;
   return 0;
 }
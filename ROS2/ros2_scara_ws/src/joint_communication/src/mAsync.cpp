@@ -0,0 +1,210 @@
+#include "joint_communication/mAsync.h"
+#include "joint_communication/uClock.h"
+
+#include <cerrno>
+#include <cmath>
+
+Task::Task(std::coroutine_handle<promise_type> h) : h(h)
+{
+}
+
+Task::Task(Task &&other) noexcept : h(other.h)
+{
+    other.h = nullptr;
+}
+
+Task &Task::operator=(Task &&other) noexcept
+{
+    if (this != &other)
+    {
+        if (this->h)
+        {
+            this->h.destroy();
+        }
+        this->h = other.h;
+        other.h = nullptr;
+    }
+    return *this;
+}
+
+Task::~Task()
+{
+    if (this->h)
+    {
+        this->h.destroy();
+    }
+}
+
+bool Task::done(void) const
+{
+    return this->h.done();
+}
+
+int Task::result(void) const
+{
+    return this->h.promise().rc;
+}
+
+Event_loop &Event_loop::instance(void)
+{
+    static thread_local Event_loop loop;
+    return loop;
+}
+
+int Event_loop::run(Task &task)
+{
+    while (!task.done())
+    {
+        if (this->waiters.empty())
+        {
+            std::cerr << "Event loop: task can not be resumed" << std::endl;
+            return -1;
+        }
+
+        // Collect the due waiters first, resuming them may add new waiters
+        uint64_t now = getClock().now();
+        uint64_t next = UINT64_MAX;
+        this->ready.clear();
+        for (size_t i = 0; i < this->waiters.size();)
+        {
+            Waiter &w = this->waiters[i];
+            if (w.due <= now)
+            {
+                if (!w.condition || w.condition())
+                {
+                    this->ready.push_back(w.h);
+                    this->waiters[i] = this->waiters.back();
+                    this->waiters.pop_back();
+                    continue;
+                }
+                w.due += w.period_us;
+                if (w.due <= now)
+                {
+                    w.due = now + w.period_us; // the poll fell behind, do not catch up
+                }
+            }
+            next = std::min(next, w.due);
+            i++;
+        }
+
+        for (std::coroutine_handle<> h : this->ready)
+        {
+            h.resume();
+        }
+
+        if (this->ready.empty() && next > now)
+        {
+            getClock().sleep(next - now);
+        }
+    }
+    return task.result();
+}
+
+bool Event_loop::Sleep_awaiter::await_ready(void) const
+{
+    return getClock().now() >= this->until;
+}
+
+void Event_loop::Sleep_awaiter::await_suspend(std::coroutine_handle<> h)
+{
+    Event_loop::instance().waiters.push_back({this->until, 0, nullptr, h});
+}
+
+bool Event_loop::Poll_awaiter::await_ready(void) const
+{
+    return this->condition();
+}
+
+void Event_loop::Poll_awaiter::await_suspend(std::coroutine_handle<> h)
+{
+    Event_loop::instance().waiters.push_back({getClock().now() + this->period_us, this->period_us, this->condition, h});
+}
+
+Event_loop::Sleep_awaiter sleepFor(const uint64_t us)
+{
+    return {getClock().now() + us};
+}
+
+Event_loop::Poll_awaiter pollUntil(std::function<bool(void)> condition, const uint32_t period_us)
+{
+    return {std::move(condition), period_us};
+}
+
+Task moveTo(Joint_comms &joints, std::vector<float> angle_v, const float tolerance, const uint32_t period_us)
+{
+    int rc = joints.setPositions(angle_v);
+    if (rc != 0)
+    {
+        co_return rc;
+    }
+
+    std::vector<float> q(angle_v.size());
+    co_await pollUntil([&]()
+                       {
+        rc = joints.getPositions(q);
+        if (rc != 0)
+        {
+            return true;
+        }
+        for (size_t i = 0; i < q.size(); i++)
+        {
+            if (std::fabs(q[i] - angle_v[i]) > tolerance)
+            {
+                return false;
+            }
+        }
+        return true; }, period_us);
+    co_return rc;
+}
+
+Task home(Joint &joint, u_int8_t direction, u_int8_t rpm, u_int8_t sensitivity, u_int8_t current, const uint64_t timeout_us)
+{
+    const uint64_t deadline = getClock().now() + timeout_us;
+    int rc = joint.startHome(direction, rpm, sensitivity, current);
+    if (rc != 0)
+    {
+        co_return rc;
+    }
+
+    // Same timing as Joint::home(): give the joint time to pick up the command, then wait for the homing to end
+    co_await sleepFor(1000 * 1000);
+    Joint::home_state_t state = Joint::HOME_RUNNING;
+    co_await pollUntil([&]()
+                       {
+        rc = joint.getHomeState(state);
+        return rc < 0 || state != Joint::HOME_RUNNING || getClock().now() >= deadline; });
+    if (rc < 0)
+    {
+        co_return rc;
+    }
+    if (state == Joint::HOME_RUNNING)
+    {
+        co_return -ETIMEDOUT;
+    }
+    co_return state == Joint::HOME_DONE ? 0 : -1;
+}
+
+Task checkOrientations(Joint_comms &joints, const float angle)
+{
+    for (size_t i = 0; i < joints.joints.size(); i++)
+    {
+        int rc = joints.joints[i].checkOrientation(angle);
+        if (rc < 0)
+        {
+            co_return rc;
+        }
+    }
+    co_await sleepFor(1000 * 1000);
+    co_return 0;
+}
+
+Task setPosition(Gripper &gripper, const float width, const uint64_t settle_us)
+{
+    int rc = gripper.setPosition(width);
+    if (rc != 0)
+    {
+        co_return rc;
+    }
+    co_await sleepFor(settle_us);
+    co_return 0;
+}
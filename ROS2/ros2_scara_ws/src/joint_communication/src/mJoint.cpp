@@ -1,8 +1,12 @@
 #include "joint_communication/uI2C.h"
 #include "joint_communication/mJoint.h"
+#include "joint_communication/uClock.h"
+#include <algorithm>
+#include <cmath>
 
-Joint::Joint(const int address, const std::string name, const float gearRatio, const float offset)
+Joint::Joint(const int address, const std::string name, const float gearRatio, const float offset, std::shared_ptr<Bus_backend> bus)
 {
+    this->bus = bus ? bus : defaultBusBackend();
     this->address = address;
     this->name = name;
     this->gearRatio = gearRatio;
@@ -12,7 +16,8 @@ Joint::Joint(const int address, const std::string name, const float gearRatio, c
 int Joint::init(void)
 {
     std::cout << "INFO: Initializing " << this->name << std::endl;
-    this->handle = openI2CDevHandle(this->address);
+    this->invalidateShadow();
+    this->handle = this->bus->open(this->address);
     if (this->handle < 0)
     {
         return this->handle;
@@ -22,20 +27,20 @@ int Joint::init(void)
 
 int Joint::deinit(void)
 {
-    int rc = closeI2CDevHandle(this->handle);
+    int rc = this->bus->close(this->handle);
     return rc;
 }
 int Joint::disable(void)
 {
     int rc = 0;
     rc |= this->stop(1);
-    usleep(100000);
+    getClock().sleep(100000);
     rc |= this->disableCL();
-    usleep(10000);
+    getClock().sleep(10000);
     rc |= this->setHoldCurrent(0);
-    usleep(10000);
+    getClock().sleep(10000);
     rc |= this->setBrakeMode(0);
-    usleep(10000);
+    getClock().sleep(10000);
     return rc;
 }
 
@@ -48,10 +53,32 @@ int Joint::enable(u_int8_t driveCurrent, u_int8_t holdCurrent)
     buf |= (driveCurrent & 0xFF);       // Copy driveCurrent to the least significant byte
     buf |= ((holdCurrent & 0xFF) << 8); // Copy holdCurrent to the next byte
 
-    return this->write(SETUP, buf, this->flags);
+    int rc = this->write(SETUP, buf, this->flags);
+    if (rc == 0)
+    {
+        // remembered for recover(), SETUP disables the stallguard
+        this->setupDriveCurrent = driveCurrent;
+        this->setupHoldCurrent = holdCurrent;
+        this->setupValid = true;
+        this->stallguardThreshold = -1;
+    }
+    return rc;
 }
 
 int Joint::home(u_int8_t direction, u_int8_t rpm, u_int8_t sensitivity, u_int8_t current)
+{
+    int rc = this->startHome(direction, rpm, sensitivity, current);
+    getClock().sleep(1000 * 1000);
+
+    while (this->isBusy())
+    {
+        getClock().sleep(10 * 1000);
+    }
+
+    return rc;
+}
+
+int Joint::startHome(u_int8_t direction, u_int8_t rpm, u_int8_t sensitivity, u_int8_t current)
 {
     u_int32_t buf = 0;
     buf |= (direction & 0xFF);
@@ -59,15 +86,19 @@ int Joint::home(u_int8_t direction, u_int8_t rpm, u_int8_t sensitivity, u_int8_t
     buf |= ((sensitivity & 0xFF) << 16);
     buf |= ((current & 0xFF) << 24);
 
-    int rc = this->write(HOME, buf, this->flags);
-    usleep(1000 * 1000);
+    return this->write(HOME, buf, this->flags);
+}
 
-    while (this->getFlags() & (1 << 1))
+int Joint::getHomeState(home_state_t &state)
+{
+    u_int8_t s;
+    int rc = this->read(GETHOMESTATE, s, this->flags);
+    if (rc < 0)
     {
-        usleep(10 * 1000);
+        return rc;
     }
-
-    return rc;
+    state = static_cast<home_state_t>(s);
+    return 0;
 }
 
 int Joint::printInfo(void)
@@ -79,7 +110,7 @@ int Joint::printInfo(void)
 int Joint::getPosition(float &angle)
 {
     int rc = this->read(ANGLEMOVED, angle, this->flags);
-    angle = ENCODER2JOINTANGLE(angle, this->gearRatio, this->offset);
+    angle = encoderToJoint(angle, this->gearRatio, this->offset);
     return rc;
 }
 
@@ -90,13 +121,12 @@ int Joint::setPosition(float angle)
         return 2; // not homed
     }
     int rc;
-    rc = this->write(MOVETOANGLE, JOINT2ENCODERANGLE(angle, this->gearRatio, this->offset), this->flags);
+    rc = this->write(MOVETOANGLE, jointToEncoder(angle, this->gearRatio, this->offset), this->flags);
     if (rc < 0)
     {
         return rc;
     }
 
-    printf("Flags: %#x\n", this->flags);
     if (this->flags & (1 << 0))
     {
         return 1; // STALLED
@@ -104,6 +134,202 @@ int Joint::setPosition(float angle)
     return 0;
 }
 
+int Joint::latchPosition(float angle)
+{
+    if (!this->ishomed)
+    {
+        return 2; // not homed
+    }
+    int rc = this->write(LATCHANGLE, jointToEncoder(angle, this->gearRatio, this->offset), this->flags);
+    if (rc < 0)
+    {
+        return rc;
+    }
+    return this->flags & (1 << 0) ? 1 : 0; // STALLED
+}
+
+int Joint::commit(void)
+{
+    int rc = this->write(COMMIT, static_cast<u_int8_t>(0), this->flags);
+    if (rc < 0)
+    {
+        return rc;
+    }
+    return this->flags & (1 << 0) ? 1 : 0; // STALLED
+}
+
+int Joint::getCommitDelay(uint32_t &us)
+{
+    return this->read(GETCOMMITDELAY, us, this->flags);
+}
+
+int Joint::getLoopStats(Loop_stats &stats)
+{
+    return this->read(GETLOOPSTATS, stats, this->flags);
+}
+
+int Joint::readTrace(std::vector<Trace_event> &events, uint32_t &dropped)
+{
+    Trace_batch_payload batch;
+    int n = 0;
+    dropped = 0;
+    // a bounded number of reads, the firmware may record events while it is read
+    for (int i = 0; i <= TRACE_BUFFER / TRACE_BATCH; i++)
+    {
+        int rc = this->read(GETTRACE, batch, this->flags);
+        if (rc < 0)
+        {
+            return rc;
+        }
+        dropped += batch.dropped;
+        for (int k = 0; k < batch.count && k < TRACE_BATCH; k++)
+        {
+            events.push_back(batch.events[k]);
+            n++;
+        }
+        if (batch.count < TRACE_BATCH)
+        {
+            break;
+        }
+    }
+    return n;
+}
+
+int Joint::startCapture(const uint16_t divider, const uint16_t samples)
+{
+    u_int32_t buf = divider | (samples << 16);
+    int rc = this->write(STARTCAPTURE, buf, this->flags);
+    if (rc < 0)
+    {
+        return rc;
+    }
+    if (samples)
+    {
+        this->captureDivider = divider ? divider : 1;
+        this->captureNext = 0;
+    }
+    return 0;
+}
+
+int Joint::readCapture(std::vector<Telemetry_sample> &series, bool &active)
+{
+    Capture_batch_payload batch;
+    int rc = this->read(GETCAPTURE, batch, this->flags);
+    if (rc < 0)
+    {
+        return rc;
+    }
+    active = batch.active;
+
+    // the index only grows, samples overwritten on the joint are skipped
+    uint32_t index = this->captureNext + static_cast<u_int16_t>(batch.index - static_cast<u_int16_t>(this->captureNext));
+    int n = std::min<int>(batch.count, CAPTURE_BATCH);
+    for (int i = 0; i < n; i++)
+    {
+        const Joint_state_payload &p = batch.samples[i];
+        Telemetry_sample sample;
+        sample.t = static_cast<double>(index + i) * this->captureDivider / JOINT_LOOP_RATE_HZ;
+        sample.q = encoderToJoint(p.angle, this->gearRatio, this->offset);
+        sample.qd = encoderToJoint(p.rpm, this->gearRatio, 0) * 6;
+        sample.pidError = p.pidError;
+        series.push_back(sample);
+    }
+    this->captureNext = index + n;
+    return n;
+}
+
+int Joint::captureTelemetry(const float rate_hz, const uint16_t samples, std::vector<Telemetry_sample> &series)
+{
+    if (rate_hz <= 0 || rate_hz > JOINT_LOOP_RATE_HZ)
+    {
+        std::cerr << "Capture rate must be within 0 - " << JOINT_LOOP_RATE_HZ << " Hz" << std::endl;
+        return -1;
+    }
+    if (this->busThread && *this->busThread)
+    {
+        std::cerr << "Telemetry can not be captured while the bus thread runs" << std::endl;
+        return -3;
+    }
+    const uint16_t divider = std::min(65535L, std::max(1L, std::lround(JOINT_LOOP_RATE_HZ / rate_hz)));
+    series.clear();
+    series.reserve(samples);
+    int rc = this->startCapture(divider, samples);
+    if (rc < 0)
+    {
+        return rc;
+    }
+
+    // poll about once per batch of samples, faster while the buffer of the joint holds more
+    const uint32_t wait_us = static_cast<uint64_t>(CAPTURE_BATCH) * divider * 1000000 / JOINT_LOOP_RATE_HZ;
+    bool active = samples > 0;
+    while (true)
+    {
+        int n = this->readCapture(series, active);
+        if (n < 0)
+        {
+            return n;
+        }
+        if (n < CAPTURE_BATCH)
+        {
+            if (!active)
+            {
+                break;
+            }
+            getClock().sleep(wait_us);
+        }
+    }
+    return samples - static_cast<int>(series.size());
+}
+
+int Joint::setMaxAcceleration(const float steps_s2)
+{
+    return this->write(SETMAXACCELERATION, steps_s2, this->flags);
+}
+
+int Joint::setMaxDeceleration(const float steps_s2)
+{
+    return this->write(SETMAXDECELERATION, steps_s2, this->flags);
+}
+
+int Joint::setMaxVelocity(const float steps_s)
+{
+    return this->write(SETMAXVELOCITY, steps_s, this->flags);
+}
+
+int Joint::setControlThreshold(const float microsteps)
+{
+    return this->write(SETCONTROLTHRESHOLD, microsteps, this->flags);
+}
+
+int Joint::getConfig(Joint_config &config)
+{
+    return this->read(GETCONFIG, config, this->flags);
+}
+
+int Joint::storeConfig(const config_action_t action, const uint32_t timeout_us)
+{
+    u_int8_t buf = action;
+    int rc = this->write(STORECONFIG, buf, this->flags);
+    if (rc < 0 || action != CONFIG_SAVE)
+    {
+        return rc;
+    }
+
+    // the flags of the write precede the command, poll until the flash is written
+    const uint64_t deadline = getClock().now() + timeout_us;
+    do
+    {
+        getClock().sleep(10 * 1000);
+        rc = this->read(PING, buf, this->flags);
+    } while ((rc < 0 || (this->flags & (1 << 1))) && getClock().now() < deadline);
+
+    if (rc < 0)
+    {
+        return rc;
+    }
+    return this->flags & (1 << 1) ? -ETIMEDOUT : 0;
+}
+
 int Joint::moveSteps(int32_t steps)
 {
     int rc;
@@ -113,7 +339,6 @@ int Joint::moveSteps(int32_t steps)
         return rc;
     }
 
-    printf("Flags: %#x\n", this->flags);
     if (this->flags & (1 << 0))
     {
         return 1; // STALLED
@@ -124,11 +349,72 @@ int Joint::moveSteps(int32_t steps)
 int Joint::getVelocity(float &degps)
 {
     int rc = this->read(GETENCODERRPM, degps, this->flags);
-    degps = ENCODER2JOINTANGLE(degps, this->gearRatio, 0);
+    degps = encoderToJoint(degps, this->gearRatio, 0);
     degps *= 6.0;
     return rc;
 }
 
+int Joint::getState(Joint_state &state)
+{
+    Joint_state_payload payload;
+    int rc = this->read(GETSTATE, payload, this->flags);
+    if (rc < 0)
+    {
+        return rc;
+    }
+    state.q = encoderToJoint(payload.angle, this->gearRatio, this->offset);
+    state.qd = encoderToJoint(payload.rpm, this->gearRatio, 0) * 6;
+    state.pidError = payload.pidError;
+    state.flags = this->flags;
+    return 0;
+}
+
+int Joint::pushTrajectory(std::span<const PVT_point> points)
+{
+    if (!this->ishomed)
+    {
+        return 2; // not homed
+    }
+    for (size_t i = 0; i < points.size(); i += PVT_BATCH)
+    {
+        std::array<PVT_segment_payload, PVT_BATCH> batch;
+        const size_t n = std::min<size_t>(PVT_BATCH, points.size() - i);
+        for (size_t k = 0; k < n; k++)
+        {
+            batch[k].angle = jointToEncoder(points[i + k].q, this->gearRatio, this->offset);
+            batch[k].velocity = jointToEncoder(points[i + k].qd, this->gearRatio, 0);
+            batch[k].duration_us = points[i + k].duration_us;
+        }
+        int rc = n == PVT_BATCH ? this->write(PUSHPVT, batch, this->flags) : this->write(PUSHPVT, batch[0], this->flags);
+        if (rc < 0)
+        {
+            return rc;
+        }
+        if (this->flags & (1 << 0))
+        {
+            return 1; // STALLED
+        }
+    }
+    return 0;
+}
+
+int Joint::getTrajectorySpace(int &space)
+{
+    if (!this->flagsCached())
+    {
+        u_int8_t buf;
+        int rc = this->read(PING, buf, this->flags);
+        if (rc < 0)
+        {
+            return rc;
+        }
+    }
+    // the firmware rounds the level up, at most level * PVT_BUFFER / 7 segments are used
+    const int level = this->flags >> 5;
+    space = PVT_BUFFER - level * PVT_BUFFER / 7;
+    return 0;
+}
+
 int Joint::setVelocity(float degps)
 {
     if (!this->ishomed)
@@ -136,12 +422,11 @@ int Joint::setVelocity(float degps)
         return 2; // not homed
     }
     int rc;
-    rc = this->write(SETRPM, JOINT2ENCODERANGLE(degps, this->gearRatio, 0) / 6, this->flags);
+    rc = this->write(SETRPM, jointToEncoder(degps, this->gearRatio, 0) / 6, this->flags);
     if (rc < 0)
     {
         return rc;
     }
-    printf("Flags: %#x\n", this->flags);
     if (this->flags & (1 << 0))
     {
         return 1; // STALLED
@@ -181,18 +466,43 @@ int Joint::setBrakeMode(u_int8_t mode)
     return this->write(SETBRAKEMODE, mode, this->flags);
 }
 
+int Joint::setInterpolation(const interp_mode_t mode)
+{
+    int rc = this->write(SETINTERPOLATION, static_cast<u_int8_t>(mode), this->flags);
+    if (rc == 0)
+    {
+        this->interpolation = mode;
+    }
+    return rc;
+}
+
 int Joint::getStall(u_int8_t &stall)
 {
+    if (this->flagsCached())
+    {
+        stall = this->flags & (1 << 0) ? 1 : 0;
+        return 0;
+    }
     return this->read(ISSTALLED, stall, this->flags);
 }
 
 int Joint::enableStallguard(u_int8_t sensitivity)
 {
-    return this->write(ENABLESTALLGUARD, sensitivity, this->flags);
+    int rc = this->write(ENABLESTALLGUARD, sensitivity, this->flags);
+    if (rc == 0)
+    {
+        this->stallguardThreshold = sensitivity;
+    }
+    return rc;
 }
 
 int Joint::getIsHomed(u_int8_t &homed)
 {
+    if (this->flagsCached())
+    {
+        homed = this->flags & (1 << 2) ? 1 : 0;
+        return 0;
+    }
     int rc = this->read(ISHOMED, homed, this->flags);
     return rc;
 }
@@ -210,6 +520,11 @@ bool Joint::isHomed(void)
 
 int Joint::getIsSetup(u_int8_t &setup)
 {
+    if (this->flagsCached())
+    {
+        setup = this->flags & (1 << 3) ? 1 : 0;
+        return 0;
+    }
     int rc = this->read(ISSETUP, setup, this->flags);
     return rc;
 }
@@ -239,7 +554,320 @@ int Joint::checkCom(void)
 
 u_int8_t Joint::getFlags(void)
 {
-    u_int8_t buf;
-    this->read(PING, buf, this->flags);
+    if (!this->flagsCached())
+    {
+        u_int8_t buf;
+        this->read(PING, buf, this->flags);
+    }
     return this->flags;
-}
\ No newline at end of file
+}
+
+bool Joint::isBusy(void)
+{
+    return this->getFlags() & (1 << 1);
+}
+
+bool Joint::isStalled(void)
+{
+    return this->getFlags() & (1 << 0);
+}
+
+void Joint::setFlagsMaxAge(const uint64_t max_age_us)
+{
+    this->flagsMaxAge = max_age_us;
+}
+
+uint32_t Joint::getFlagCacheHits(void) const
+{
+    return this->flagCacheHits;
+}
+
+uint32_t Joint::getFlagCacheMisses(void) const
+{
+    return this->flagCacheMisses;
+}
+
+void Joint::updateFlags(const u_int8_t flags, const bool command)
+{
+    this->flags = flags;
+    this->flagsStamp = getClock().now();
+    this->flagsFresh = !command;
+    if (!command)
+    {
+        this->ishomed = flags & (1 << 2) ? 1 : 0;
+        this->issetup = flags & (1 << 3) ? 1 : 0;
+    }
+}
+
+bool Joint::flagsCached(void)
+{
+    if (this->flagsFresh && this->flagsMaxAge && getClock().now() - this->flagsStamp <= this->flagsMaxAge)
+    {
+        this->flagCacheHits++;
+        return true;
+    }
+    this->flagCacheMisses++;
+    return false;
+}
+void Joint::setWriteCoalescing(bool enable)
+{
+    this->coalescing = enable;
+}
+
+int Joint::setDeadband(const stp_reg_t reg, const float deadband)
+{
+    int slot = Joint::shadowSlot(reg);
+    if (slot < 0)
+    {
+        return -1;
+    }
+    this->shadow[slot].deadband = deadband;
+    return 0;
+}
+
+void Joint::invalidateShadow(void)
+{
+    for (auto &sh : this->shadow)
+    {
+        sh.valid = false;
+    }
+}
+
+uint32_t Joint::getCoalescedWrites(void) const
+{
+    return this->coalescedWrites;
+}
+
+uint64_t Joint::getSavedBusTime(void) const
+{
+    return this->savedBusTime;
+}
+
+int Joint::registerSize(const stp_reg_t reg, bool &write)
+{
+    write = true;
+    switch (reg)
+    {
+    case PING:
+    case ISSTALLED:
+    case ISHOMED:
+    case ISSETUP:
+    case GETHOMESTATE:
+        write = false;
+        return 1;
+    case ANGLEMOVED:
+    case GETENCODERRPM:
+    case GETCOMMITDELAY:
+        write = false;
+        return 4;
+    case GETSTATE:
+        write = false;
+        return sizeof(Joint_state_payload);
+    case GETLOOPSTATS:
+        write = false;
+        return sizeof(Loop_stats);
+    case GETTRACE:
+        write = false;
+        return sizeof(Trace_batch_payload);
+    case GETCAPTURE:
+        write = false;
+        return sizeof(Capture_batch_payload);
+    case GETCONFIG:
+        write = false;
+        return sizeof(Joint_config);
+    case PUSHPVT:
+        return PVT_BATCH * sizeof(PVT_segment_payload);
+    case SETUP:
+        return 2;
+    case SETRPM:
+    case MOVESTEPS:
+    case MOVETOANGLE:
+    case CHECKORIENTATION:
+    case HOME:
+    case LATCHANGLE:
+    case STARTCAPTURE:
+    case SETMAXACCELERATION:
+    case SETMAXDECELERATION:
+    case SETMAXVELOCITY:
+    case SETCONTROLTHRESHOLD:
+        return 4;
+    case SETCURRENT:
+    case SETHOLDCURRENT:
+    case ENABLESTALLGUARD:
+    case SETBRAKEMODE:
+    case DISABLECLOSEDLOOP:
+    case STOP:
+    case SETINTERPOLATION:
+    case COMMIT:
+    case STORECONFIG:
+        return 1;
+    default:
+        return -1;
+    }
+}
+
+int Joint::shadowSlot(const stp_reg_t reg)
+{
+    switch (reg)
+    {
+    case MOVETOANGLE:
+        return 0;
+    case SETRPM:
+        return 1;
+    case SETCURRENT:
+        return 2;
+    case SETHOLDCURRENT:
+        return 3;
+    case SETBRAKEMODE:
+        return 4;
+    default:
+        return -1;
+    }
+}
+
+bool Joint::coalesce(const int slot, const float value)
+{
+    Shadow_register &sh = this->shadow[slot];
+    // a stalled joint has stopped, motion setpoints must be resent
+    // an interpolating joint takes a repeated setpoint as a sample of a halted trajectory
+    if (!this->coalescing || !sh.valid || ((this->flags & (1 << 0)) && slot <= 1) || (slot == 0 && this->interpolation != INTERP_OFF))
+    {
+        return false;
+    }
+    if (std::fabs(value - sh.value) > sh.deadband)
+    {
+        return false;
+    }
+    this->coalescedWrites++;
+    this->savedBusTime += sh.latency;
+    return true;
+}
+
+void Joint::updateShadow(const stp_reg_t reg, const int slot, const float value, const int rc, const u_int8_t flags, const uint64_t latency_us)
+{
+    switch (reg)
+    {
+    case SETUP:
+        // sets both currents, the first SETUP also resets the driver and with it the brake mode
+        this->shadow[2].valid = false;
+        this->shadow[3].valid = false;
+        this->shadow[4].valid = false;
+        this->shadow[0].valid = false;
+        this->shadow[1].valid = false;
+        break;
+    case HOME:
+        // homing runs at its own current and restores the drive current of SETUP, not the one of SETCURRENT
+        this->shadow[2].valid = false;
+        [[fallthrough]];
+    case STOP:
+    case MOVESTEPS:
+    case CHECKORIENTATION:
+    case DISABLECLOSEDLOOP:
+    case PUSHPVT:
+    case LATCHANGLE: // the joint moves to another target once the broadcast COMMIT arrives
+        this->shadow[0].valid = false;
+        this->shadow[1].valid = false;
+        break;
+    case MOVETOANGLE:
+        this->shadow[1].valid = false; // switches the joint to position mode
+        break;
+    case SETRPM:
+        this->shadow[0].valid = false; // switches the joint to velocity mode
+        break;
+    default:
+        break;
+    }
+
+    if (slot < 0)
+    {
+        return;
+    }
+    // A busy joint latches the command and may overwrite it with a later one before executing it
+    Shadow_register &sh = this->shadow[slot];
+    sh.valid = rc == 0 && !(flags & (1 << 1));
+    sh.value = value;
+    sh.latency = latency_us;
+}
+
+Recovery_stats &Recovery_stats::operator+=(const Recovery_stats &other)
+{
+    this->count += other.count;
+    this->failures += other.failures;
+    this->reset_failures += other.reset_failures;
+    this->last_us = std::max(this->last_us, other.last_us);
+    this->max_us = std::max(this->max_us, other.max_us);
+    this->total_us += other.total_us;
+    return *this;
+}
+
+int Joint::recover(const uint64_t budget_us)
+{
+    const uint64_t start = getClock().now();
+    const bus_error_t cause = classifyBusError(this->lastError);
+    std::cerr << "WARN: Recovering " << this->name << " - error: " << this->lastError << std::endl;
+
+    // a hung bus does not recover by reopening the handle
+    if ((cause == BUS_TIMEOUT || cause == BUS_STUCK) && this->bus->reset() < 0)
+    {
+        std::cerr << "WARN: Bus reset failed for " << this->name << std::endl;
+        this->recoveryStats.reset_failures++;
+    }
+    if (this->handle >= 0)
+    {
+        this->bus->close(this->handle);
+    }
+    this->handle = this->bus->open(this->address);
+
+    int rc = -1;
+    while (true)
+    {
+        if (this->handle < 0)
+        {
+            this->handle = this->bus->open(this->address);
+        }
+        if (this->handle >= 0)
+        {
+            rc = this->checkCom();
+        }
+        if (rc == 0 || getClock().now() - start >= budget_us)
+        {
+            break;
+        }
+        getClock().sleep(1000);
+    }
+
+    if (rc == 0)
+    {
+        this->invalidateShadow();
+        rc = this->getIsSetup();
+        if (rc == 0 && this->setupValid && !this->issetup)
+        {
+            std::cerr << "WARN: " << this->name << " lost its setup, restoring it" << std::endl;
+            int threshold = this->stallguardThreshold;
+            rc = this->enable(this->setupDriveCurrent, this->setupHoldCurrent);
+            if (rc == 0 && threshold >= 0)
+            {
+                rc = this->enableStallguard(threshold);
+            }
+        }
+        rc |= this->getIsHomed();
+    }
+
+    const uint64_t duration = getClock().now() - start;
+    this->recoveryStats.count++;
+    this->recoveryStats.failures += rc != 0;
+    this->recoveryStats.last_us = duration;
+    this->recoveryStats.max_us = std::max(this->recoveryStats.max_us, duration);
+    this->recoveryStats.total_us += duration;
+    return rc == 0 ? 0 : -1;
+}
+
+bus_error_t Joint::getLastError(void) const
+{
+    return classifyBusError(this->lastError);
+}
+
+const Recovery_stats &Joint::getRecoveryStats(void) const
+{
+    return this->recoveryStats;
+}
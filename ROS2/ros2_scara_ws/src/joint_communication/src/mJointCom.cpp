@@ -1,18 +1,63 @@
 #include "joint_communication/uI2C.h"
 #include "joint_communication/mJointCom.h"
+#include "joint_communication/uClock.h"
+
+#include <algorithm>
+
+/**
+ * @brief Transforms the encoder values of n joints to joint units in place, see encoderToJoint().
+ *
+ * A plain loop over contiguous arrays, which the compiler vectorizes.
+ * @param scale factor applied after the transform, e.g. 6 for rpm to degrees/s.
+ */
+static void encoderToJoints(float *values, const float *gearRatios, const float *offsets, const float scale, const size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        values[i] = encoderToJoint(values[i], gearRatios[i], offsets[i]) * scale;
+    }
+}
+
+/**
+ * @brief Converts a queued value of a byte valued command, e.g. a current, clamped to 0..255.
+ *
+ * A float outside the range of u_int8_t (or NaN) must not be converted directly.
+ */
+static u_int8_t toByte(const float value)
+{
+    return value >= 255 ? 255 : value > 0 ? static_cast<u_int8_t>(value) : 0;
+}
 
 Joint_comms::Joint_comms(void)
 {
+    for (auto &deadline : this->deadlines)
+    {
+        deadline = 0;
+    }
 }
 
 Joint_comms::~Joint_comms()
 {
+    this->stopBusThread();
 }
 
 
-void Joint_comms::addJoint(const int address, const std::string name, const float gearRatio, const float offset)
+void Joint_comms::addJoint(const int address, const std::string name, const float gearRatio, const float offset, std::shared_ptr<Bus_backend> bus)
 {
-    this->joints.push_back(Joint(address,name,gearRatio,offset));
+    this->joints.push_back(Joint(address,name,gearRatio,offset,bus));
+    this->joints.back().busThread = &this->running;
+    this->batchAddrs.push_back(address);
+    this->batchIds.push_back(this->joints.size() - 1);
+    this->batchBuffer.resize(this->joints.size() * (sizeof(Joint_state_payload) + RFLAGS_SIZE) + 1);
+    this->batchStates.resize(this->joints.size());
+    this->gearRatios.push_back(gearRatio);
+    this->offsets.push_back(offset);
+    this->zeros.push_back(0);
+}
+
+void Joint_comms::addJoint(const int address, const std::string name, const float gearRatio, const float offset, const int bus_id)
+{
+    this->addJoint(address, name, gearRatio, offset, busBackend(bus_id));
 }
 
 
@@ -126,7 +171,89 @@ int Joint_comms::home(std::string name, u_int8_t direction, u_int8_t rpm, u_int8
     return -1;
 }
 
-int Joint_comms::getPositions(std::vector<float> &angle_v)
+int Joint_comms::startHomes(std::span<const Home_config> configs)
+{
+    if (configs.size() != this->joints.size())
+    {
+        std::cerr << "vector size mismatch" << std::endl;
+        return -2;
+    }
+    if (this->deferred())
+    {
+        std::cerr << "Joints can not be homed while the bus thread runs" << std::endl;
+        return -3;
+    }
+
+    for (size_t i = 0; i < this->joints.size(); i++)
+    {
+        const Home_config &c = configs[i];
+        int err = this->joints[i].startHome(c.direction, c.rpm, c.sensitivity, c.current);
+        if (err < 0)
+        {
+            std::cerr << "Failed to start homing of: " << this->joints[i].name << " - error: " << err << std::endl;
+            return err;
+        }
+    }
+    return 0;
+}
+
+int Joint_comms::getHomeStates(std::span<Joint::home_state_t> states)
+{
+    if (states.size() != this->joints.size())
+    {
+        std::cerr << "vector size mismatch" << std::endl;
+        return -2;
+    }
+    if (this->deferred())
+    {
+        std::cerr << "Homing states can not be read while the bus thread runs" << std::endl;
+        return -3;
+    }
+
+    for (size_t i = 0; i < this->joints.size(); i++)
+    {
+        int err = this->joints[i].getHomeState(states[i]);
+        if (err < 0)
+        {
+            std::cerr << "Failed to read homing state of: " << this->joints[i].name << " - error: " << err << std::endl;
+            return err;
+        }
+    }
+    return 0;
+}
+
+int Joint_comms::homes(std::span<const Home_config> configs, const uint32_t poll_us)
+{
+    int rc = this->startHomes(configs);
+    if (rc != 0)
+    {
+        return rc;
+    }
+
+    std::vector<Joint::home_state_t> states(this->joints.size(), Joint::HOME_RUNNING);
+    while (std::find(states.begin(), states.end(), Joint::HOME_RUNNING) != states.end())
+    {
+        getClock().sleep(poll_us);
+        if ((rc = this->getHomeStates(states)) < 0)
+        {
+            return rc;
+        }
+    }
+
+    rc = 0;
+    for (size_t i = 0; i < this->joints.size(); i++)
+    {
+        this->joints[i].getIsHomed();
+        if (states[i] != Joint::HOME_DONE)
+        {
+            std::cerr << "Homing failed for: " << this->joints[i].name << " - state: " << states[i] << std::endl;
+            rc = 1;
+        }
+    }
+    return rc;
+}
+
+int Joint_comms::getPositions(std::span<float> angle_v)
 {
     if (angle_v.size() != this->joints.size())
     {
@@ -134,6 +261,24 @@ int Joint_comms::getPositions(std::vector<float> &angle_v)
         return -2;
     }
 
+    if (this->deferred())
+    {
+        Joint_snapshot snap = this->snapshot.load();
+        std::copy(snap.q, snap.q + angle_v.size(), angle_v.begin());
+        return snap.rc;
+    }
+
+    if (this->batchedReads)
+    {
+        if (this->readBatched(Joint::ANGLEMOVED, this->batchIds.data(), this->batchAddrs.data(), this->joints.size(), this->batchBuffer.data(), sizeof(float), angle_v.data()) < 0)
+        {
+            std::cerr << "Failed to get angles" << std::endl;
+            return -1;
+        }
+        encoderToJoints(angle_v.data(), this->gearRatios.data(), this->offsets.data(), 1, angle_v.size());
+        return 0;
+    }
+
     for (size_t i = 0; i < this->joints.size(); i++)
     {
         float a;
@@ -147,7 +292,7 @@ int Joint_comms::getPositions(std::vector<float> &angle_v)
     return 0;
 }
 
-int Joint_comms::setPositions(std::vector<float> angle_v)
+int Joint_comms::setPositions(std::span<const float> angle_v)
 {
     if (angle_v.size() != this->joints.size())
     {
@@ -155,6 +300,14 @@ int Joint_comms::setPositions(std::vector<float> angle_v)
         return -2;
     }
 
+    if (this->deferred())
+    {
+        Joint_command cmd;
+        cmd.type = Joint_command::POSITIONS;
+        std::copy(angle_v.begin(), angle_v.end(), cmd.values);
+        return this->enqueue(PRIO_MOTION, cmd);
+    }
+
     for (size_t i = 0; i < this->joints.size(); i++)
     {
         int err = this->joints[i].setPosition(angle_v[i]);
@@ -167,7 +320,104 @@ int Joint_comms::setPositions(std::vector<float> angle_v)
     return 0;
 }
 
-int Joint_comms::getVelocities(std::vector<float> &degps_v)
+int Joint_comms::setPositionsSynchronized(std::span<const float> angle_v)
+{
+    if (angle_v.size() != this->joints.size())
+    {
+        std::cerr << "vector size mismatch" << std::endl;
+        return -2;
+    }
+
+    if (this->deferred())
+    {
+        Joint_command cmd;
+        cmd.type = Joint_command::SYNCPOSITIONS;
+        std::copy(angle_v.begin(), angle_v.end(), cmd.values);
+        return this->enqueue(PRIO_MOTION, cmd);
+    }
+
+    for (size_t i = 0; i < this->joints.size(); i++)
+    {
+        int err = this->joints[i].latchPosition(angle_v[i]);
+        if (err != 0)
+        {
+            std::cerr << "Failed to latch angle for: " << this->joints[i].name << " - error: " << err << std::endl;
+            return err;
+        }
+    }
+
+    size_t ids[MAX_JOINTS];
+    const size_t n = std::min<size_t>(this->joints.size(), MAX_JOINTS);
+    for (size_t i = 0; i < n; i++)
+    {
+        ids[i] = i;
+    }
+    return this->commitLatched(ids, n);
+}
+
+int Joint_comms::getStartSkew(uint32_t &skew_us)
+{
+    if (this->deferred())
+    {
+        std::cerr << "The start skew can not be read while the bus thread runs" << std::endl;
+        return -3;
+    }
+
+    uint32_t first = UINT32_MAX, last = 0;
+    for (size_t i = 0; i < this->joints.size(); i++)
+    {
+        uint32_t us;
+        int err = this->joints[i].getCommitDelay(us);
+        if (err < 0)
+        {
+            std::cerr << "Failed to read commit delay of: " << this->joints[i].name << " - error: " << err << std::endl;
+            return -1;
+        }
+        first = std::min(first, us);
+        last = std::max(last, us);
+    }
+    skew_us = this->joints.empty() ? 0 : last - first;
+    return 0;
+}
+
+int Joint_comms::commitLatched(const size_t *ids, const size_t n)
+{
+    char zero = 0;
+    for (size_t k = 0; k < n; k++)
+    {
+        Joint &joint = this->joints[ids[k]];
+        // one broadcast per bus, at the first joint of the bus
+        bool seen = false;
+        for (size_t m = 0; m < k && !seen; m++)
+        {
+            seen = this->joints[ids[m]].bus == joint.bus;
+        }
+        if (seen)
+        {
+            continue;
+        }
+
+        int rc = joint.bus->broadcast(joint.handle, Joint::COMMIT, &zero, sizeof(zero));
+        if (rc == -ENOTSUP)
+        {
+            for (size_t m = k; m < n; m++)
+            {
+                if (this->joints[ids[m]].bus == joint.bus && (rc = this->joints[ids[m]].commit()) < 0)
+                {
+                    break;
+                }
+            }
+        }
+        if (rc < 0)
+        {
+            std::cerr << "Failed to commit positions for: " << joint.name << " - error: " << rc << std::endl;
+            return rc;
+        }
+    }
+    return 0;
+}
+
+int Joint_comms::getVelocities(std::span<float> degps_v)
 {
     if (degps_v.size() != this->joints.size())
     {
@@ -175,6 +425,24 @@ int Joint_comms::getVelocities(std::vector<float> &degps_v)
         return -2;
     }
 
+    if (this->deferred())
+    {
+        Joint_snapshot snap = this->snapshot.load();
+        std::copy(snap.qd, snap.qd + degps_v.size(), degps_v.begin());
+        return snap.rc;
+    }
+
+    if (this->batchedReads)
+    {
+        if (this->readBatched(Joint::GETENCODERRPM, this->batchIds.data(), this->batchAddrs.data(), this->joints.size(), this->batchBuffer.data(), sizeof(float), degps_v.data()) < 0)
+        {
+            std::cerr << "Failed to get speeds" << std::endl;
+            return -1;
+        }
+        encoderToJoints(degps_v.data(), this->gearRatios.data(), this->zeros.data(), 6, degps_v.size());
+        return 0;
+    }
+
     for (size_t i = 0; i < this->joints.size(); i++)
     {
         float a;
@@ -188,7 +456,57 @@ int Joint_comms::getVelocities(std::vector<float> &degps_v)
     return 0;
 }
 
-int Joint_comms::setVelocities(std::vector<float> degps_v)
+int Joint_comms::getStates(std::span<Joint_state> states)
+{
+    if (states.size() != this->joints.size())
+    {
+        std::cerr << "vector size mismatch" << std::endl;
+        return -2;
+    }
+
+    if (this->deferred())
+    {
+        Joint_snapshot snap = this->snapshot.load();
+        for (size_t i = 0; i < states.size(); i++)
+        {
+            states[i].q = snap.q[i];
+            states[i].qd = snap.qd[i];
+            states[i].pidError = snap.pidError[i];
+            states[i].flags = snap.flags[i];
+        }
+        return snap.rc;
+    }
+
+    if (this->batchedReads)
+    {
+        if (this->readBatched(Joint::GETSTATE, this->batchIds.data(), this->batchAddrs.data(), this->joints.size(), this->batchBuffer.data(), sizeof(Joint_state_payload), this->batchStates.data()) < 0)
+        {
+            std::cerr << "Failed to get states" << std::endl;
+            return -1;
+        }
+        for (size_t i = 0; i < states.size(); i++)
+        {
+            const Joint_state_payload &p = this->batchStates[i];
+            states[i].q = encoderToJoint(p.angle, this->gearRatios[i], this->offsets[i]);
+            states[i].qd = encoderToJoint(p.rpm, this->gearRatios[i], 0) * 6;
+            states[i].pidError = p.pidError;
+            states[i].flags = this->joints[i].flags;
+        }
+        return 0;
+    }
+
+    for (size_t i = 0; i < this->joints.size(); i++)
+    {
+        if (this->joints[i].getState(states[i]) < 0)
+        {
+            std::cerr << "Failed to get state from: " << this->joints[i].name << std::endl;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int Joint_comms::setVelocities(std::span<const float> degps_v)
 {
     if (degps_v.size() != this->joints.size())
     {
@@ -196,6 +514,14 @@ int Joint_comms::setVelocities(std::vector<float> degps_v)
         return -2;
     }
 
+    if (this->deferred())
+    {
+        Joint_command cmd;
+        cmd.type = Joint_command::VELOCITIES;
+        std::copy(degps_v.begin(), degps_v.end(), cmd.values);
+        return this->enqueue(PRIO_MOTION, cmd);
+    }
+
     for (size_t i = 0; i < this->joints.size(); i++)
     {
         int err = this->joints[i].setVelocity(degps_v[i]);
@@ -208,6 +534,53 @@ int Joint_comms::setVelocities(std::vector<float> degps_v)
     return 0;
 }
 
+int Joint_comms::streamTrajectory(std::span<const std::vector<PVT_point>> points, const uint32_t period_us)
+{
+    if (points.size() != this->joints.size())
+    {
+        std::cerr << "vector size mismatch" << std::endl;
+        return -2;
+    }
+    if (this->deferred())
+    {
+        std::cerr << "Trajectories can not be streamed while the bus thread runs" << std::endl;
+        return -3;
+    }
+
+    std::vector<size_t> sent(points.size(), 0);
+    while (true)
+    {
+        bool done = true;
+        for (size_t i = 0; i < this->joints.size(); i++)
+        {
+            int space;
+            if (this->joints[i].getTrajectorySpace(space) < 0)
+            {
+                std::cerr << "Failed to get trajectory space from: " << this->joints[i].name << std::endl;
+                return -1;
+            }
+            const size_t n = std::min<size_t>(space, points[i].size() - sent[i]);
+            if (n > 0)
+            {
+                int err = this->joints[i].pushTrajectory(std::span<const PVT_point>(points[i]).subspan(sent[i], n));
+                if (err != 0)
+                {
+                    std::cerr << "Failed to push trajectory to: " << this->joints[i].name << " - error: " << err << std::endl;
+                    return err < 0 ? -1 : err;
+                }
+                sent[i] += n;
+            }
+            // the buffer ran empty if all points were sent before the space was read
+            done &= sent[i] == points[i].size() && n == 0 && space == PVT_BUFFER;
+        }
+        if (done)
+        {
+            return 0;
+        }
+        getClock().sleep(period_us);
+    }
+}
+
 int Joint_comms::checkOrientations(std::vector<float> angle_v)
 {
     if (angle_v.size() != this->joints.size())
@@ -225,7 +598,7 @@ int Joint_comms::checkOrientations(std::vector<float> angle_v)
             return err;
         }
     }
-    sleep(1);
+    getClock().sleep(1000 * 1000);
     return 0;
 }
 
@@ -240,12 +613,20 @@ int Joint_comms::checkOrientations(float angle)
             return err;
         }
     }
-    sleep(1);
+    getClock().sleep(1000 * 1000);
     return 0;
 }
 
 int Joint_comms::stops(bool mode)
 {
+    if (this->deferred())
+    {
+        Joint_command cmd;
+        cmd.type = Joint_command::STOPS;
+        cmd.mode = mode;
+        return this->enqueue(PRIO_EMERGENCY, cmd);
+    }
+
     for (size_t i = 0; i < this->joints.size(); i++)
     {
         int err = this->joints[i].stop(mode);
@@ -260,6 +641,13 @@ int Joint_comms::stops(bool mode)
 
 int Joint_comms::disableCLs(void)
 {
+    if (this->deferred())
+    {
+        Joint_command cmd;
+        cmd.type = Joint_command::DISABLECLS;
+        return this->enqueue(PRIO_CONFIG, cmd);
+    }
+
     for (size_t i = 0; i < this->joints.size(); i++)
     {
         int err = this->joints[i].disableCL();
@@ -280,6 +668,14 @@ int Joint_comms::setDriveCurrents(std::vector<u_int8_t> current)
         return -2;
     }
 
+    if (this->deferred())
+    {
+        Joint_command cmd;
+        cmd.type = Joint_command::DRIVECURRENTS;
+        std::copy(current.begin(), current.end(), cmd.values);
+        return this->enqueue(PRIO_CONFIG, cmd);
+    }
+
     for (size_t i = 0; i < this->joints.size(); i++)
     {
         int err = this->joints[i].setDriveCurrent(current[i]);
@@ -294,6 +690,13 @@ int Joint_comms::setDriveCurrents(std::vector<u_int8_t> current)
 
 int Joint_comms::setDriveCurrents(u_int8_t current)
 {
+    if (this->deferred())
+    {
+        Joint_command cmd;
+        cmd.type = Joint_command::DRIVECURRENTS;
+        return this->enqueue(PRIO_CONFIG, cmd, current);
+    }
+
     for (size_t i = 0; i < this->joints.size(); i++)
     {
         int err = this->joints[i].setDriveCurrent(current);
@@ -314,6 +717,14 @@ int Joint_comms::setHoldCurrents(std::vector<u_int8_t> current)
         return -2;
     }
 
+    if (this->deferred())
+    {
+        Joint_command cmd;
+        cmd.type = Joint_command::HOLDCURRENTS;
+        std::copy(current.begin(), current.end(), cmd.values);
+        return this->enqueue(PRIO_CONFIG, cmd);
+    }
+
     for (size_t i = 0; i < this->joints.size(); i++)
     {
         int err = this->joints[i].setHoldCurrent(current[i]);
@@ -328,6 +739,13 @@ int Joint_comms::setHoldCurrents(std::vector<u_int8_t> current)
 
 int Joint_comms::setHoldCurrents(u_int8_t current)
 {
+    if (this->deferred())
+    {
+        Joint_command cmd;
+        cmd.type = Joint_command::HOLDCURRENTS;
+        return this->enqueue(PRIO_CONFIG, cmd, current);
+    }
+
     for (size_t i = 0; i < this->joints.size(); i++)
     {
         int err = this->joints[i].setHoldCurrent(current);
@@ -342,6 +760,13 @@ int Joint_comms::setHoldCurrents(u_int8_t current)
 
 int Joint_comms::setBrakeModes(u_int8_t mode)
 {
+    if (this->deferred())
+    {
+        Joint_command cmd;
+        cmd.type = Joint_command::BRAKEMODES;
+        return this->enqueue(PRIO_CONFIG, cmd, mode);
+    }
+
     for (size_t i = 0; i < this->joints.size(); i++)
     {
         int err = this->joints[i].setBrakeMode(mode);
@@ -354,9 +779,42 @@ int Joint_comms::setBrakeModes(u_int8_t mode)
     return 0;
 }
 
-int Joint_comms::enableStallguards(std::vector<u_int8_t> thresholds)
+int Joint_comms::setInterpolations(Joint::interp_mode_t mode)
 {
+    if (this->deferred())
+    {
+        Joint_command cmd;
+        cmd.type = Joint_command::INTERPOLATIONS;
+        return this->enqueue(PRIO_CONFIG, cmd, mode);
+    }
+
     for (size_t i = 0; i < this->joints.size(); i++)
+    {
+        int err = this->joints[i].setInterpolation(mode);
+        if (err < 0)
+        {
+            std::cerr << "Failed to set interpolation for motor: " << this->joints[i].name << " - error: " << err << std::endl;
+            return err;
+        }
+    }
+    return 0;
+}
+
+int Joint_comms::enableStallguards(std::vector<u_int8_t> thresholds)
+{
+    // joints without a threshold are left unchanged
+    const size_t n = std::min(thresholds.size(), this->joints.size());
+
+    if (this->deferred())
+    {
+        Joint_command cmd;
+        cmd.type = Joint_command::STALLGUARDS;
+        std::fill(cmd.values, cmd.values + MAX_JOINTS, -1);
+        std::copy(thresholds.begin(), thresholds.begin() + n, cmd.values);
+        return this->enqueue(PRIO_CONFIG, cmd);
+    }
+
+    for (size_t i = 0; i < n; i++)
     {
         int err = this->joints[i].enableStallguard(thresholds[i]);
         if (err < 0)
@@ -366,4 +824,526 @@ int Joint_comms::enableStallguards(std::vector<u_int8_t> thresholds)
         }
     }
     return 0;
-}
\ No newline at end of file
+}
+
+void Joint_comms::setBatchedReads(bool enable)
+{
+    this->batchedReads = enable;
+}
+
+int Joint_comms::readBatched(const int reg, const size_t *ids, const int *addrs, const size_t n, char *buf, const size_t length, void *values)
+{
+    const size_t size = length + RFLAGS_SIZE;
+
+    // Any handle of a backend can carry the transfer. Split in runs of up to MAX_BATCH_DEVS joints sharing a backend.
+    for (size_t first = 0, m; first < n; first += m)
+    {
+        const Joint &joint = this->joints[ids[first]];
+        for (m = 1; first + m < n && m < MAX_BATCH_DEVS; m++)
+        {
+            if (this->joints[ids[first + m]].bus != joint.bus)
+            {
+                break;
+            }
+        }
+        int rc = joint.bus->readBatch(joint.handle, addrs + first, m, reg, buf + first * size, size);
+        rc = rc == static_cast<int>(m * size) ? 0 : (rc < 0 ? rc : -EBADMSG);
+        for (size_t k = first; k < first + m; k++)
+        {
+            this->joints[ids[k]].lastError = rc;
+        }
+        if (rc < 0)
+        {
+            return -1;
+        }
+    }
+
+    for (size_t k = 0; k < n; k++)
+    {
+        memcpy(static_cast<char *>(values) + k * length, buf + k * size, length);
+        u_int8_t flags;
+        memcpy(&flags, buf + k * size + length, RFLAGS_SIZE);
+        this->joints[ids[k]].updateFlags(flags, false);
+    }
+    return 0;
+}
+
+/**
+ * @brief Joint_comms object whose bus thread is the calling thread, nullptr in all other threads
+ */
+static thread_local const Joint_comms *busOwner = nullptr;
+
+int Joint_comms::startBusThread(const uint32_t period_us)
+{
+    if (this->running || this->joints.size() > MAX_JOINTS)
+    {
+        return -1;
+    }
+
+    // One worker per backend, i.e. per adapter
+    this->workers.clear();
+    for (size_t i = 0; i < this->joints.size(); i++)
+    {
+        auto it = std::find_if(this->workers.begin(), this->workers.end(),
+                               [&](const std::unique_ptr<Bus_worker> &w) { return w->bus == this->joints[i].bus; });
+        if (it == this->workers.end())
+        {
+            this->workers.push_back(std::make_unique<Bus_worker>());
+            this->workers.back()->bus = this->joints[i].bus;
+            it = this->workers.end() - 1;
+        }
+        (*it)->ids.push_back(i);
+        (*it)->addrs.push_back(this->joints[i].address);
+        (*it)->gearRatios.push_back(this->gearRatios[i]);
+        (*it)->offsets.push_back(this->offsets[i]);
+        (*it)->zeros.push_back(0);
+    }
+    for (auto &w : this->workers)
+    {
+        w->buffer.resize(w->ids.size() * (sizeof(Joint_state_payload) + RFLAGS_SIZE) + 1);
+        w->values.resize(w->ids.size());
+        w->states.resize(w->ids.size());
+    }
+
+    this->assembledCycle = 0;
+    this->busStart = getClock().now();
+    this->running = true;
+    for (auto &w : this->workers)
+    {
+        w->thread = std::thread(&Joint_comms::busThreadLoop, this, std::ref(*w), period_us);
+    }
+    return 0;
+}
+
+void Joint_comms::stopBusThread(void)
+{
+    this->running = false;
+    for (auto &w : this->workers)
+    {
+        if (w->thread.joinable())
+        {
+            w->thread.join();
+        }
+    }
+}
+
+Joint_snapshot Joint_comms::getSnapshot(void) const
+{
+    return this->snapshot.load();
+}
+
+uint32_t Joint_comms::getCommandErrors(void) const
+{
+    return this->commandErrors.load(std::memory_order_relaxed);
+}
+
+uint32_t Joint_comms::getMergedCommands(void) const
+{
+    return this->mergedCommands.load(std::memory_order_relaxed);
+}
+
+void Joint_comms::setDeadline(const bus_prio_t prio, const uint32_t deadline_us)
+{
+    if (prio < PRIO_CLASSES)
+    {
+        this->deadlines[prio].store(deadline_us, std::memory_order_relaxed);
+    }
+}
+
+Bus_class_stats Joint_comms::getClassStats(const bus_prio_t prio) const
+{
+    Bus_class_stats sum;
+    if (prio >= PRIO_CLASSES)
+    {
+        return sum;
+    }
+    for (const auto &w : this->workers)
+    {
+        Bus_class_stats stats = w->classStats[prio].load();
+        sum.count += stats.count;
+        sum.deadline_misses += stats.deadline_misses;
+        sum.total_wait_us += stats.total_wait_us;
+        sum.max_wait_us = std::max(sum.max_wait_us, stats.max_wait_us);
+    }
+    return sum;
+}
+
+int Joint_comms::recover(void)
+{
+    int rc = 0;
+    for (Joint &joint : this->joints)
+    {
+        if (joint.getLastError() != BUS_OK && joint.recover() < 0)
+        {
+            std::cerr << "Failed to recover: " << joint.name << std::endl;
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
+void Joint_comms::setAutoRecovery(const bool enable, const uint64_t budget_us)
+{
+    this->autoRecovery.store(enable, std::memory_order_relaxed);
+    this->recoveryBudget.store(budget_us, std::memory_order_relaxed);
+}
+
+Recovery_stats Joint_comms::getRecoveryStats(void) const
+{
+    Recovery_stats sum;
+    if (this->running)
+    {
+        for (const auto &w : this->workers)
+        {
+            sum += w->recoveryStats.load();
+        }
+        return sum;
+    }
+    for (const Joint &joint : this->joints)
+    {
+        sum += joint.getRecoveryStats();
+    }
+    return sum;
+}
+
+void Joint_comms::recoverInWorker(Bus_worker &worker, const size_t joint)
+{
+    const bus_error_t cause = this->joints[joint].getLastError();
+    if (!this->autoRecovery.load(std::memory_order_relaxed) || (cause != BUS_NACK && cause != BUS_TIMEOUT && cause != BUS_STUCK))
+    {
+        return;
+    }
+    this->joints[joint].recover(this->recoveryBudget.load(std::memory_order_relaxed));
+
+    Recovery_stats sum;
+    for (size_t i : worker.ids)
+    {
+        sum += this->joints[i].getRecoveryStats();
+    }
+    worker.recoveryStats.store(sum);
+}
+
+bool Joint_comms::deferred(void) const
+{
+    return this->running && busOwner != this;
+}
+
+int Joint_comms::enqueue(const bus_prio_t prio, Joint_command &cmd)
+{
+    int rc = 0;
+    cmd.stamp = getClock().now();
+    for (auto &w : this->workers)
+    {
+        if (!w->commands[prio].push(cmd))
+        {
+            rc = -3;
+        }
+    }
+    if (rc < 0)
+    {
+        this->commandErrors.fetch_add(1, std::memory_order_relaxed);
+    }
+    return rc;
+}
+
+int Joint_comms::enqueue(const bus_prio_t prio, Joint_command &cmd, const float value)
+{
+    std::fill(cmd.values, cmd.values + MAX_JOINTS, value);
+    return this->enqueue(prio, cmd);
+}
+
+size_t Joint_comms::steps(const Bus_worker &worker, const Joint_command &cmd) const
+{
+    if (cmd.type == Joint_command::TELEMETRY)
+    {
+        // one GETSTATE transfer for all joints if batched, else one transaction per joint
+        return this->batchedReads ? 1 : worker.ids.size();
+    }
+    if (cmd.type == Joint_command::SYNCPOSITIONS)
+    {
+        // latch every joint, then commit all at once
+        return worker.ids.size() + 1;
+    }
+    return worker.ids.size();
+}
+
+int Joint_comms::executeStep(Bus_worker &worker, const Joint_command &cmd, const size_t step, const size_t first)
+{
+    const size_t n = worker.ids.size();
+    const size_t i = worker.ids[(first + step) % n];
+    switch (cmd.type)
+    {
+    case Joint_command::POSITIONS:
+        return this->joints[i].setPosition(cmd.values[i]);
+    case Joint_command::SYNCPOSITIONS:
+        return step < n ? this->joints[i].latchPosition(cmd.values[i]) : this->commitLatched(worker.ids.data(), n);
+    case Joint_command::VELOCITIES:
+        return this->joints[i].setVelocity(cmd.values[i]);
+    case Joint_command::STOPS:
+        return this->joints[i].stop(cmd.mode);
+    case Joint_command::DRIVECURRENTS:
+        return this->joints[i].setDriveCurrent(toByte(cmd.values[i]));
+    case Joint_command::HOLDCURRENTS:
+        return this->joints[i].setHoldCurrent(toByte(cmd.values[i]));
+    case Joint_command::BRAKEMODES:
+        return this->joints[i].setBrakeMode(toByte(cmd.values[i]));
+    case Joint_command::INTERPOLATIONS:
+        return this->joints[i].setInterpolation(static_cast<Joint::interp_mode_t>(toByte(cmd.values[i])));
+    case Joint_command::STALLGUARDS:
+        return cmd.values[i] < 0 ? 0 : this->joints[i].enableStallguard(toByte(cmd.values[i]));
+    case Joint_command::DISABLECLS:
+        return this->joints[i].disableCL();
+    default:
+        break;
+    }
+
+    // Telemetry: state of every joint
+    Joint_snapshot &t = worker.telemetry;
+    int rc;
+    if (this->batchedReads)
+    {
+        rc = this->readBatched(Joint::GETSTATE, worker.ids.data(), worker.addrs.data(), n, worker.buffer.data(),
+                               sizeof(Joint_state_payload), worker.states.data());
+        if (rc == 0)
+        {
+            for (size_t k = 0; k < n; k++)
+            {
+                worker.values[k] = worker.states[k].angle;
+            }
+            encoderToJoints(worker.values.data(), worker.gearRatios.data(), worker.offsets.data(), 1, n);
+            for (size_t k = 0; k < n; k++)
+            {
+                t.q[worker.ids[k]] = worker.values[k];
+                worker.values[k] = worker.states[k].rpm;
+            }
+            encoderToJoints(worker.values.data(), worker.gearRatios.data(), worker.zeros.data(), 6, n);
+            for (size_t k = 0; k < n; k++)
+            {
+                t.qd[worker.ids[k]] = worker.values[k];
+                t.pidError[worker.ids[k]] = worker.states[k].pidError;
+            }
+        }
+    }
+    else
+    {
+        Joint_state state;
+        rc = this->joints[i].getState(state);
+        if (rc == 0)
+        {
+            t.q[i] = state.q;
+            t.qd[i] = state.qd;
+            t.pidError[i] = state.pidError;
+        }
+    }
+    return rc < 0 ? rc : 0;
+}
+
+void Joint_comms::assembleSnapshot(void)
+{
+    std::lock_guard<std::mutex> guard(this->assembleLock);
+
+    Joint_snapshot snap;
+    snap.cycle = UINT32_MAX;
+    snap.rc = 0;
+    for (auto &w : this->workers)
+    {
+        Joint_snapshot part = w->partial.load();
+        for (size_t i : w->ids)
+        {
+            snap.q[i] = part.q[i];
+            snap.qd[i] = part.qd[i];
+            snap.pidError[i] = part.pidError[i];
+            snap.flags[i] = part.flags[i];
+        }
+        snap.rc |= part.rc;
+        snap.cycle = std::min(snap.cycle, part.cycle);
+        snap.stamp = std::max(snap.stamp, part.stamp);
+    }
+    // a worker completing a period publishes only once all workers are done with it
+    if (snap.cycle > this->assembledCycle)
+    {
+        this->assembledCycle = snap.cycle;
+        this->snapshot.store(snap);
+    }
+}
+
+void Joint_comms::busThreadLoop(Bus_worker &worker, const uint32_t period_us)
+{
+    busOwner = this;
+    const uint32_t defaults[PRIO_CLASSES] = {1000, period_us, 100000, period_us};
+    Active_command active[PRIO_CLASSES];
+    Bus_class_stats stats[PRIO_CLASSES];
+    uint64_t nextTelemetry = this->busStart;
+    int telemetryRc = 0;
+    Joint_command held{};
+    bool holding = false;
+
+    while (this->running)
+    {
+        uint64_t now = getClock().now();
+
+        if (active[PRIO_TELEMETRY].steps == 0 && now >= nextTelemetry)
+        {
+            active[PRIO_TELEMETRY].cmd.type = Joint_command::TELEMETRY;
+            active[PRIO_TELEMETRY].cmd.stamp = nextTelemetry;
+            active[PRIO_TELEMETRY].step = 0;
+            active[PRIO_TELEMETRY].steps = this->steps(worker, active[PRIO_TELEMETRY].cmd);
+            worker.telemetry.cycle = (nextTelemetry - this->busStart) / period_us + 1;
+            telemetryRc = 0;
+            while (nextTelemetry <= now)
+            {
+                nextTelemetry += period_us;
+            }
+        }
+
+        // The highest class with pending work gets the next transaction slot
+        int p;
+        Joint_command newer;
+        for (p = 0; p < PRIO_CLASSES; p++)
+        {
+            if (active[p].steps == 0 && p == PRIO_MOTION && holding)
+            {
+                active[p].cmd = held;
+                active[p].step = 0;
+                active[p].steps = this->steps(worker, held);
+                active[p].first = 0;
+                holding = false;
+            }
+            else if (active[p].steps == 0 && p != PRIO_TELEMETRY && worker.commands[p].pop(active[p].cmd))
+            {
+                active[p].step = 0;
+                active[p].steps = this->steps(worker, active[p].cmd);
+                active[p].first = 0;
+                if (p == PRIO_EMERGENCY && active[p].cmd.type == Joint_command::STOPS)
+                {
+                    // a stop cancels the motion commanded before it, e.g. the remaining joints of a setPositions()
+                    const uint64_t stamp = active[p].cmd.stamp;
+                    active[PRIO_MOTION].steps = 0;
+                    holding = holding && held.stamp > stamp;
+                    while (worker.commands[PRIO_MOTION].pop(newer))
+                    {
+                        if (newer.stamp > stamp)
+                        {
+                            held = newer;
+                            holding = true;
+                        }
+                    }
+                }
+            }
+            // Every motion command sets all joints, a newer one supersedes the rest of the current one.
+            // It continues with the next joint in turn, so every joint is served once after the last merge
+            // even if newer commands arrive faster than the worker runs through its joints.
+            // Latched positions are always committed, a newer command waits for a started synchronized move.
+            while (p == PRIO_MOTION && active[p].steps != 0 && worker.commands[p].pop(holding ? held : newer))
+            {
+                Active_command &a = active[p];
+                if (holding)
+                {
+                    // the held command was replaced before it started
+                    this->mergedCommands.fetch_add(1, std::memory_order_relaxed);
+                }
+                else if (a.cmd.type == Joint_command::SYNCPOSITIONS && a.step != 0)
+                {
+                    held = newer;
+                    holding = true;
+                }
+                else
+                {
+                    a.cmd = newer;
+                    a.first = (a.first + a.step) % worker.ids.size();
+                    a.step = 0;
+                    a.steps = this->steps(worker, newer);
+                    this->mergedCommands.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            if (active[p].steps != 0)
+            {
+                break;
+            }
+        }
+        if (p == PRIO_CLASSES)
+        {
+            getClock().sleep(std::min<uint64_t>(BUS_IDLE_POLL_US, nextTelemetry - now));
+            continue;
+        }
+
+        Active_command &a = active[p];
+        if (a.step == 0)
+        {
+            uint64_t wait = now > a.cmd.stamp ? now - a.cmd.stamp : 0;
+            uint32_t deadline = this->deadlines[p].load(std::memory_order_relaxed);
+            stats[p].count++;
+            stats[p].total_wait_us += wait;
+            stats[p].max_wait_us = std::max(stats[p].max_wait_us, wait);
+            if (wait > (deadline ? deadline : defaults[p]))
+            {
+                stats[p].deadline_misses++;
+            }
+            worker.classStats[p].store(stats[p]);
+        }
+
+        const size_t joint = worker.ids[(a.first + a.step) % worker.ids.size()];
+        int rc = this->executeStep(worker, a.cmd, a.step++, a.first);
+        if (rc < 0 && p == PRIO_TELEMETRY && this->batchedReads)
+        {
+            // a batched read fails for all joints of the worker
+            for (size_t i : worker.ids)
+            {
+                this->recoverInWorker(worker, i);
+            }
+        }
+        else if (rc < 0)
+        {
+            this->recoverInWorker(worker, joint);
+        }
+        if (p == PRIO_TELEMETRY)
+        {
+            telemetryRc |= rc;
+            if (a.step == a.steps)
+            {
+                for (size_t i : worker.ids)
+                {
+                    worker.telemetry.flags[i] = this->joints[i].flags;
+                }
+                worker.telemetry.rc = telemetryRc;
+                worker.telemetry.stamp = getClock().now();
+                worker.partial.store(worker.telemetry);
+                this->assembleSnapshot();
+                a.steps = 0;
+            }
+        }
+        else if (rc < 0)
+        {
+            // the remaining joints are skipped, a partially executed command is reported as failed
+            std::cerr << "Bus thread command failed for: " << this->joints[joint].name << " - error: " << rc << std::endl;
+            this->commandErrors.fetch_add(1, std::memory_order_relaxed);
+            a.steps = 0;
+        }
+        else if (a.step == a.steps)
+        {
+            a.steps = 0;
+        }
+    }
+
+    // a stop queued right before stopBusThread() is still executed
+    Active_command &e = active[PRIO_EMERGENCY];
+    while (e.steps != 0 || worker.commands[PRIO_EMERGENCY].pop(e.cmd))
+    {
+        if (e.steps == 0)
+        {
+            e.step = 0;
+            e.steps = this->steps(worker, e.cmd);
+            e.first = 0;
+        }
+        for (; e.step < e.steps; e.step++)
+        {
+            int rc = this->executeStep(worker, e.cmd, e.step, e.first);
+            if (rc < 0)
+            {
+                std::cerr << "Bus thread command failed for: " << this->joints[worker.ids[e.step % worker.ids.size()]].name << " - error: " << rc << std::endl;
+                this->commandErrors.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        e.steps = 0;
+    }
+}
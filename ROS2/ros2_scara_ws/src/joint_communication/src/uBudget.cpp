@@ -0,0 +1,102 @@
+#include "joint_communication/uBudget.h"
+#include "joint_communication/uI2C.h"
+#include "joint_communication/uClock.h"
+
+#include <algorithm>
+
+void Bus_budget::print(std::ostream &os) const
+{
+    os << this->transactions << " transactions, " << this->bits << " bits, wire " << this->wire_us << " us, turnaround "
+       << this->turnaround_us << " us, cycle " << this->cycle_us << " us, max rate " << this->max_rate_hz << " Hz" << std::endl;
+}
+
+double measureTurnaround(Bus_backend &bus, const int dev_handle, const int n)
+{
+    char buf[1 + RFLAGS_SIZE];
+    if (n < 1)
+    {
+        return -1;
+    }
+
+    const uint64_t start = getClock().now();
+    for (int i = 0; i < n; i++)
+    {
+        if (bus.read(dev_handle, Joint::PING, buf, sizeof(buf)) != sizeof(buf))
+        {
+            return -1;
+        }
+    }
+    double rtt = static_cast<double>(getClock().now() - start) / n;
+    uint32_t hz = bus.getSpeed();
+    double wire = hz ? bus.transactionBits(0, sizeof(buf)) * 1e6 / hz : 0;
+    return std::max(0.0, rtt - wire);
+}
+
+int planBusBudget(Bus_backend &bus, const Bus_cycle &cycle, const double turnaround_us, Bus_budget &budget,
+                  uint32_t hz, const double max_load)
+{
+    hz = hz ? hz : bus.getSpeed();
+    if (hz == 0)
+    {
+        std::cerr << "Bus budget: unknown bus speed" << std::endl;
+        return -1;
+    }
+
+    budget = Bus_budget();
+    const size_t n = cycle.addrs.size();
+    for (Joint::stp_reg_t reg : cycle.regs)
+    {
+        bool write;
+        int size = Joint::registerSize(reg, write);
+        if (size < 0)
+        {
+            std::cerr << "Bus budget: register " << reg << " is not implemented" << std::endl;
+            return -1;
+        }
+        // a write returns the flags, a read the payload followed by the flags
+        const uint32_t bits = write ? bus.transactionBits(size, RFLAGS_SIZE) : bus.transactionBits(0, size + RFLAGS_SIZE);
+        budget.transactions += cycle.batched && !write ? 1 : n;
+        budget.bits += n * bits;
+        budget.turnaround_us += n * turnaround_us;
+    }
+    budget.wire_us = budget.bits * 1e6 / hz;
+    budget.cycle_us = budget.wire_us + budget.turnaround_us;
+    budget.max_rate_hz = budget.cycle_us > 0 ? max_load * 1e6 / budget.cycle_us : 0;
+    return 0;
+}
+
+int validateBusBudget(const Bus_backend &bus, const Bus_cycle &cycle, const Bus_budget &predicted, Bus_budget &measured,
+                      const double p, const double max_load)
+{
+    measured = predicted;
+    measured.cycle_us = 0;
+    for (Joint::stp_reg_t reg : cycle.regs)
+    {
+        bool write;
+        Joint::registerSize(reg, write);
+        uint64_t longest = 0;
+        for (int addr : cycle.addrs)
+        {
+            Bus_stats_entry entry;
+            if (bus.getStats().get(addr, reg, entry) < 0 || entry.count == 0)
+            {
+                std::cerr << "Bus budget: no transactions of register " << reg << " at " << addr << std::endl;
+                return -1;
+            }
+            // every joint of a batched read records the latency of the whole transfer
+            uint64_t latency = entry.latencyPercentile(p);
+            if (cycle.batched && !write)
+            {
+                longest = std::max(longest, latency);
+            }
+            else
+            {
+                measured.cycle_us += latency;
+            }
+        }
+        measured.cycle_us += longest;
+    }
+    measured.turnaround_us = std::max(0.0, measured.cycle_us - measured.wire_us);
+    measured.max_rate_hz = measured.cycle_us > 0 ? max_load * 1e6 / measured.cycle_us : 0;
+    return 0;
+}
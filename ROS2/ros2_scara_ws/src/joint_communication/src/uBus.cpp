@@ -0,0 +1,502 @@
+#include "joint_communication/uBus.h"
+#include "joint_communication/uI2C.h"
+#include "joint_communication/uClock.h"
+#include "joint_communication/mJoint.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <mutex>
+
+template <typename F>
+int Bus_backend::retry(const int reg, F attempt, int &retries, uint64_t &latency_us)
+{
+    const Retry_policy policy = this->getRetryPolicy(reg);
+    const uint64_t start = getClock().now();
+    double backoff = policy.backoff_us;
+
+    int rc = attempt();
+    for (retries = 0; rc < 0 && retries + 1 < policy.max_attempts; retries++)
+    {
+        uint64_t wait = backoff < policy.max_backoff_us ? backoff : policy.max_backoff_us;
+        if (policy.deadline_us && getClock().now() + wait - start >= policy.deadline_us)
+        {
+            break;
+        }
+        getClock().sleep(wait);
+        backoff *= policy.backoff_factor;
+        rc = attempt();
+    }
+    latency_us = getClock().now() - start;
+    return rc;
+}
+
+uint8_t crc8(const uint8_t *data, const size_t length, uint8_t crc)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++)
+        {
+            crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+/**
+ * @brief Header byte of a frame with the protocol version and the payload length.
+ */
+static char frameHeader(const int length)
+{
+    return static_cast<char>(I2C_FRAME_VERSION << 6 | length);
+}
+
+/**
+ * @brief Checksum of a frame, seeded with the device address and the register byte.
+ */
+static uint8_t frameCrc(const int addr, const int reg, const char *frame, const int length)
+{
+    const uint8_t head[2] = {static_cast<uint8_t>(addr), static_cast<uint8_t>(reg | I2C_FRAMED)};
+    return crc8(reinterpret_cast<const uint8_t *>(frame), length, crc8(head, sizeof(head)));
+}
+
+/**
+ * @brief Checks a reply frame [HDR][PAYLOAD][FLAGS][CRC] and copies payload and flags.
+ * @param addr address of the replying device
+ * @param reg register of the request
+ * @param frame reply of \a data_length + I2C_FRAME_OVERHEAD bytes
+ * @param data_length payload length including the flags
+ * @param buffer output of \a data_length bytes
+ * @return 0 on OK, -EBADMSG on a checksum or length mismatch or if the joint rejected the request,
+ * -EPROTO if the joint speaks another protocol version.
+ */
+static int unframe(const int addr, const int reg, const char *frame, const int data_length, char *buffer)
+{
+    const uint8_t header = frame[0];
+    const uint8_t flags = frame[data_length];
+    if (frameCrc(addr, reg, frame, data_length + 1) != static_cast<uint8_t>(frame[data_length + 1]))
+    {
+        return -EBADMSG;
+    }
+    if (header >> 6 != I2C_FRAME_VERSION)
+    {
+        return -EPROTO;
+    }
+    if ((header & 0x3F) != data_length - RFLAGS_SIZE || flags & I2C_FRAME_ERROR)
+    {
+        return -EBADMSG;
+    }
+    memcpy(buffer, frame + 1, data_length);
+    return 0;
+}
+
+int Bus_backend::readFramedOnce(const int dev_handle, const int reg, char *buffer, const int data_length)
+{
+    char frame[MAX_BUFFER + RFLAGS_SIZE + I2C_FRAME_OVERHEAD];
+    if (data_length < RFLAGS_SIZE || data_length > MAX_BUFFER + RFLAGS_SIZE)
+    {
+        return -EINVAL;
+    }
+
+    int rc = this->readOnce(dev_handle, reg | I2C_FRAMED, frame, data_length + I2C_FRAME_OVERHEAD);
+    if (rc < 0)
+    {
+        return rc;
+    }
+    rc = unframe(this->address(dev_handle), reg, frame, data_length, buffer);
+    return rc < 0 ? rc : data_length;
+}
+
+int Bus_backend::writeFramedOnce(const int dev_handle, const int reg, char *tx_buffer, const int data_length, char *RFLAGS_buffer)
+{
+    char frame[MAX_BUFFER + I2C_FRAME_OVERHEAD];
+    char reply[RFLAGS_SIZE + I2C_FRAME_OVERHEAD + 1];
+    if (data_length > MAX_BUFFER)
+    {
+        return -EINVAL;
+    }
+
+    const int addr = this->address(dev_handle);
+    frame[0] = frameHeader(data_length);
+    memcpy(frame + 1, tx_buffer, data_length);
+    frame[1 + data_length] = frameCrc(addr, reg, frame, 1 + data_length);
+
+    int rc = this->writeOnce(dev_handle, reg | I2C_FRAMED, frame, data_length + I2C_FRAME_OVERHEAD, reply, RFLAGS_SIZE + I2C_FRAME_OVERHEAD);
+    if (rc < 0)
+    {
+        return rc;
+    }
+    rc = unframe(addr, reg, reply, RFLAGS_SIZE, RFLAGS_buffer);
+    return rc < 0 ? rc : RFLAGS_SIZE;
+}
+
+int Bus_backend::readBatchFramedOnce(const int dev_handle, const int *dev_addrs, const int n_devs, const int reg, char *buffer, const int data_length)
+{
+    char frames[MAX_BATCH_DEVS * (MAX_BUFFER + RFLAGS_SIZE + I2C_FRAME_OVERHEAD) + 1];
+    const int length = data_length + I2C_FRAME_OVERHEAD;
+    if (n_devs < 1 || n_devs > MAX_BATCH_DEVS || data_length < RFLAGS_SIZE || data_length > MAX_BUFFER + RFLAGS_SIZE)
+    {
+        return -EINVAL;
+    }
+
+    int rc = this->readBatchOnce(dev_handle, dev_addrs, n_devs, reg | I2C_FRAMED, frames, length);
+    if (rc < 0)
+    {
+        return rc;
+    }
+    for (int i = 0; i < n_devs; i++)
+    {
+        rc = unframe(dev_addrs[i], reg, frames + i * length, data_length, buffer + i * data_length);
+        if (rc < 0)
+        {
+            return rc;
+        }
+    }
+    return n_devs * data_length;
+}
+
+Bus_backend::Bus_backend()
+{
+    // the seqlocks start zeroed, not with the defaults of Retry_policy
+    this->setRetryPolicy(Retry_policy());
+}
+
+int Bus_backend::read(const int dev_handle, const int reg, char *buffer, const int data_length)
+{
+    int retries;
+    uint64_t latency_us;
+    int rc = this->retry(reg, [&]()
+                         { return this->getFraming() ? this->readFramedOnce(dev_handle, reg, buffer, data_length)
+                                                : this->readOnce(dev_handle, reg, buffer, data_length); }, retries, latency_us);
+    this->stats.record(this->address(dev_handle), reg, latency_us, retries, rc);
+    return rc;
+}
+
+int Bus_backend::write(const int dev_handle, const int reg, char *tx_buffer, const int data_length, char *RFLAGS_buffer)
+{
+    int retries;
+    uint64_t latency_us;
+    int rc = this->retry(reg, [&]()
+                         { return this->getFraming() ? this->writeFramedOnce(dev_handle, reg, tx_buffer, data_length, RFLAGS_buffer)
+                                                : this->writeOnce(dev_handle, reg, tx_buffer, data_length, RFLAGS_buffer, RFLAGS_SIZE); }, retries, latency_us);
+    this->stats.record(this->address(dev_handle), reg, latency_us, retries, rc);
+    return rc;
+}
+
+int Bus_backend::readBatch(const int dev_handle, const int *dev_addrs, const int n_devs, const int reg, char *buffer, const int data_length)
+{
+    int retries;
+    uint64_t latency_us;
+    int rc = this->retry(reg, [&]()
+                         { return this->getFraming() ? this->readBatchFramedOnce(dev_handle, dev_addrs, n_devs, reg, buffer, data_length)
+                                                : this->readBatchOnce(dev_handle, dev_addrs, n_devs, reg, buffer, data_length); }, retries, latency_us);
+    for (int i = 0; i < n_devs; i++)
+    {
+        this->stats.record(dev_addrs[i], reg, latency_us, retries, rc);
+    }
+    return rc;
+}
+
+int Bus_backend::broadcast(const int dev_handle, const int reg, char *tx_buffer, const int data_length)
+{
+    int retries;
+    uint64_t latency_us;
+    bool unsupported = false;
+    int rc = this->retry(reg, [&]()
+                         { int r = this->broadcastOnce(dev_handle, reg, tx_buffer, data_length);
+                           unsupported = r == -ENOTSUP;
+                           return unsupported ? 0 : r; }, retries, latency_us);
+    if (unsupported)
+    {
+        return -ENOTSUP; // nothing was sent, not retried and not recorded
+    }
+    this->stats.record(I2C_GENERAL_CALL, reg, latency_us, retries, rc);
+    return rc;
+}
+
+int Bus_backend::broadcastOnce(const int dev_handle, const int reg, char *tx_buffer, const int data_length)
+{
+    (void)dev_handle;
+    (void)reg;
+    (void)tx_buffer;
+    (void)data_length;
+    return -ENOTSUP;
+}
+
+int Bus_backend::setFraming(const bool enable)
+{
+    this->framing.store(enable, std::memory_order_relaxed);
+    return 0;
+}
+
+bool Bus_backend::getFraming(void) const
+{
+    return this->framing.load(std::memory_order_relaxed);
+}
+
+void Bus_backend::setRetryPolicy(const Retry_policy &policy)
+{
+    std::lock_guard<std::mutex> guard(this->policyLock);
+    for (Seqlock<Retry_policy> &p : this->policies)
+    {
+        p.store(policy);
+    }
+}
+
+void Bus_backend::setRetryPolicy(const int reg, const Retry_policy &policy)
+{
+    if (reg >= 0 && reg < STATS_MAX_REGS)
+    {
+        std::lock_guard<std::mutex> guard(this->policyLock);
+        this->policies[reg].store(policy);
+    }
+}
+
+Retry_policy Bus_backend::getRetryPolicy(const int reg) const
+{
+    return this->policies[reg >= 0 && reg < STATS_MAX_REGS ? reg : 0].load();
+}
+
+const Bus_stats &Bus_backend::getStats(void) const
+{
+    return this->stats;
+}
+
+void Bus_backend::resetStats(void)
+{
+    this->stats.reset();
+}
+
+int Bus_backend::setSpeed(const uint32_t hz)
+{
+    (void)hz;
+    return -1;
+}
+
+uint32_t Bus_backend::getSpeed(void)
+{
+    return 0;
+}
+
+int Bus_backend::reset(void)
+{
+    return -1;
+}
+
+uint32_t Bus_backend::transactionBits(const int tx_length, const int rx_length) const
+{
+    if (this->getFraming())
+    {
+        return 9 * (3 + (tx_length ? tx_length + I2C_FRAME_OVERHEAD : 0) + rx_length + I2C_FRAME_OVERHEAD) + 3;
+    }
+    return 9 * (3 + tx_length + rx_length) + 3;
+}
+
+bus_error_t classifyBusError(const int rc)
+{
+    if (rc >= 0)
+    {
+        return BUS_OK;
+    }
+    switch (rc)
+    {
+    case -ENXIO:
+    case -EREMOTEIO:
+        return BUS_NACK;
+    case -ETIMEDOUT:
+    case -EIO:
+        return BUS_TIMEOUT;
+    case -EAGAIN:
+    case -EBUSY:
+        return BUS_STUCK;
+    case -EBADMSG:
+    case -EPROTO:
+        return BUS_PROTOCOL;
+    default:
+        return BUS_OTHER;
+    }
+}
+
+std::shared_ptr<Bus_backend> defaultBusBackend(void)
+{
+    return busBackend(1);
+}
+
+std::shared_ptr<Bus_backend> busBackend(const int bus)
+{
+    static std::mutex lock;
+    static std::map<int, std::shared_ptr<Bus_backend>> backends;
+
+    std::lock_guard<std::mutex> guard(lock);
+    std::shared_ptr<Bus_backend> &backend = backends[bus];
+    if (!backend)
+    {
+        backend = std::make_shared<LGPIO_backend>(bus);
+    }
+    return backend;
+}
+
+double measureBusLatency(Bus_backend &bus, const int dev_handle, const int reg, const int data_length, const int n)
+{
+    char buf[MAX_BUFFER + RFLAGS_SIZE + 1];
+    if (data_length > MAX_BUFFER + RFLAGS_SIZE || n < 1)
+    {
+        return -1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; i++)
+    {
+        if (bus.read(dev_handle, reg, buf, data_length) != data_length)
+        {
+            return -1;
+        }
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / n;
+}
+
+int calibrateBusSpeed(Bus_backend &bus, const std::vector<int> &dev_handles, std::vector<Bus_speed_result> &results,
+                      const std::vector<uint32_t> &speeds, const int n, const double max_error_rate)
+{
+    const int regs[] = {Joint::PING, Joint::ANGLEMOVED};
+    const int sizes[] = {1 + RFLAGS_SIZE, sizeof(float) + RFLAGS_SIZE};
+    char buf[MAX_BUFFER + RFLAGS_SIZE + 1];
+
+    // every failed attempt counts, retries would hide them
+    Retry_policy saved[2];
+    for (int k = 0; k < 2; k++)
+    {
+        saved[k] = bus.getRetryPolicy(regs[k]);
+        Retry_policy once = saved[k];
+        once.max_attempts = 1;
+        bus.setRetryPolicy(regs[k], once);
+    }
+
+    for (uint32_t hz : speeds)
+    {
+        if (bus.setSpeed(hz) < 0)
+        {
+            continue;
+        }
+        Bus_speed_result r;
+        r.hz = hz;
+        uint64_t busy = 0;
+        for (int i = 0; i < n; i++)
+        {
+            for (int h : dev_handles)
+            {
+                for (int k = 0; k < 2; k++)
+                {
+                    uint64_t start = getClock().now();
+                    int rc = bus.read(h, regs[k], buf, sizes[k]);
+                    uint64_t latency = getClock().now() - start;
+                    r.transactions++;
+                    if (rc != sizes[k] || (regs[k] == Joint::PING && buf[0] != ACK))
+                    {
+                        r.errors++;
+                        continue;
+                    }
+                    busy += latency;
+                }
+            }
+        }
+        if (r.transactions > r.errors)
+        {
+            r.latency_us = static_cast<double>(busy) / (r.transactions - r.errors);
+        }
+
+        auto it = std::find_if(results.begin(), results.end(), [hz](const Bus_speed_result &e) { return e.hz == hz; });
+        if (it != results.end())
+        {
+            *it = r;
+        }
+        else
+        {
+            results.push_back(r);
+        }
+    }
+
+    for (int k = 0; k < 2; k++)
+    {
+        bus.setRetryPolicy(regs[k], saved[k]);
+    }
+    std::sort(results.begin(), results.end(), [](const Bus_speed_result &a, const Bus_speed_result &b) { return a.hz < b.hz; });
+
+    int selected = selectBusSpeed(results, max_error_rate);
+    if (selected > 0 && bus.setSpeed(selected) < 0)
+    {
+        std::cerr << "Bus speed " << selected << " Hz selected, but it can not be set at runtime" << std::endl;
+    }
+    return selected;
+}
+
+int selectBusSpeed(const std::vector<Bus_speed_result> &results, const double max_error_rate)
+{
+    int selected = -1;
+    for (const Bus_speed_result &r : results)
+    {
+        if (r.transactions > 0 && r.errors <= max_error_rate * r.transactions && static_cast<int>(r.hz) > selected)
+        {
+            selected = r.hz;
+        }
+    }
+    return selected;
+}
+
+int saveBusSpeeds(const std::string &path, const int bus_id, const std::vector<Bus_speed_result> &results)
+{
+    // keep the lines of the other buses
+    std::vector<std::string> lines;
+    std::ifstream in(path);
+    for (std::string line; std::getline(in, line);)
+    {
+        int id;
+        if (std::istringstream(line) >> id && id != bus_id)
+        {
+            lines.push_back(line);
+        }
+    }
+    in.close();
+
+    std::ofstream out(path);
+    if (!out)
+    {
+        std::cerr << "Could not write bus speeds to '" << path << "'" << std::endl;
+        return -1;
+    }
+    out << "# bus hz transactions errors latency_us" << std::endl;
+    for (const std::string &line : lines)
+    {
+        out << line << std::endl;
+    }
+    for (const Bus_speed_result &r : results)
+    {
+        out << bus_id << " " << r.hz << " " << r.transactions << " " << r.errors << " " << r.latency_us << std::endl;
+    }
+    return 0;
+}
+
+int loadBusSpeeds(const std::string &path, const int bus_id, std::vector<Bus_speed_result> &results)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        return -1;
+    }
+    results.clear();
+    for (std::string line; std::getline(in, line);)
+    {
+        int id;
+        Bus_speed_result r;
+        std::istringstream fields(line);
+        if (fields >> id >> r.hz >> r.transactions >> r.errors >> r.latency_us && id == bus_id)
+        {
+            results.push_back(r);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,48 @@
+#include "joint_communication/uClock.h"
+
+#include <chrono>
+#include <unistd.h>
+
+/**
+ * @brief Clock used by the library, function local to be safe from static initialization order.
+ */
+static std::shared_ptr<Clock> &currentClock(void)
+{
+    static std::shared_ptr<Clock> clock = std::make_shared<Clock>();
+    return clock;
+}
+
+uint64_t Clock::now(void)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Clock::sleep(uint64_t us)
+{
+    usleep(us);
+}
+
+uint64_t Virtual_clock::now(void)
+{
+    return this->t;
+}
+
+void Virtual_clock::sleep(uint64_t us)
+{
+    this->t += us;
+}
+
+void Virtual_clock::advance(uint64_t us)
+{
+    this->t += us;
+}
+
+void setClock(std::shared_ptr<Clock> clock)
+{
+    currentClock() = clock ? clock : std::make_shared<Clock>();
+}
+
+Clock &getClock(void)
+{
+    return *currentClock();
+}
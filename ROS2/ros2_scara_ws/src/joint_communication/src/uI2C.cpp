@@ -2,10 +2,11 @@
 #include "joint_communication/common.h"
 
 #include <lgpio.h>
+#include <fstream>
 
-int openI2CDevHandle(const int dev_addr)
+int openI2CDevHandle(const int dev_addr, const int bus)
 {
-    int rc = lgI2cOpen(1, dev_addr, 0);
+    int rc = lgI2cOpen(bus, dev_addr, 0);
     if (rc < 0)
     {
         std::cerr << "I2C OPEN ERROR: \'" << lguErrorText(rc) << "\'" << std::endl;
@@ -15,53 +16,74 @@ int openI2CDevHandle(const int dev_addr)
 
 int readFromI2CDev(const int dev_handle, const int reg, char *buffer, const int data_length)
 {
-    int rc;
-    for (size_t i = 0; i < 3; i++)
-    {
-        rc = lgI2cReadI2CBlockData(dev_handle, reg, buffer, data_length);
-        if(rc < 0 && i+1 < 3){
-            usleep(50);
-        }else{
-            break;
-        }
-    }
-
-    if (rc < 0)
-    {
-        std::cerr << "I2C READ ERROR: \'" << lguErrorText(rc) << "\'" << std::endl;
-    }
-    return rc;
+    return lgI2cReadI2CBlockData(dev_handle, reg, buffer, data_length);
 }
 
-int writeToI2CDev(const int dev_handle, const int reg, char *tx_buffer, const int data_length, char *RFLAGS_buffer)
+int writeToI2CDev(const int dev_handle, const int reg, char *tx_buffer, const int data_length, char *RFLAGS_buffer, const int rx_length)
 {
+    if (data_length > MAX_BUFFER + I2C_FRAME_OVERHEAD)
+    {
+        return -1;
+    }
 
-    char cmnd[MAX_BUFFER + 6];
+    char cmnd[MAX_BUFFER + I2C_FRAME_OVERHEAD + 6];
     cmnd[0] = 5;                                  // CMD: Write
     cmnd[1] = 1 + static_cast<char>(data_length); // N Bytes: 1 (reg) + data_length
     cmnd[2] = reg;                                // Data: register
     memcpy(&cmnd[3], tx_buffer, data_length);
     cmnd[3 + data_length] = 4;           // CMD: Read
-    cmnd[4 + data_length] = RFLAGS_SIZE; // N Bytes: RFLAGS_SIZE
+    cmnd[4 + data_length] = rx_length;   // N Bytes: RFLAGS_SIZE or framed reply
     cmnd[5 + data_length] = 0;           // Terminate Buffer
 
-    int rc;
-    for (size_t i = 0; i < 3; i++)
+    /* There is a bug in the lgpio library that requires `rxCount` to be set n+1 higher*/
+    return lgI2cZip(dev_handle, cmnd, 6 + data_length, RFLAGS_buffer, rx_length + 1);
+}
+
+int readFromI2CDevs(const int dev_handle, const int *dev_addrs, const int n_devs, const int reg, char *buffer, const int data_length)
+{
+    if (n_devs < 1 || n_devs > MAX_BATCH_DEVS)
     {
-        /* There is a bug in the lgpio library that requires `rxCount` to be set n+1 higher*/
-        rc = lgI2cZip(dev_handle, cmnd, 6 + data_length, RFLAGS_buffer, RFLAGS_SIZE + 1);
-        if(rc < 0 && i+1 < 3){
-            usleep(50);
-        }else{
-            break;
-        }
+        return -1;
     }
 
-    if (rc < 0)
+    char cmnd[7 * MAX_BATCH_DEVS + 1];
+    int n = 0;
+    for (int i = 0; i < n_devs; i++)
     {
-        std::cerr << "I2C WRITE ERROR: \'" << lguErrorText(rc) << "\'" << std::endl;
+        cmnd[n++] = 2;                                 // CMD: Set address
+        cmnd[n++] = static_cast<char>(dev_addrs[i]);   // Data: address
+        cmnd[n++] = 5;                                 // CMD: Write
+        cmnd[n++] = 1;                                 // N Bytes: 1 (reg)
+        cmnd[n++] = static_cast<char>(reg);            // Data: register
+        cmnd[n++] = 4;                                 // CMD: Read
+        cmnd[n++] = static_cast<char>(data_length);    // N Bytes: data_length
     }
-    return rc;
+    cmnd[n++] = 0; // Terminate Buffer
+
+    /* There is a bug in the lgpio library that requires `rxCount` to be set n+1 higher*/
+    return lgI2cZip(dev_handle, cmnd, n, buffer, n_devs * data_length + 1);
+}
+
+int writeToI2CDevs(const int dev_handle, const int reg, char *tx_buffer, const int data_length)
+{
+    if (data_length > MAX_BUFFER)
+    {
+        return -1;
+    }
+
+    char cmnd[MAX_BUFFER + 6];
+    char rx[1];
+    cmnd[0] = 2;                                  // CMD: Set address
+    cmnd[1] = I2C_GENERAL_CALL;                   // Data: address
+    cmnd[2] = 5;                                  // CMD: Write
+    cmnd[3] = 1 + static_cast<char>(data_length); // N Bytes: 1 (reg) + data_length
+    cmnd[4] = reg;                                // Data: register
+    memcpy(&cmnd[5], tx_buffer, data_length);
+    cmnd[5 + data_length] = 0;                    // Terminate Buffer
+
+    /* There is a bug in the lgpio library that requires `rxCount` to be set n+1 higher*/
+    int rc = lgI2cZip(dev_handle, cmnd, 6 + data_length, rx, 1);
+    return rc < 0 ? rc : 0;
 }
 
 int closeI2CDevHandle(const int dev_handle)
@@ -74,3 +96,90 @@ int closeI2CDevHandle(const int dev_handle)
     return rc;
 }
 
+LGPIO_backend::LGPIO_backend(const int bus)
+{
+    this->bus = bus;
+}
+
+uint32_t getI2CBusSpeed(const int bus)
+{
+    // device tree properties are big endian
+    std::ifstream in("/sys/class/i2c-adapter/i2c-" + std::to_string(bus) + "/of_node/clock-frequency", std::ios::binary);
+    unsigned char be[4];
+    if (!in.read(reinterpret_cast<char *>(be), sizeof(be)))
+    {
+        return 0;
+    }
+    return (uint32_t)be[0] << 24 | (uint32_t)be[1] << 16 | (uint32_t)be[2] << 8 | be[3];
+}
+
+int LGPIO_backend::open(const int dev_addr)
+{
+    int rc = openI2CDevHandle(dev_addr, this->bus);
+    if (rc >= 0)
+    {
+        if (rc >= static_cast<int>(this->addrs.size()))
+        {
+            this->addrs.resize(rc + 1, -1);
+        }
+        this->addrs[rc] = dev_addr;
+    }
+    return rc;
+}
+
+/**
+ * @brief Replaces the lgpio error code of a failed transfer by the errno of the failed ioctl, see classifyBusError().
+ */
+static int withErrno(const int rc)
+{
+    return rc < 0 && errno ? -errno : rc;
+}
+
+int LGPIO_backend::readOnce(const int dev_handle, const int reg, char *buffer, const int data_length)
+{
+    errno = 0;
+    return withErrno(readFromI2CDev(dev_handle, reg, buffer, data_length));
+}
+
+int LGPIO_backend::writeOnce(const int dev_handle, const int reg, char *tx_buffer, const int data_length, char *rx_buffer, const int rx_length)
+{
+    errno = 0;
+    int rc = withErrno(writeToI2CDev(dev_handle, reg, tx_buffer, data_length, rx_buffer, rx_length));
+    return rc < 0 ? rc : rx_length;
+}
+
+int LGPIO_backend::readBatchOnce(const int dev_handle, const int *dev_addrs, const int n_devs, const int reg, char *buffer, const int data_length)
+{
+    errno = 0;
+    return withErrno(readFromI2CDevs(dev_handle, dev_addrs, n_devs, reg, buffer, data_length));
+}
+
+int LGPIO_backend::broadcastOnce(const int dev_handle, const int reg, char *tx_buffer, const int data_length)
+{
+    errno = 0;
+    return withErrno(writeToI2CDevs(dev_handle, reg, tx_buffer, data_length));
+}
+
+int LGPIO_backend::address(const int dev_handle)
+{
+    return dev_handle >= 0 && dev_handle < static_cast<int>(this->addrs.size()) ? this->addrs[dev_handle] : -1;
+}
+
+int LGPIO_backend::close(const int dev_handle)
+{
+    if (dev_handle >= 0 && dev_handle < static_cast<int>(this->addrs.size()))
+    {
+        this->addrs[dev_handle] = -1;
+    }
+    return closeI2CDevHandle(dev_handle);
+}
+
+int LGPIO_backend::setSpeed(const uint32_t hz)
+{
+    return hz == getI2CBusSpeed(this->bus) ? 0 : -ENOTSUP;
+}
+
+uint32_t LGPIO_backend::getSpeed(void)
+{
+    return getI2CBusSpeed(this->bus);
+}
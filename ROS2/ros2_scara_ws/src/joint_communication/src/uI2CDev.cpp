@@ -0,0 +1,187 @@
+#include "joint_communication/uI2CDev.h"
+
+#include <linux/i2c-dev.h>
+#include <sys/ioctl.h>
+#include <string>
+
+I2CDEV_backend::I2CDEV_backend(const int bus)
+{
+    this->bus = bus;
+}
+
+I2CDEV_backend::~I2CDEV_backend()
+{
+    if (this->fd >= 0)
+    {
+        ::close(this->fd);
+    }
+}
+
+int I2CDEV_backend::open(const int dev_addr)
+{
+    if (this->fd < 0)
+    {
+        std::string path = "/dev/i2c-" + std::to_string(this->bus);
+        this->fd = ::open(path.c_str(), O_RDWR);
+        if (this->fd < 0)
+        {
+            int err = errno;
+            std::cerr << "I2C OPEN ERROR: \'" << path << ": " << strerror(err) << "\'" << std::endl;
+            return -err;
+        }
+    }
+
+    // reuse the slot of a closed handle, so reopening in recover() does not grow the table
+    this->n_open++;
+    for (size_t h = 0; h < this->addrs.size(); h++)
+    {
+        if (this->addrs[h] < 0)
+        {
+            this->addrs[h] = dev_addr;
+            return h;
+        }
+    }
+    this->addrs.push_back(dev_addr);
+    return this->addrs.size() - 1;
+}
+
+int I2CDEV_backend::transfer(const int n_msgs)
+{
+    struct i2c_rdwr_ioctl_data data;
+    data.msgs = this->msgs;
+    data.nmsgs = n_msgs;
+
+    return ioctl(this->fd, I2C_RDWR, &data) < 0 ? -errno : 0;
+}
+
+int I2CDEV_backend::readOnce(const int dev_handle, const int reg, char *buffer, const int data_length)
+{
+    if (dev_handle < 0 || dev_handle >= static_cast<int>(this->addrs.size()) || this->addrs[dev_handle] < 0)
+    {
+        return -EBADF;
+    }
+
+    this->regs[0] = reg;
+    this->msgs[0] = {static_cast<__u16>(this->addrs[dev_handle]), 0, 1, this->regs};
+    this->msgs[1] = {static_cast<__u16>(this->addrs[dev_handle]), I2C_M_RD, static_cast<__u16>(data_length), reinterpret_cast<__u8 *>(buffer)};
+
+    int rc = this->transfer(2);
+    if (rc < 0)
+    {
+        return rc;
+    }
+    return data_length;
+}
+
+int I2CDEV_backend::writeOnce(const int dev_handle, const int reg, char *tx_buffer, const int data_length, char *rx_buffer, const int rx_length)
+{
+    if (dev_handle < 0 || dev_handle >= static_cast<int>(this->addrs.size()) || this->addrs[dev_handle] < 0)
+    {
+        return -EBADF;
+    }
+    if (data_length > MAX_BUFFER + I2C_FRAME_OVERHEAD)
+    {
+        return -EINVAL;
+    }
+
+    this->tx_buf[0] = reg;
+    memcpy(&this->tx_buf[1], tx_buffer, data_length);
+    this->msgs[0] = {static_cast<__u16>(this->addrs[dev_handle]), 0, static_cast<__u16>(1 + data_length), this->tx_buf};
+    this->msgs[1] = {static_cast<__u16>(this->addrs[dev_handle]), I2C_M_RD, static_cast<__u16>(rx_length), reinterpret_cast<__u8 *>(rx_buffer)};
+
+    int rc = this->transfer(2);
+    if (rc < 0)
+    {
+        return rc;
+    }
+    return rx_length;
+}
+
+int I2CDEV_backend::readBatchOnce(const int dev_handle, const int *dev_addrs, const int n_devs, const int reg, char *buffer, const int data_length)
+{
+    (void)dev_handle; // all devices share the one bus file descriptor
+    if (n_devs < 1 || n_devs > MAX_BATCH_DEVS)
+    {
+        return -EINVAL;
+    }
+    if (this->fd < 0)
+    {
+        return -EBADF;
+    }
+
+    for (int i = 0; i < n_devs; i++)
+    {
+        this->regs[i] = reg;
+        this->msgs[2 * i] = {static_cast<__u16>(dev_addrs[i]), 0, 1, &this->regs[i]};
+        this->msgs[2 * i + 1] = {static_cast<__u16>(dev_addrs[i]), I2C_M_RD, static_cast<__u16>(data_length), reinterpret_cast<__u8 *>(buffer + i * data_length)};
+    }
+
+    int rc = this->transfer(2 * n_devs);
+    if (rc < 0)
+    {
+        return rc;
+    }
+    return n_devs * data_length;
+}
+
+int I2CDEV_backend::broadcastOnce(const int dev_handle, const int reg, char *tx_buffer, const int data_length)
+{
+    (void)dev_handle; // all devices share the one bus file descriptor
+    if (this->fd < 0)
+    {
+        return -EBADF;
+    }
+    if (data_length > MAX_BUFFER)
+    {
+        return -EINVAL;
+    }
+
+    this->tx_buf[0] = reg;
+    memcpy(&this->tx_buf[1], tx_buffer, data_length);
+    this->msgs[0] = {I2C_GENERAL_CALL, 0, static_cast<__u16>(1 + data_length), this->tx_buf};
+    return this->transfer(1);
+}
+
+int I2CDEV_backend::address(const int dev_handle)
+{
+    return dev_handle >= 0 && dev_handle < static_cast<int>(this->addrs.size()) ? this->addrs[dev_handle] : -1;
+}
+
+int I2CDEV_backend::close(const int dev_handle)
+{
+    if (dev_handle < 0 || dev_handle >= static_cast<int>(this->addrs.size()) || this->addrs[dev_handle] < 0)
+    {
+        return -EBADF;
+    }
+
+    this->addrs[dev_handle] = -1;
+    if (--this->n_open == 0)
+    {
+        ::close(this->fd);
+        this->fd = -1;
+        this->addrs.clear();
+    }
+    return 0;
+}
+
+int I2CDEV_backend::setSpeed(const uint32_t hz)
+{
+    return hz == getI2CBusSpeed(this->bus) ? 0 : -ENOTSUP;
+}
+
+uint32_t I2CDEV_backend::getSpeed(void)
+{
+    return getI2CBusSpeed(this->bus);
+}
+
+int I2CDEV_backend::reset(void)
+{
+    if (this->fd < 0)
+    {
+        return -EBADF;
+    }
+    ::close(this->fd);
+    std::string path = "/dev/i2c-" + std::to_string(this->bus);
+    this->fd = ::open(path.c_str(), O_RDWR);
+    return this->fd < 0 ? -errno : 0;
+}
@@ -0,0 +1,298 @@
+#include "joint_communication/uRS485.h"
+
+#include <chrono>
+#include <poll.h>
+
+/**
+ * @return the termios constant of a baud rate, B0 if it is not supported.
+ */
+static speed_t baudConstant(const int baud)
+{
+    switch (baud)
+    {
+    case 9600:
+        return B9600;
+    case 115200:
+        return B115200;
+    case 230400:
+        return B230400;
+    case 460800:
+        return B460800;
+    case 500000:
+        return B500000;
+    case 921600:
+        return B921600;
+    case 1000000:
+        return B1000000;
+    case 2000000:
+        return B2000000;
+    default:
+        return B0;
+    }
+}
+
+RS485_backend::RS485_backend(const std::string device, const int baud, const uint32_t timeout_us)
+{
+    this->device = device;
+    this->baud = baud;
+    this->timeout_us = timeout_us;
+}
+
+RS485_backend::~RS485_backend()
+{
+    if (this->fd >= 0)
+    {
+        ::close(this->fd);
+    }
+}
+
+int RS485_backend::open(const int dev_addr)
+{
+    if (this->fd < 0)
+    {
+        speed_t speed = baudConstant(this->baud);
+        if (speed == B0)
+        {
+            std::cerr << "RS485 OPEN ERROR: unsupported baud rate " << this->baud << std::endl;
+            return -EINVAL;
+        }
+        this->fd = ::open(this->device.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if (this->fd < 0)
+        {
+            int err = errno;
+            std::cerr << "RS485 OPEN ERROR: \'" << this->device << ": " << strerror(err) << "\'" << std::endl;
+            return -err;
+        }
+
+        struct termios tty;
+        tcgetattr(this->fd, &tty);
+        cfmakeraw(&tty);
+        cfsetispeed(&tty, speed);
+        cfsetospeed(&tty, speed);
+        tty.c_cflag |= CLOCAL | CREAD;
+        tty.c_cflag &= ~CRTSCTS;
+        tcsetattr(this->fd, TCSANOW, &tty);
+        tcflush(this->fd, TCIOFLUSH);
+    }
+
+    // reuse the slot of a closed handle, so reopening in recover() does not grow the table
+    this->n_open++;
+    for (size_t h = 0; h < this->addrs.size(); h++)
+    {
+        if (this->addrs[h] < 0)
+        {
+            this->addrs[h] = dev_addr;
+            return h;
+        }
+    }
+    this->addrs.push_back(dev_addr);
+    return this->addrs.size() - 1;
+}
+
+int RS485_backend::send(const int dev_addr, const int reg, const char *payload, const int length)
+{
+    if (this->fd < 0)
+    {
+        return -EBADF;
+    }
+    if (length > FRAME_MAX_PAYLOAD)
+    {
+        return -EINVAL;
+    }
+
+    // drop bytes of a previous transaction which timed out
+    tcflush(this->fd, TCIFLUSH);
+
+    this->frame[0] = FRAME_SYNC;
+    this->frame[1] = dev_addr;
+    this->frame[2] = reg;
+    this->frame[3] = length;
+    if (length > 0)
+    {
+        memcpy(&this->frame[4], payload, length);
+    }
+    this->frame[4 + length] = crc8(&this->frame[1], 3 + length);
+    for (int sent = 0, n = FRAME_OVERHEAD + length; sent < n;)
+    {
+        int rc = ::write(this->fd, this->frame + sent, n - sent);
+        if (rc < 0 && errno != EAGAIN)
+        {
+            return -errno;
+        }
+        if (rc < 0)
+        {
+            // the transmit buffer is full, wait until the UART drained some of it
+            struct pollfd pfd = {this->fd, POLLOUT, 0};
+            if (poll(&pfd, 1, (this->timeout_us + 999) / 1000) <= 0)
+            {
+                return -ETIMEDOUT;
+            }
+            continue;
+        }
+        sent += rc;
+    }
+    return 0;
+}
+
+int RS485_backend::transfer(const int dev_addr, const int reg, const char *payload, const int length, char *reply, const int reply_length)
+{
+    if (reply_length > FRAME_MAX_PAYLOAD)
+    {
+        return -EINVAL;
+    }
+    int rc = this->send(dev_addr, reg, payload, length);
+    if (rc < 0)
+    {
+        return rc;
+    }
+
+    // Receive until a complete reply of the joint arrived. Other frames, e.g. the echo of the request, are skipped.
+    // The timeout is real time, independent of getClock().
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(this->timeout_us);
+    int n = 0;
+    while (true)
+    {
+        int need = n < 4 ? 4 : FRAME_OVERHEAD + this->frame[3];
+        if (n < need)
+        {
+            auto left = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count();
+            struct pollfd pfd = {this->fd, POLLIN, 0};
+            if (left <= 0 || poll(&pfd, 1, (left + 999) / 1000) <= 0)
+            {
+                return -ETIMEDOUT;
+            }
+            int rc = ::read(this->fd, this->frame + n, need - n);
+            n += rc > 0 ? rc : 0;
+        }
+
+        // resynchronize on the next SYNC byte if the frame start or length is corrupted
+        while (n > 0 && (this->frame[0] != FRAME_SYNC || (n >= 4 && this->frame[3] > FRAME_MAX_PAYLOAD)))
+        {
+            memmove(this->frame, this->frame + 1, --n);
+        }
+        if (n < 4 || n < FRAME_OVERHEAD + this->frame[3])
+        {
+            continue;
+        }
+
+        const uint8_t len = this->frame[3];
+        if (crc8(&this->frame[1], 3 + len) != this->frame[4 + len])
+        {
+            return -EBADMSG;
+        }
+        if (this->frame[1] != (dev_addr | FRAME_REPLY) || this->frame[2] != reg)
+        {
+            n = 0;
+            continue;
+        }
+        if (len != reply_length)
+        {
+            return -EBADMSG;
+        }
+        memcpy(reply, &this->frame[4], len);
+        return 0;
+    }
+}
+
+int RS485_backend::readOnce(const int dev_handle, const int reg, char *buffer, const int data_length)
+{
+    if (dev_handle < 0 || dev_handle >= static_cast<int>(this->addrs.size()) || this->addrs[dev_handle] < 0)
+    {
+        return -EBADF;
+    }
+
+    int rc = this->transfer(this->addrs[dev_handle], reg, nullptr, 0, buffer, data_length);
+    return rc < 0 ? rc : data_length;
+}
+
+int RS485_backend::writeOnce(const int dev_handle, const int reg, char *tx_buffer, const int data_length, char *rx_buffer, const int rx_length)
+{
+    if (dev_handle < 0 || dev_handle >= static_cast<int>(this->addrs.size()) || this->addrs[dev_handle] < 0)
+    {
+        return -EBADF;
+    }
+    if (data_length < 1)
+    {
+        return -EINVAL; // a request without payload is a read
+    }
+
+    int rc = this->transfer(this->addrs[dev_handle], reg, tx_buffer, data_length, rx_buffer, rx_length);
+    return rc < 0 ? rc : rx_length;
+}
+
+int RS485_backend::readBatchOnce(const int dev_handle, const int *dev_addrs, const int n_devs, const int reg, char *buffer, const int data_length)
+{
+    (void)dev_handle; // all devices share the one port
+    if (n_devs < 1 || n_devs > MAX_BATCH_DEVS)
+    {
+        return -EINVAL;
+    }
+
+    for (int i = 0; i < n_devs; i++)
+    {
+        int rc = this->transfer(dev_addrs[i], reg, nullptr, 0, buffer + i * data_length, data_length);
+        if (rc < 0)
+        {
+            return rc;
+        }
+    }
+    return n_devs * data_length;
+}
+
+int RS485_backend::broadcastOnce(const int dev_handle, const int reg, char *tx_buffer, const int data_length)
+{
+    (void)dev_handle; // all devices share the one port
+    if (data_length < 1)
+    {
+        return -EINVAL;
+    }
+    // the frame is on the line once it left the UART, the joints do not answer
+    int rc = this->send(I2C_GENERAL_CALL, reg, tx_buffer, data_length);
+    return rc < 0 ? rc : (tcdrain(this->fd) < 0 ? -errno : 0);
+}
+
+int RS485_backend::address(const int dev_handle)
+{
+    return dev_handle >= 0 && dev_handle < static_cast<int>(this->addrs.size()) ? this->addrs[dev_handle] : -1;
+}
+
+int RS485_backend::close(const int dev_handle)
+{
+    if (dev_handle < 0 || dev_handle >= static_cast<int>(this->addrs.size()) || this->addrs[dev_handle] < 0)
+    {
+        return -EBADF;
+    }
+
+    this->addrs[dev_handle] = -1;
+    if (--this->n_open == 0)
+    {
+        ::close(this->fd);
+        this->fd = -1;
+        this->addrs.clear();
+    }
+    return 0;
+}
+
+uint32_t RS485_backend::getSpeed(void)
+{
+    return this->baud;
+}
+
+int RS485_backend::reset(void)
+{
+    if (this->fd < 0)
+    {
+        return -EBADF;
+    }
+    return tcflush(this->fd, TCIOFLUSH) < 0 ? -errno : 0;
+}
+
+int RS485_backend::setFraming(const bool enable)
+{
+    return enable ? -ENOTSUP : 0;
+}
+
+uint32_t RS485_backend::transactionBits(const int tx_length, const int rx_length) const
+{
+    return 10 * (2 * FRAME_OVERHEAD + tx_length + rx_length);
+}
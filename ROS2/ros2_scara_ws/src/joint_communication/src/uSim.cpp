@@ -0,0 +1,885 @@
+#include "joint_communication/uSim.h"
+#include "joint_communication/uClock.h"
+#include "joint_communication/mJoint.h"
+
+#include <algorithm>
+#include <cmath>
+
+/** degrees per full step of the 200 steps/rev stepper */
+#define SIM_DEG_PER_STEP (360.0f / 200.0f)
+/** integration step of the motion model in us */
+#define SIM_DT_US 1000
+/** homing fails after this time, HOME_TIMEOUT_MS of the firmware, in us */
+#define SIM_HOME_TIMEOUT_US 30000000
+/** CONTROL_THRESHOLD of the firmware */
+#define SIM_CONTROL_THRESHOLD 15
+/** samples in the telemetry buffer, CAPTURE_BUFFER of the firmware */
+#define SIM_CAPTURE_BUFFER 512
+/** setpoints further apart start a new interpolation, INTERP_MAX_PERIOD of the firmware, in s */
+#define SIM_INTERP_MAX_PERIOD 0.2f
+/** sample period assumed until the second setpoint arrived, INTERP_DEFAULT_PERIOD of the firmware, in s */
+#define SIM_INTERP_DEFAULT_PERIOD 0.02f
+
+/**
+ * @brief Cubic Hermite spline from (p0, v0) to (p1, v1) of duration T evaluated at t, as hermite() of the firmware.
+ */
+static void hermite(float p0, float v0, float p1, float v1, float T, float t, float &p, float &v)
+{
+    float s = T > 0 ? t / T : 1;
+    float s2 = s * s;
+    float s3 = s2 * s;
+    p = (2 * s3 - 3 * s2 + 1) * p0 + (s3 - 2 * s2 + s) * T * v0 + (-2 * s3 + 3 * s2) * p1 + (s3 - s2) * T * v1;
+    v = T > 0 ? (6 * s2 - 6 * s) / T * (p0 - p1) + (3 * s2 - 4 * s + 1) * v0 + (3 * s2 - 2 * s) * v1 : v1;
+}
+
+void Sim_backend::addDevice(const int dev_addr, const float home_distance, const float max_accel, const float max_vel)
+{
+    Sim_device dev;
+    dev.address = dev_addr;
+    dev.home_distance = home_distance;
+    dev.max_accel = max_accel * SIM_DEG_PER_STEP;
+    dev.max_vel = max_vel * SIM_DEG_PER_STEP;
+    dev.defaults = {max_accel, max_accel, max_vel, SIM_CONTROL_THRESHOLD};
+    dev.config = dev.defaults;
+    dev.t = getClock().now();
+    dev.t0 = dev.t;
+    this->devices.push_back(dev);
+}
+
+void Sim_backend::stall(const int dev_addr)
+{
+    Sim_device *dev = this->find(dev_addr);
+    if (dev && dev->isStallguardEnabled)
+    {
+        this->update(*dev);
+        dev->isStalled = true;
+        dev->pvtCount = 0;
+        dev->latched = false;
+        dev->mode = VELOCITY; // stepper.stop(SOFT)
+        dev->target = 0;
+    }
+}
+
+void Sim_backend::setTransactionTime(const uint64_t us)
+{
+    this->transactionTime = us;
+}
+
+void Sim_backend::setSpeedLimit(const uint32_t hz)
+{
+    this->speedLimit = hz;
+}
+
+void Sim_backend::setCorruption(const uint32_t n)
+{
+    this->corruption = n;
+}
+
+void Sim_backend::corrupt(char *buffer, const int length)
+{
+    if (this->corruption && length > 0 && ++this->corrupted % this->corruption == 0)
+    {
+        // walk through the bits of the message with every corruption
+        const uint32_t bit = this->corrupted / this->corruption;
+        buffer[bit / 8 % length] ^= 1 << (bit % 8);
+    }
+}
+
+void Sim_backend::hang(const uint64_t us)
+{
+    this->hangUntil = getClock().now() + us;
+}
+
+void Sim_backend::reboot(const int dev_addr)
+{
+    Sim_device *dev = this->find(dev_addr);
+    if (dev)
+    {
+        this->update(*dev);
+        dev->mode = IDLE;
+        dev->velocity = 0;
+        dev->isSetup = false;
+        dev->isHomed = false;
+        dev->isStalled = false;
+        dev->isStallguardEnabled = false;
+        dev->busy = false;
+    }
+}
+
+int Sim_backend::reset(void)
+{
+    this->hangUntil = 0;
+    return 0;
+}
+
+int Sim_backend::setSpeed(const uint32_t hz)
+{
+    if (hz == 0)
+    {
+        return -1;
+    }
+    this->speed = hz;
+    return 0;
+}
+
+uint32_t Sim_backend::getSpeed(void)
+{
+    return this->speed;
+}
+
+int Sim_backend::transact(const int bytes)
+{
+    uint64_t us = this->transactionTime;
+    if (this->speed)
+    {
+        us += 9ull * bytes * 1000000 / this->speed;
+    }
+    if (us)
+    {
+        getClock().sleep(us);
+    }
+    if (getClock().now() < this->hangUntil)
+    {
+        return -ETIMEDOUT;
+    }
+    // the firmware misses clock stretching deadlines above its speed limit
+    if (this->speedLimit && this->speed > this->speedLimit && ++this->transactions % 10 == 0)
+    {
+        return -EIO;
+    }
+    return 0;
+}
+
+Sim_backend::Sim_device *Sim_backend::find(const int dev_addr)
+{
+    for (Sim_device &dev : this->devices)
+    {
+        if (dev.address == dev_addr)
+        {
+            return &dev;
+        }
+    }
+    return nullptr;
+}
+
+void Sim_backend::update(Sim_device &dev)
+{
+    const uint64_t now = getClock().now();
+    const float dt = SIM_DT_US * 1e-6f;
+    const float dv = dev.max_accel * dt;
+
+    for (; dev.t + SIM_DT_US <= now; dev.t += SIM_DT_US)
+    {
+        // one model step is one control tick of the firmware, see capture_update()
+        if (dev.captureLeft && ++dev.captureTick >= dev.captureDivider)
+        {
+            dev.captureTick = 0;
+            if (dev.capture.size() == SIM_CAPTURE_BUFFER)
+            {
+                dev.capture.pop_front();
+            }
+            dev.capture.push_back({dev.position, dev.velocity / 6.0f, 0});
+            dev.captureTaken++;
+            dev.captureLeft--;
+        }
+
+        switch (dev.mode)
+        {
+        case POSITION:
+        {
+            float err = dev.target - dev.position;
+            float dir = err > 0 ? 1 : -1;
+            if (std::fabs(err) <= std::fabs(dev.velocity) * dt && std::fabs(dev.velocity) <= dv)
+            {
+                dev.position = dev.target;
+                dev.velocity = 0;
+                dev.mode = IDLE;
+                continue;
+            }
+            if (dev.velocity * dir > 0 && std::fabs(err) <= dev.velocity * dev.velocity / (2 * dev.max_accel))
+            {
+                dev.velocity -= dir * dv; // decelerate into the target
+            }
+            else
+            {
+                dev.velocity += dir * dv;
+            }
+            break;
+        }
+        case HOMING:
+            if (dev.t + SIM_DT_US - dev.homeT0 > SIM_HOME_TIMEOUT_US)
+            {
+                dev.mode = VELOCITY;
+                dev.target = 0;
+                dev.velocity = 0; // stepper.stop()
+                dev.homeState = Joint::HOME_TIMEOUT;
+                dev.busy = false;
+                continue;
+            }
+            [[fallthrough]];
+        case VELOCITY:
+            dev.velocity += std::fmax(-dv, std::fmin(dv, dev.target - dev.velocity));
+            if (dev.mode == VELOCITY && dev.target == 0 && dev.velocity == 0)
+            {
+                dev.mode = IDLE;
+            }
+            break;
+        case TRAJECTORY:
+        {
+            uint64_t t = dev.t + SIM_DT_US - dev.pvtT0;
+            while (dev.pvtCount && t >= dev.pvt[dev.pvtHead].duration_us)
+            {
+                const PVT_segment_payload &s = dev.pvt[dev.pvtHead];
+                t -= s.duration_us;
+                dev.pvtT0 += s.duration_us;
+                dev.pvtP0 = s.angle;
+                dev.pvtV0 = s.velocity;
+                dev.pvtHead = (dev.pvtHead + 1) % PVT_BUFFER;
+                dev.pvtCount--;
+            }
+            if (!dev.pvtCount)
+            {
+                // buffer ran empty: hold the end of the last segment
+                dev.mode = POSITION;
+                dev.target = dev.pvtP0;
+                continue;
+            }
+            const PVT_segment_payload &s = dev.pvt[dev.pvtHead];
+            hermite(dev.pvtP0, dev.pvtV0, s.angle, s.velocity, s.duration_us * 1e-6f, t * 1e-6f, dev.position, dev.velocity);
+            continue;
+        }
+        case INTERPOLATE:
+            if ((dev.t + SIM_DT_US - dev.ipT0) * 1e-6f >= 2 * dev.ipPeriod)
+            {
+                // no setpoint within two periods: stop at the latest one
+                dev.mode = POSITION;
+                dev.target = dev.ipP1;
+                continue;
+            }
+            this->interpolate(dev, dev.t + SIM_DT_US, dev.position, dev.velocity);
+            continue;
+        case IDLE:
+            dev.velocity = 0;
+            break;
+        }
+
+        dev.velocity = std::fmax(-dev.max_vel, std::fmin(dev.max_vel, dev.velocity));
+        dev.position += dev.velocity * dt;
+
+        if (dev.mode == HOMING)
+        {
+            dev.travelled += std::fabs(dev.velocity) * dt;
+            if (dev.travelled >= dev.home_distance)
+            {
+                // end stop reached: encoder.setHome(), driver.setHome(), stop()
+                dev.position = 0;
+                dev.velocity = 0;
+                dev.mode = IDLE;
+                dev.isHomed = true;
+                dev.isStalled = false;
+                dev.homeState = Joint::HOME_DONE;
+                dev.busy = false;
+            }
+        }
+    }
+    // Follow a clock which jumped backwards, e.g. after setClock()
+    if (dev.t > now)
+    {
+        dev.t = now;
+    }
+}
+
+void Sim_backend::sample(Sim_device &dev, const float angle)
+{
+    const float dt = (dev.t - dev.ipT0) * 1e-6f;
+    float p, v;
+    dev.pvtCount = 0;
+    if (dev.mode == HOMING)
+    {
+        dev.homeState = Joint::HOME_ABORTED;
+        dev.busy = false;
+    }
+    if (dev.mode == INTERPOLATE && dt < SIM_INTERP_MAX_PERIOD)
+    {
+        if (dt > 1e-3f)
+        {
+            dev.ipPeriod = dev.ipSamples < 2 ? dt : dev.ipPeriod + (dt - dev.ipPeriod) / 4;
+        }
+        this->interpolate(dev, dev.t, p, v);
+        dev.ipSamples = std::min(dev.ipSamples + 1, 2);
+    }
+    else
+    {
+        p = dev.position;
+        v = 0;
+        dev.ipPeriod = SIM_INTERP_DEFAULT_PERIOD;
+        dev.ipSamples = 1;
+    }
+
+    if (dev.interp == Joint::INTERP_CUBIC)
+    {
+        dev.ipV1 = dev.ipSamples < 2 ? 0 : (angle - dev.ipP1) / dev.ipPeriod;
+    }
+    else
+    {
+        dev.ipV1 = (angle - p) / dev.ipPeriod;
+    }
+    dev.ipP0 = p;
+    dev.ipV0 = v;
+    dev.ipP1 = angle;
+    dev.ipT0 = dev.t;
+    dev.mode = INTERPOLATE;
+}
+
+void Sim_backend::interpolate(const Sim_device &dev, const uint64_t t, float &p, float &v)
+{
+    const float s = (t - dev.ipT0) * 1e-6f;
+    if (s >= dev.ipPeriod)
+    {
+        v = dev.ipV1;
+        p = dev.ipP1 + dev.ipV1 * (s - dev.ipPeriod);
+    }
+    else if (dev.interp == Joint::INTERP_LINEAR)
+    {
+        v = dev.ipV1;
+        p = dev.ipP0 + dev.ipV1 * s;
+    }
+    else
+    {
+        hermite(dev.ipP0, dev.ipV0, dev.ipP1, dev.ipV1, dev.ipPeriod, s, p, v);
+    }
+}
+
+u_int8_t Sim_backend::state(const Sim_device &dev)
+{
+    u_int8_t s = 0;
+    s |= dev.isStalled ? (1 << 0) : 0;
+    s |= dev.busy ? (1 << 1) : 0;
+    s |= dev.isHomed ? (1 << 2) : 0;
+    s |= dev.isSetup ? (1 << 3) : 0;
+    s |= (dev.pvtCount * 7 + PVT_BUFFER - 1) / PVT_BUFFER << 5;
+    return s;
+}
+
+int Sim_backend::request(Sim_device &dev, const int reg, char *buffer)
+{
+    int n = 0;
+    float f;
+    switch (reg)
+    {
+    case Joint::PING:
+        buffer[n++] = ACK;
+        break;
+    case Joint::ANGLEMOVED:
+        f = dev.position;
+        memcpy(buffer, &f, sizeof(f));
+        n = sizeof(f);
+        break;
+    case Joint::GETENCODERRPM:
+        f = dev.velocity / 6.0f;
+        memcpy(buffer, &f, sizeof(f));
+        n = sizeof(f);
+        break;
+    case Joint::GETSTATE:
+    {
+        // the simulation follows setpoints exactly, hence without PID error
+        Joint_state_payload payload = {dev.position, dev.velocity / 6.0f, 0};
+        memcpy(buffer, &payload, sizeof(payload));
+        n = sizeof(payload);
+        break;
+    }
+    case Joint::GETCOMMITDELAY:
+    {
+        const uint32_t delay = 0; // commands are executed on reception
+        memcpy(buffer, &delay, sizeof(delay));
+        n = sizeof(delay);
+        break;
+    }
+    case Joint::GETCAPTURE:
+    {
+        Capture_batch_payload batch = {};
+        batch.index = dev.captureTaken - dev.capture.size();
+        batch.count = std::min<size_t>(dev.capture.size(), CAPTURE_BATCH);
+        for (int i = 0; i < batch.count; i++)
+        {
+            batch.samples[i] = dev.capture.front();
+            dev.capture.pop_front();
+        }
+        batch.active = dev.captureLeft > 0;
+        memcpy(buffer, &batch, sizeof(batch));
+        n = sizeof(batch);
+        break;
+    }
+    case Joint::GETTRACE:
+    {
+        Trace_batch_payload batch = {}; // the model records no events
+        memcpy(buffer, &batch, sizeof(batch));
+        n = sizeof(batch);
+        break;
+    }
+    case Joint::GETCONFIG:
+        memcpy(buffer, &dev.config, sizeof(dev.config));
+        n = sizeof(dev.config);
+        break;
+    case Joint::GETLOOPSTATS:
+    {
+        // one control tick per model step, which never overruns
+        Loop_stats stats;
+        stats.ticks = (dev.t - dev.t0) / SIM_DT_US;
+        memcpy(buffer, &stats, sizeof(stats));
+        n = sizeof(stats);
+        break;
+    }
+    case Joint::GETHOMESTATE:
+        buffer[n++] = dev.homeState;
+        break;
+    case Joint::ISSTALLED:
+        buffer[n++] = dev.isStalled;
+        break;
+    case Joint::ISHOMED:
+        buffer[n++] = dev.isHomed;
+        break;
+    case Joint::ISSETUP:
+        buffer[n++] = dev.isSetup;
+        break;
+    default:
+        // Unknown function: only the flags are sent
+        break;
+    }
+    buffer[n++] = this->state(dev);
+    return n;
+}
+
+void Sim_backend::receive(Sim_device &dev, const int reg, const char *rx_buf, const int rx_length)
+{
+    float f = 0;
+    int32_t i = 0;
+    u_int8_t b = 0;
+    if (rx_length >= 4)
+    {
+        memcpy(&f, rx_buf, sizeof(f));
+        memcpy(&i, rx_buf, sizeof(i));
+    }
+    if (rx_length >= 1)
+    {
+        memcpy(&b, rx_buf, 1);
+    }
+
+    // motion commands take over from a streamed trajectory or interpolated setpoints
+    switch (reg)
+    {
+    case Joint::MOVETOANGLE:
+        if (dev.interp != Joint::INTERP_OFF)
+        {
+            break; // see sample()
+        }
+        [[fallthrough]];
+    case Joint::SETUP:
+    case Joint::SETRPM:
+    case Joint::MOVESTEPS:
+    case Joint::STOP:
+    case Joint::HOME:
+        dev.pvtCount = 0;
+        dev.latched = false;
+        if (dev.mode == HOMING)
+        {
+            dev.homeState = Joint::HOME_ABORTED;
+            dev.busy = false;
+        }
+        if (dev.mode == TRAJECTORY || dev.mode == INTERPOLATE)
+        {
+            dev.mode = VELOCITY;
+            dev.target = 0;
+        }
+        break;
+    default:
+        break;
+    }
+
+    switch (reg)
+    {
+    case Joint::SETUP:
+        dev.driveCurrent = rx_buf[0];
+        dev.holdCurrent = rx_length > 1 ? rx_buf[1] : 0;
+        if (!dev.isSetup)
+        {
+            dev.isHomed = false;
+        }
+        dev.target = dev.position;
+        dev.velocity = 0;
+        dev.mode = IDLE;
+        dev.isStallguardEnabled = false;
+        dev.isSetup = true;
+        dev.isStalled = false;
+        break;
+    case Joint::SETRPM:
+        if (!dev.isStalled)
+        {
+            dev.mode = VELOCITY;
+            dev.target = f * 6.0f;
+        }
+        break;
+    case Joint::MOVESTEPS:
+        dev.mode = POSITION;
+        dev.target = dev.position + i * SIM_DEG_PER_STEP;
+        break;
+    case Joint::MOVETOANGLE:
+        if (dev.isStalled)
+        {
+            break;
+        }
+        if (dev.interp == Joint::INTERP_OFF)
+        {
+            dev.mode = POSITION;
+            dev.target = f;
+        }
+        else
+        {
+            this->sample(dev, f);
+        }
+        break;
+    case Joint::SETCURRENT:
+        dev.driveCurrent = b;
+        break;
+    case Joint::SETHOLDCURRENT:
+        dev.holdCurrent = b;
+        break;
+    case Joint::ENABLESTALLGUARD:
+        dev.isStallguardEnabled = true;
+        dev.isStalled = false;
+        break;
+    case Joint::STOP:
+        dev.mode = VELOCITY;
+        dev.target = 0;
+        if (!b)
+        {
+            dev.velocity = 0; // hard stop
+        }
+        break;
+    case Joint::HOME:
+    {
+        u_int8_t dir = rx_buf[0];
+        u_int8_t speed = rx_length > 1 ? rx_buf[1] : 0;
+        dev.mode = HOMING;
+        dev.target = (dir ? speed : -speed) * 6.0f;
+        dev.travelled = 0;
+        dev.homeT0 = dev.t;
+        dev.homeState = Joint::HOME_RUNNING;
+        dev.busy = true;
+        break;
+    }
+    case Joint::PUSHPVT:
+        if (dev.isStalled || rx_length == 0 || rx_length % sizeof(PVT_segment_payload))
+        {
+            break;
+        }
+        if (dev.mode == HOMING)
+        {
+            dev.homeState = Joint::HOME_ABORTED;
+            dev.busy = false;
+        }
+        for (size_t k = 0; k < rx_length / sizeof(PVT_segment_payload) && dev.pvtCount < PVT_BUFFER; k++)
+        {
+            memcpy(&dev.pvt[(dev.pvtHead + dev.pvtCount) % PVT_BUFFER], rx_buf + k * sizeof(PVT_segment_payload), sizeof(PVT_segment_payload));
+            dev.pvtCount++;
+        }
+        if (dev.mode != TRAJECTORY)
+        {
+            // the first segment starts at the current position
+            dev.pvtP0 = dev.position;
+            dev.pvtV0 = dev.velocity;
+            dev.pvtT0 = dev.t;
+            dev.mode = TRAJECTORY;
+        }
+        break;
+    case Joint::SETINTERPOLATION:
+        if (b > Joint::INTERP_CUBIC)
+        {
+            break;
+        }
+        if (dev.mode == INTERPOLATE)
+        {
+            // hold the latest setpoint
+            dev.mode = POSITION;
+            dev.target = dev.ipP1;
+        }
+        dev.interp = static_cast<Joint::interp_mode_t>(b);
+        break;
+    case Joint::SETMAXACCELERATION:
+    case Joint::SETMAXDECELERATION:
+    case Joint::SETMAXVELOCITY:
+    case Joint::SETCONTROLTHRESHOLD:
+        if (!(f > 0))
+        {
+            break;
+        }
+        if (reg == Joint::SETMAXACCELERATION)
+        {
+            dev.config.maxAcceleration = f;
+        }
+        else if (reg == Joint::SETMAXDECELERATION)
+        {
+            dev.config.maxDeceleration = f;
+        }
+        else if (reg == Joint::SETMAXVELOCITY)
+        {
+            dev.config.maxVelocity = f;
+        }
+        else
+        {
+            dev.config.controlThreshold = f;
+        }
+        dev.max_accel = dev.config.maxAcceleration * SIM_DEG_PER_STEP;
+        dev.max_vel = dev.config.maxVelocity * SIM_DEG_PER_STEP;
+        break;
+    case Joint::STORECONFIG:
+        if (b == Joint::CONFIG_SAVE)
+        {
+            dev.flash = dev.config;
+            dev.flashValid = true;
+        }
+        else if (b == Joint::CONFIG_LOAD && dev.flashValid)
+        {
+            dev.config = dev.flash;
+        }
+        else if (b == Joint::CONFIG_DEFAULTS)
+        {
+            dev.config = dev.defaults;
+        }
+        dev.max_accel = dev.config.maxAcceleration * SIM_DEG_PER_STEP;
+        dev.max_vel = dev.config.maxVelocity * SIM_DEG_PER_STEP;
+        break;
+    case Joint::STARTCAPTURE:
+    {
+        if (rx_length < 4)
+        {
+            break;
+        }
+        u_int16_t divider, samples;
+        memcpy(&divider, rx_buf, sizeof(divider));
+        memcpy(&samples, rx_buf + 2, sizeof(samples));
+        if (samples)
+        {
+            dev.capture.clear();
+            dev.captureTaken = 0;
+            dev.captureDivider = divider ? divider : 1;
+            dev.captureTick = dev.captureDivider - 1;
+        }
+        dev.captureLeft = samples;
+        break;
+    }
+    case Joint::LATCHANGLE:
+        if (!dev.isStalled)
+        {
+            dev.latched = true;
+            dev.latchedAngle = f;
+        }
+        break;
+    case Joint::COMMIT:
+        if (!dev.latched || dev.isStalled)
+        {
+            break;
+        }
+        dev.latched = false;
+        if (dev.interp == Joint::INTERP_OFF)
+        {
+            dev.pvtCount = 0;
+            dev.mode = POSITION;
+            dev.target = dev.latchedAngle;
+        }
+        else
+        {
+            this->sample(dev, dev.latchedAngle);
+        }
+        break;
+    case Joint::SETBRAKEMODE:
+    case Joint::DISABLECLOSEDLOOP:
+    case Joint::CHECKORIENTATION:
+        break;
+    default:
+        std::cerr << "SIM: Unknown command " << reg << std::endl;
+        break;
+    }
+}
+
+int Sim_backend::open(const int dev_addr)
+{
+    for (size_t i = 0; i < this->devices.size(); i++)
+    {
+        if (this->devices[i].address == dev_addr)
+        {
+            this->handles.push_back(i);
+            return this->handles.size() - 1;
+        }
+    }
+    std::cerr << "I2C OPEN ERROR: \'SIM: no device at " << dev_addr << "\'" << std::endl;
+    return -1;
+}
+
+int Sim_backend::readOnce(const int dev_handle, const int reg, char *buffer, const int data_length)
+{
+    if (dev_handle < 0 || dev_handle >= static_cast<int>(this->handles.size()) || this->handles[dev_handle] < 0)
+    {
+        return -1;
+    }
+    return this->readBatchOnce(dev_handle, &this->devices[this->handles[dev_handle]].address, 1, reg, buffer, data_length);
+}
+
+int Sim_backend::checkFrame(const Sim_device &dev, const int reg, const char *frame, const int length)
+{
+    const uint8_t head[2] = {static_cast<uint8_t>(dev.address), static_cast<uint8_t>(reg | I2C_FRAMED)};
+    const uint8_t header = frame[0];
+    const int n = header & 0x3F;
+    if (length < I2C_FRAME_OVERHEAD || header >> 6 != I2C_FRAME_VERSION || n > MAX_BUFFER || length != n + I2C_FRAME_OVERHEAD)
+    {
+        return -1;
+    }
+    if (crc8(reinterpret_cast<const uint8_t *>(frame), n + 1, crc8(head, sizeof(head))) != static_cast<uint8_t>(frame[n + 1]))
+    {
+        return -1;
+    }
+    return n;
+}
+
+int Sim_backend::frameReply(const Sim_device &dev, const int reg, char *buffer, const int n)
+{
+    const uint8_t head[2] = {static_cast<uint8_t>(dev.address), static_cast<uint8_t>(reg | I2C_FRAMED)};
+    memmove(buffer + 1, buffer, n);
+    buffer[0] = static_cast<char>(I2C_FRAME_VERSION << 6 | (n - RFLAGS_SIZE));
+    buffer[n + 1] = crc8(reinterpret_cast<const uint8_t *>(buffer), n + 1, crc8(head, sizeof(head)));
+    return n + I2C_FRAME_OVERHEAD;
+}
+
+int Sim_backend::writeOnce(const int dev_handle, const int reg, char *tx_buffer, const int data_length, char *rx_buffer, const int rx_length)
+{
+    if (dev_handle < 0 || dev_handle >= static_cast<int>(this->handles.size()) || this->handles[dev_handle] < 0)
+    {
+        return -1;
+    }
+    if (data_length > MAX_BUFFER + I2C_FRAME_OVERHEAD || rx_length > RFLAGS_SIZE + I2C_FRAME_OVERHEAD)
+    {
+        return -1;
+    }
+    // [ADDR W][REG][PAYLOAD] [ADDR R][FLAGS]
+    int rc = this->transact(data_length + rx_length + 3);
+    if (rc < 0)
+    {
+        return rc;
+    }
+
+    Sim_device &dev = this->devices[this->handles[dev_handle]];
+    this->update(dev);
+    char rx_buf[MAX_BUFFER + I2C_FRAME_OVERHEAD];
+    memcpy(rx_buf, tx_buffer, data_length);
+    this->corrupt(rx_buf, data_length);
+
+    // The flags are sent before the command is executed
+    char tx_buf[RFLAGS_SIZE + I2C_FRAME_OVERHEAD];
+    tx_buf[0] = this->state(dev);
+    int n = RFLAGS_SIZE;
+    if (reg & I2C_FRAMED)
+    {
+        // a rejected command is not executed
+        int length = this->checkFrame(dev, reg & ~I2C_FRAMED, rx_buf, data_length);
+        if (length < 0)
+        {
+            tx_buf[0] |= I2C_FRAME_ERROR;
+        }
+        else
+        {
+            this->receive(dev, reg & ~I2C_FRAMED, rx_buf + 1, length);
+        }
+        n = this->frameReply(dev, reg & ~I2C_FRAMED, tx_buf, n);
+    }
+    else
+    {
+        this->receive(dev, reg, rx_buf, data_length);
+    }
+    this->corrupt(tx_buf, n);
+    // The master clocks out rx_length bytes, missing bytes read as 0xFF
+    memset(rx_buffer, 0xFF, rx_length);
+    memcpy(rx_buffer, tx_buf, std::min(n, rx_length));
+    return rx_length;
+}
+
+int Sim_backend::broadcastOnce(const int dev_handle, const int reg, char *tx_buffer, const int data_length)
+{
+    (void)dev_handle;
+    if (data_length > MAX_BUFFER)
+    {
+        return -1;
+    }
+    // [GENERAL CALL W][REG][PAYLOAD]
+    int rc = this->transact(data_length + 2);
+    if (rc < 0)
+    {
+        return rc;
+    }
+
+    // all joints receive the same bytes
+    char rx_buf[MAX_BUFFER];
+    memcpy(rx_buf, tx_buffer, data_length);
+    this->corrupt(rx_buf, data_length);
+    for (Sim_device &dev : this->devices)
+    {
+        this->update(dev);
+        this->receive(dev, reg, rx_buf, data_length);
+    }
+    return 0;
+}
+
+int Sim_backend::readBatchOnce(const int dev_handle, const int *dev_addrs, const int n_devs, const int reg, char *buffer, const int data_length)
+{
+    (void)dev_handle;
+    if (data_length > MAX_BUFFER + RFLAGS_SIZE + I2C_FRAME_OVERHEAD)
+    {
+        return -1;
+    }
+    // [ADDR W][REG] [ADDR R][DATA] per device
+    int rc = this->transact(n_devs * (data_length + 3));
+    if (rc < 0)
+    {
+        return rc;
+    }
+
+    for (int i = 0; i < n_devs; i++)
+    {
+        Sim_device *dev = this->find(dev_addrs[i]);
+        if (!dev)
+        {
+            return -ENXIO; // NACK
+        }
+        this->update(*dev);
+
+        char tx_buf[MAX_BUFFER + RFLAGS_SIZE + I2C_FRAME_OVERHEAD];
+        int n = this->request(*dev, reg & ~I2C_FRAMED, tx_buf);
+        if (reg & I2C_FRAMED)
+        {
+            n = this->frameReply(*dev, reg & ~I2C_FRAMED, tx_buf, n);
+        }
+        this->corrupt(tx_buf, n);
+        // The master clocks out data_length bytes, missing bytes read as 0xFF
+        memset(buffer + i * data_length, 0xFF, data_length);
+        memcpy(buffer + i * data_length, tx_buf, std::min(n, data_length));
+    }
+    return n_devs * data_length;
+}
+
+int Sim_backend::address(const int dev_handle)
+{
+    if (dev_handle < 0 || dev_handle >= static_cast<int>(this->handles.size()) || this->handles[dev_handle] < 0)
+    {
+        return -1;
+    }
+    return this->devices[this->handles[dev_handle]].address;
+}
+
+int Sim_backend::close(const int dev_handle)
+{
+    if (dev_handle < 0 || dev_handle >= static_cast<int>(this->handles.size()) || this->handles[dev_handle] < 0)
+    {
+        return -1;
+    }
+    this->handles[dev_handle] = -1;
+    return 0;
+}
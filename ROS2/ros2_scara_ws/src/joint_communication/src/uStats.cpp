@@ -0,0 +1,178 @@
+#include "joint_communication/uStats.h"
+
+#include <cstdio>
+
+uint64_t Bus_stats_entry::latencyPercentile(const double p) const
+{
+    uint64_t n = 0;
+    for (int i = 0; i < STATS_LAT_BUCKETS; i++)
+    {
+        n += this->latency[i];
+    }
+    if (!n)
+    {
+        return 0;
+    }
+
+    uint64_t acc = 0;
+    for (int i = 0; i < STATS_LAT_BUCKETS; i++)
+    {
+        acc += this->latency[i];
+        if (acc >= p * n)
+        {
+            return 1ull << i;
+        }
+    }
+    return 1ull << (STATS_LAT_BUCKETS - 1);
+}
+
+int Bus_stats::slot(const int dev_addr, const bool claim) const
+{
+    if (dev_addr < 0)
+    {
+        return -1;
+    }
+
+    // slots store the address + 1, hence broadcasts to I2C_GENERAL_CALL (0) are tracked as well
+    const int key = dev_addr + 1;
+    for (int i = 0; i < STATS_MAX_DEVS; i++)
+    {
+        int a = this->addrs[i].load(std::memory_order_acquire);
+        if (a == key)
+        {
+            return i;
+        }
+        if (a == 0)
+        {
+            if (!claim)
+            {
+                return -1;
+            }
+            // Claim the free slot, if another thread was faster check whether it claimed it for the same address
+            if (this->addrs[i].compare_exchange_strong(a, key, std::memory_order_acq_rel) || a == key)
+            {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+void Bus_stats::record(const int dev_addr, const int reg, const uint64_t latency_us, const int retries, const int rc)
+{
+    int s = this->slot(dev_addr, true);
+    if (s < 0 || reg < 0 || reg >= STATS_MAX_REGS)
+    {
+        return;
+    }
+
+    Cell &cell = this->cells[s][reg];
+    cell.count.fetch_add(1, std::memory_order_relaxed);
+
+    int bucket = 0;
+    while (bucket < STATS_LAT_BUCKETS - 1 && latency_us >= (1ull << bucket))
+    {
+        bucket++;
+    }
+    cell.latency[bucket].fetch_add(1, std::memory_order_relaxed);
+    cell.retries[retries < STATS_RETRY_BUCKETS ? retries : STATS_RETRY_BUCKETS - 1].fetch_add(1, std::memory_order_relaxed);
+
+    if (rc < 0)
+    {
+        cell.errors.fetch_add(1, std::memory_order_relaxed);
+        int code = -rc < STATS_ERROR_CODES ? -rc : STATS_ERROR_CODES - 1;
+        this->error_codes[s][code].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+int Bus_stats::get(const int dev_addr, const int reg, Bus_stats_entry &entry) const
+{
+    int s = this->slot(dev_addr, false);
+    if (s < 0 || reg < 0 || reg >= STATS_MAX_REGS)
+    {
+        return -1;
+    }
+
+    const Cell &cell = this->cells[s][reg];
+    entry.count = cell.count.load(std::memory_order_relaxed);
+    entry.errors = cell.errors.load(std::memory_order_relaxed);
+    for (int i = 0; i < STATS_LAT_BUCKETS; i++)
+    {
+        entry.latency[i] = cell.latency[i].load(std::memory_order_relaxed);
+    }
+    for (int i = 0; i < STATS_RETRY_BUCKETS; i++)
+    {
+        entry.retries[i] = cell.retries[i].load(std::memory_order_relaxed);
+    }
+    return 0;
+}
+
+uint32_t Bus_stats::errorCount(const int dev_addr, const int rc) const
+{
+    int s = this->slot(dev_addr, false);
+    if (s < 0)
+    {
+        return 0;
+    }
+    int code = rc < 0 ? -rc : rc;
+    return this->error_codes[s][code < STATS_ERROR_CODES ? code : STATS_ERROR_CODES - 1].load(std::memory_order_relaxed);
+}
+
+void Bus_stats::print(std::ostream &os) const
+{
+    char line[128];
+    os << "ADDR REG   COUNT  ERRORS RETRIED   P50[us]   P99[us]" << std::endl;
+    for (int s = 0; s < STATS_MAX_DEVS; s++)
+    {
+        int addr = this->addrs[s].load(std::memory_order_acquire) - 1;
+        if (addr < 0)
+        {
+            continue;
+        }
+        for (int reg = 0; reg < STATS_MAX_REGS; reg++)
+        {
+            Bus_stats_entry e;
+            this->get(addr, reg, e);
+            if (!e.count)
+            {
+                continue;
+            }
+            snprintf(line, sizeof(line), "%#4x %#4x %7u %7u %7u %9llu %9llu", addr, reg, e.count, e.errors, e.count - e.retries[0],
+                     static_cast<unsigned long long>(e.latencyPercentile(0.5)), static_cast<unsigned long long>(e.latencyPercentile(0.99)));
+            os << line << std::endl;
+        }
+        for (int code = 1; code < STATS_ERROR_CODES; code++)
+        {
+            uint32_t n = this->error_codes[s][code].load(std::memory_order_relaxed);
+            if (n)
+            {
+                os << "     error " << -code << ": " << n << std::endl;
+            }
+        }
+    }
+}
+
+void Bus_stats::reset(void)
+{
+    for (int s = 0; s < STATS_MAX_DEVS; s++)
+    {
+        for (int reg = 0; reg < STATS_MAX_REGS; reg++)
+        {
+            Cell &cell = this->cells[s][reg];
+            cell.count.store(0, std::memory_order_relaxed);
+            cell.errors.store(0, std::memory_order_relaxed);
+            for (auto &b : cell.latency)
+            {
+                b.store(0, std::memory_order_relaxed);
+            }
+            for (auto &b : cell.retries)
+            {
+                b.store(0, std::memory_order_relaxed);
+            }
+        }
+        for (auto &n : this->error_codes[s])
+        {
+            n.store(0, std::memory_order_relaxed);
+        }
+    }
+}
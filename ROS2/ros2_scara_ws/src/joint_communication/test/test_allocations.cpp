@@ -0,0 +1,119 @@
+/**
+ * @file test_allocations.cpp
+ * @author Sebastian Storz
+ * @brief Checks that the steady-state control loop does not allocate
+ * @version 0.1
+ * @date 2025-06-20
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * The global operator new is replaced by a counting one. Every cycle of the control loop runs
+ * setPositions() and getPositions() on simulated joints, after a warm-up cycle no allocation is allowed.
+ */
+#include <gtest/gtest.h>
+
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "joint_communication/mJointCom.h"
+#include "joint_communication/uClock.h"
+#include "joint_communication/uSim.h"
+
+static std::atomic<long> allocations{0};
+
+// not inlined, so the compiler does not pair the malloc() and free() inside with the callers
+__attribute__((noinline)) void *operator new(size_t n)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(n ? n : 1);
+    if (!p)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+/**
+ * @brief Four homed joints on a simulated bus
+ */
+class Allocations : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        setClock(std::make_shared<Virtual_clock>());
+        this->sim = std::make_shared<Sim_backend>();
+        for (int a = 0x11; a <= 0x14; a++)
+        {
+            this->sim->addDevice(a);
+            this->joints.addJoint(a, "j" + std::to_string(a), 35, 10, this->sim);
+        }
+        ASSERT_EQ(this->joints.init(), 0);
+        ASSERT_EQ(this->joints.enables(30, 10), 0);
+        for (auto &j : this->joints.joints)
+        {
+            j.home(0, 20, 30, 15);
+        }
+        getClock().sleep(10000000);
+    }
+
+    void TearDown() override
+    {
+        this->joints.stopBusThread();
+        setClock(nullptr);
+    }
+
+    /**
+     * @brief Runs the control loop and counts the allocations after the first cycle.
+     */
+    long cycles(const int n)
+    {
+        this->joints.setPositions(this->setpoints);
+        this->joints.getPositions(this->positions);
+        long before = allocations.load();
+        for (int i = 0; i < n; i++)
+        {
+            this->setpoints[0] = i * 0.01f;
+            this->joints.setPositions(this->setpoints);
+            this->joints.getPositions(this->positions);
+            getClock().sleep(100);
+        }
+        return allocations.load() - before;
+    }
+
+    std::shared_ptr<Sim_backend> sim;
+    Joint_comms joints;
+    std::array<float, 4> setpoints{1, 2, 3, 4};
+    std::array<float, 4> positions{};
+};
+
+TEST_F(Allocations, SerialReads)
+{
+    this->joints.setBatchedReads(false);
+    EXPECT_EQ(this->cycles(1000), 0);
+}
+
+TEST_F(Allocations, BatchedReads)
+{
+    this->joints.setBatchedReads(true);
+    EXPECT_EQ(this->cycles(1000), 0);
+}
+
+TEST_F(Allocations, BusThread)
+{
+    ASSERT_EQ(this->joints.startBusThread(1000), 0);
+    getClock().sleep(20000);
+    EXPECT_EQ(this->cycles(1000), 0);
+}
@@ -0,0 +1,231 @@
+/**
+ * @file test_rs485.cpp
+ * @author Sebastian Storz
+ * @brief Host tests of the RS485_backend on a pseudo terminal
+ * @version 0.1
+ * @date 2025-06-20
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * The backend opens the slave side of an openpty() pair. A responder thread plays the joint on the master side:
+ * it receives one request frame and answers with scripted bytes, which may be corrupted or missing.
+ */
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "joint_communication/uRS485.h"
+
+/**
+ * @brief Builds a frame as sent by the host or the firmware.
+ */
+static std::vector<uint8_t> frame(const uint8_t addr, const uint8_t reg, const std::vector<uint8_t> &payload)
+{
+    std::vector<uint8_t> f = {FRAME_SYNC, addr, reg, static_cast<uint8_t>(payload.size())};
+    f.insert(f.end(), payload.begin(), payload.end());
+    f.push_back(crc8(&f[1], 3 + payload.size()));
+    return f;
+}
+
+/**
+ * @brief Pseudo terminal with the backend on the slave side
+ */
+class Rs485 : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        char name[64];
+        ASSERT_EQ(openpty(&this->master, &this->slave, name, nullptr, nullptr), 0);
+        this->bus = std::make_unique<RS485_backend>(name, 1000000, 20000);
+        this->handle = this->bus->open(0x11);
+        ASSERT_GE(this->handle, 0);
+
+        // every failed attempt is reported, retries would hide it
+        Retry_policy once;
+        once.max_attempts = 1;
+        this->bus->setRetryPolicy(once);
+    }
+
+    void TearDown() override
+    {
+        if (this->responder.joinable())
+        {
+            this->responder.join();
+        }
+        this->bus.reset();
+        ::close(this->slave);
+        ::close(this->master);
+    }
+
+    /**
+     * @brief Receives one request frame on the master side.
+     * @return the frame, empty if none arrived within a second.
+     */
+    std::vector<uint8_t> receive(void)
+    {
+        std::vector<uint8_t> f;
+        uint8_t b;
+        while (f.size() < 4 || f.size() < FRAME_OVERHEAD + static_cast<size_t>(f[3]))
+        {
+            struct pollfd pfd = {this->master, POLLIN, 0};
+            if (poll(&pfd, 1, 1000) <= 0 || ::read(this->master, &b, 1) != 1)
+            {
+                return {};
+            }
+            f.push_back(b);
+        }
+        return f;
+    }
+
+    /**
+     * @brief Answers the next request in the background.
+     * @param reply returns the bytes to send for a request, nothing is sent if they are empty.
+     */
+    void respond(std::function<std::vector<uint8_t>(const std::vector<uint8_t> &)> reply)
+    {
+        this->responder = std::thread([this, reply]()
+                                      {
+            this->request = this->receive();
+            std::vector<uint8_t> r = reply(this->request);
+            if (!r.empty())
+            {
+                ASSERT_EQ(::write(this->master, r.data(), r.size()), static_cast<ssize_t>(r.size()));
+            } });
+    }
+
+    int master = -1;
+    int slave = -1;
+    std::unique_ptr<RS485_backend> bus;
+    int handle = -1;
+    std::thread responder;
+    std::vector<uint8_t> request; ///< last request received by the responder
+};
+
+TEST_F(Rs485, ReadRequestAndReply)
+{
+    this->respond([](const std::vector<uint8_t> &)
+                  { return frame(0x11 | FRAME_REPLY, 0x0A, {1, 2, 3, 4, 0x0C}); });
+    char buf[5];
+    EXPECT_EQ(this->bus->read(this->handle, 0x0A, buf, 5), 5);
+    this->responder.join();
+
+    // a read is a request without payload
+    EXPECT_EQ(this->request, frame(0x11, 0x0A, {}));
+    EXPECT_EQ(std::vector<uint8_t>(buf, buf + 5), (std::vector<uint8_t>{1, 2, 3, 4, 0x0C}));
+}
+
+TEST_F(Rs485, CommandCarriesPayload)
+{
+    this->respond([](const std::vector<uint8_t> &)
+                  { return frame(0x11 | FRAME_REPLY, 0x0F, {0x08}); });
+    char payload[4] = {0x10, 0x20, 0x30, 0x40};
+    char flags = 0;
+    EXPECT_EQ(this->bus->write(this->handle, 0x0F, payload, 4, &flags), RFLAGS_SIZE);
+    this->responder.join();
+
+    EXPECT_EQ(this->request, frame(0x11, 0x0F, {0x10, 0x20, 0x30, 0x40}));
+    EXPECT_EQ(flags, 0x08);
+}
+
+TEST_F(Rs485, SkipsEchoAndNoise)
+{
+    // a transceiver which echoes the request and noise before the reply
+    this->respond([](const std::vector<uint8_t> &request)
+                  {
+        std::vector<uint8_t> r = request;
+        r.insert(r.end(), {0x00, 0xFF, 0x13});
+        std::vector<uint8_t> reply = frame(0x11 | FRAME_REPLY, 0x0A, {7, 0x04});
+        r.insert(r.end(), reply.begin(), reply.end());
+        return r; });
+    char buf[2];
+    EXPECT_EQ(this->bus->read(this->handle, 0x0A, buf, 2), 2);
+    EXPECT_EQ(buf[0], 7);
+}
+
+TEST_F(Rs485, NoReplyTimesOut)
+{
+    this->respond([](const std::vector<uint8_t> &)
+                  { return std::vector<uint8_t>(); });
+    char buf[2];
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(this->bus->read(this->handle, 0x0A, buf, 2), -ETIMEDOUT);
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(20));
+}
+
+TEST_F(Rs485, ReplyOfAnotherJointTimesOut)
+{
+    this->respond([](const std::vector<uint8_t> &)
+                  { return frame(0x12 | FRAME_REPLY, 0x0A, {7, 0x04}); });
+    char buf[2];
+    EXPECT_EQ(this->bus->read(this->handle, 0x0A, buf, 2), -ETIMEDOUT);
+}
+
+TEST_F(Rs485, CorruptedReplyFailsCrc)
+{
+    this->respond([](const std::vector<uint8_t> &)
+                  {
+        std::vector<uint8_t> r = frame(0x11 | FRAME_REPLY, 0x0A, {7, 0x04});
+        r[4] ^= 0x01;
+        return r; });
+    char buf[2];
+    EXPECT_EQ(this->bus->read(this->handle, 0x0A, buf, 2), -EBADMSG);
+
+    Bus_stats_entry e;
+    ASSERT_EQ(this->bus->getStats().get(0x11, 0x0A, e), 0);
+    EXPECT_EQ(e.errors, 1u);
+}
+
+TEST_F(Rs485, ReplyLengthMismatch)
+{
+    this->respond([](const std::vector<uint8_t> &)
+                  { return frame(0x11 | FRAME_REPLY, 0x0A, {7}); });
+    char buf[2];
+    EXPECT_EQ(this->bus->read(this->handle, 0x0A, buf, 2), -EBADMSG);
+}
+
+TEST_F(Rs485, BroadcastIsNotAnswered)
+{
+    this->respond([](const std::vector<uint8_t> &)
+                  { return std::vector<uint8_t>(); });
+    char payload = 0;
+    EXPECT_EQ(this->bus->broadcast(this->handle, 0x34, &payload, 1), 0);
+    this->responder.join();
+    EXPECT_EQ(this->request, frame(I2C_GENERAL_CALL, 0x34, {0}));
+}
+
+TEST_F(Rs485, FramingIsNotSupported)
+{
+    EXPECT_EQ(this->bus->setFraming(true), -ENOTSUP);
+    EXPECT_EQ(this->bus->setFraming(false), 0);
+}
+
+TEST_F(Rs485, ReopenReusesHandle)
+{
+    int other = this->bus->open(0x12);
+    ASSERT_GE(other, 0);
+
+    // recover() closes and reopens the handle of a joint, the table must not grow
+    for (int i = 0; i < 10; i++)
+    {
+        ASSERT_EQ(this->bus->close(this->handle), 0);
+        EXPECT_EQ(this->bus->open(0x11), this->handle);
+    }
+    EXPECT_EQ(this->bus->close(other), 0);
+
+    // the reused handle still addresses its joint
+    this->respond([](const std::vector<uint8_t> &)
+                  { return frame(0x11 | FRAME_REPLY, 0x0A, {7, 0x04}); });
+    char buf[2];
+    EXPECT_EQ(this->bus->read(this->handle, 0x0A, buf, 2), 2);
+    this->responder.join();
+    EXPECT_EQ(this->request, frame(0x11, 0x0A, {}));
+}
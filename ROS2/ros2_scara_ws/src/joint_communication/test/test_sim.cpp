@@ -0,0 +1,223 @@
+/**
+ * @file test_sim.cpp
+ * @author Sebastian Storz
+ * @brief Regression tests of the simulated bus and the retry logic of Bus_backend
+ * @version 0.1
+ * @date 2025-06-20
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * All tests run on a Virtual_clock, hence the timing is exact and independent of the host.
+ */
+#include <gtest/gtest.h>
+
+#include "joint_communication/mJointCom.h"
+#include "joint_communication/uClock.h"
+#include "joint_communication/uSim.h"
+
+/**
+ * @brief One simulated joint on a virtual clock
+ */
+class Sim : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        this->clock = std::make_shared<Virtual_clock>();
+        setClock(this->clock);
+        this->sim = std::make_shared<Sim_backend>();
+        this->sim->addDevice(0x11);
+        this->handle = this->sim->open(0x11);
+        ASSERT_GE(this->handle, 0);
+    }
+
+    void TearDown() override
+    {
+        setClock(nullptr);
+    }
+
+    /**
+     * @brief Reads PING once.
+     * @return return code of Bus_backend::read().
+     */
+    int ping(void)
+    {
+        char buf[1 + RFLAGS_SIZE];
+        return this->sim->read(this->handle, Joint::PING, buf, sizeof(buf));
+    }
+
+    /**
+     * @brief Number of failed reads out of \a n.
+     */
+    int failedPings(const int n)
+    {
+        int failed = 0;
+        for (int i = 0; i < n; i++)
+        {
+            failed += this->ping() < 0;
+        }
+        return failed;
+    }
+
+    std::shared_ptr<Virtual_clock> clock;
+    std::shared_ptr<Sim_backend> sim;
+    int handle = -1;
+};
+
+TEST_F(Sim, VirtualClockOnlyAdvancesBySleep)
+{
+    uint64_t t0 = getClock().now();
+    EXPECT_EQ(this->ping(), 1 + RFLAGS_SIZE);
+    EXPECT_EQ(getClock().now(), t0); // no transaction time by default
+
+    getClock().sleep(1234);
+    EXPECT_EQ(getClock().now(), t0 + 1234);
+}
+
+TEST_F(Sim, TransactionTimeIsSpentOnTheClock)
+{
+    this->sim->setTransactionTime(500);
+    uint64_t t0 = getClock().now();
+    ASSERT_GE(this->ping(), 0);
+    EXPECT_EQ(getClock().now() - t0, 500u);
+
+    // the wire time of 9 bits per byte is added once a clock speed is set
+    ASSERT_EQ(this->sim->setSpeed(100000), 0);
+    t0 = getClock().now();
+    ASSERT_GE(this->ping(), 0);
+    EXPECT_GT(getClock().now() - t0, 500u);
+    EXPECT_EQ((getClock().now() - t0 - 500) % 90, 0u);
+}
+
+TEST_F(Sim, SpeedLimitFailsEveryTenthTransaction)
+{
+    Retry_policy once;
+    once.max_attempts = 1;
+    this->sim->setRetryPolicy(once);
+    ASSERT_EQ(this->sim->setSpeed(400000), 0);
+    this->sim->setSpeedLimit(100000);
+    EXPECT_EQ(this->failedPings(100), 10);
+
+    // below the limit nothing fails
+    ASSERT_EQ(this->sim->setSpeed(100000), 0);
+    EXPECT_EQ(this->failedPings(100), 0);
+}
+
+TEST_F(Sim, RetriesHideSporadicErrors)
+{
+    ASSERT_EQ(this->sim->setSpeed(400000), 0);
+    this->sim->setSpeedLimit(100000);
+    EXPECT_EQ(this->failedPings(100), 0);
+
+    Bus_stats_entry e;
+    ASSERT_EQ(this->sim->getStats().get(0x11, Joint::PING, e), 0);
+    EXPECT_EQ(e.count, 100u);
+    EXPECT_EQ(e.errors, 0u);
+    EXPECT_GT(e.count - e.retries[0], 0u); // some transactions needed a retry
+}
+
+TEST_F(Sim, HangTimesOutUntilReset)
+{
+    Retry_policy once;
+    once.max_attempts = 1;
+    this->sim->setRetryPolicy(once);
+    this->sim->hang(1000000);
+    EXPECT_EQ(this->ping(), -ETIMEDOUT);
+    EXPECT_EQ(this->ping(), -ETIMEDOUT);
+    EXPECT_EQ(this->sim->reset(), 0);
+    EXPECT_GE(this->ping(), 0);
+}
+
+TEST_F(Sim, BackoffOutlastsShortHang)
+{
+    Retry_policy patient;
+    patient.max_attempts = 5;
+    patient.backoff_us = 1000;
+    patient.backoff_factor = 2;
+    this->sim->setRetryPolicy(patient);
+
+    // attempts at 0, 1, 3, 7 ms
+    this->sim->hang(5000);
+    uint64_t t0 = getClock().now();
+    EXPECT_GE(this->ping(), 0);
+    EXPECT_EQ(getClock().now() - t0, 7000u);
+}
+
+TEST_F(Sim, DeadlineStopsRetries)
+{
+    Retry_policy tight;
+    tight.max_attempts = 100;
+    tight.backoff_us = 1000;
+    tight.deadline_us = 5500;
+    this->sim->setRetryPolicy(tight);
+
+    this->sim->hang(1000000);
+    uint64_t t0 = getClock().now();
+    EXPECT_EQ(this->ping(), -ETIMEDOUT);
+    EXPECT_EQ(getClock().now() - t0, 5000u); // no retry is started which would end after the deadline
+}
+
+TEST_F(Sim, FramingRejectsCorruption)
+{
+    Joint joint(0x11, "j", 1, 0, this->sim);
+    ASSERT_EQ(joint.init(), 0);
+    ASSERT_EQ(this->sim->setFraming(true), 0);
+    this->sim->setCorruption(3);
+
+    // every corrupted message is rejected by the checksum and retried
+    float angle = 1;
+    for (int i = 0; i < 100; i++)
+    {
+        ASSERT_EQ(joint.getPosition(angle), 0);
+        EXPECT_EQ(angle, 0);
+    }
+}
+
+TEST_F(Sim, RebootForgetsSetup)
+{
+    Joint joint(0x11, "j", 1, 0, this->sim);
+    ASSERT_EQ(joint.init(), 0);
+    ASSERT_EQ(joint.enable(30, 10), 0);
+    u_int8_t setup = 0;
+    ASSERT_EQ(joint.getIsSetup(setup), 0);
+    EXPECT_TRUE(setup);
+
+    // the flags of the last transaction answer until they are too old
+    this->sim->reboot(0x11);
+    getClock().sleep(FLAGS_MAX_AGE_US + 1);
+    ASSERT_EQ(joint.getIsSetup(setup), 0);
+    EXPECT_FALSE(setup);
+}
+
+TEST_F(Sim, MotionFollowsTheClock)
+{
+    Joint joint(0x11, "j", 1, 0, this->sim);
+    ASSERT_EQ(joint.init(), 0);
+    ASSERT_EQ(joint.enable(30, 10), 0);
+    ASSERT_EQ(joint.home(0, 20, 30, 15), 0);
+    float angle = 1;
+    ASSERT_EQ(joint.getPosition(angle), 0);
+    EXPECT_NEAR(angle, 0, 0.1);
+
+    ASSERT_EQ(joint.setPosition(90), 0);
+    getClock().sleep(10000);
+    ASSERT_EQ(joint.getPosition(angle), 0);
+    EXPECT_GT(angle, 0);
+    EXPECT_LT(angle, 90);
+
+    getClock().sleep(5000000);
+    ASSERT_EQ(joint.getPosition(angle), 0);
+    EXPECT_NEAR(angle, 90, 0.1);
+}
+
+TEST_F(Sim, CaptureIsRefusedWhileTheBusThreadRuns)
+{
+    Joint_comms joints;
+    joints.addJoint(0x11, "j", 1, 0, this->sim);
+    ASSERT_EQ(joints.init(), 0);
+    std::vector<Telemetry_sample> series;
+    ASSERT_EQ(joints.startBusThread(1000), 0);
+    EXPECT_EQ(joints.joints[0].captureTelemetry(100, 10, series), -3);
+    joints.stopBusThread();
+    EXPECT_GE(joints.joints[0].captureTelemetry(100, 10, series), 0);
+}